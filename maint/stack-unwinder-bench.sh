@@ -0,0 +1,85 @@
+#!/bin/sh -efu
+#
+# Measure the cost of strace -k with different stack unwinders.
+#
+# Usage: stack-unwinder-bench.sh STRACE [STRACE-LIBUNWIND [CALLS [DEPTH]]]
+#
+# STRACE is a strace built with libdw, it is used to measure the libdw
+# and the frame pointer based unwinders.  STRACE-LIBUNWIND, if specified
+# and not empty, is a strace built with libunwind.  The traced program
+# makes CALLS getppid syscalls from DEPTH nested frames.
+#
+# Copyright (c) 2021 The strace developers.
+# All rights reserved.
+#
+# SPDX-License-Identifier: LGPL-2.1-or-later
+
+strace="$1"; shift
+strace_libunwind="${1-}"; [ $# -eq 0 ] || shift
+calls="${1-100000}"; [ $# -eq 0 ] || shift
+depth="${1-32}"; [ $# -eq 0 ] || shift
+
+: "${CC:=cc}"
+
+tmpdir="$(mktemp -d)"
+trap 'rm -rf -- "$tmpdir"' EXIT
+
+cat > "$tmpdir/bench.c" <<'__EOF__'
+#include <stdlib.h>
+#include <unistd.h>
+
+static void __attribute__((noinline))
+recurse(unsigned int depth, unsigned long calls)
+{
+	if (depth > 1) {
+		recurse(depth - 1, calls);
+		__asm__ volatile("" ::: "memory");
+		return;
+	}
+	while (calls--)
+		getppid();
+}
+
+int
+main(int ac, char **av)
+{
+	recurse(atoi(av[2]), strtoul(av[1], NULL, 0));
+	return 0;
+}
+__EOF__
+$CC -O2 -g -fno-omit-frame-pointer -o "$tmpdir/bench" "$tmpdir/bench.c"
+
+now()
+{
+	date +%s%N
+}
+
+run()
+{
+	local start end
+	start="$(now)"
+	"$@" -qq -o /dev/null -e trace=getppid \
+		"$tmpdir/bench" "$calls" "$depth"
+	end="$(now)"
+	echo $((end - start))
+}
+
+base="$(run "$strace")"
+printf '%-12s %10s us/syscall\n' none \
+	"$(echo "$base $calls" | awk '{printf "%.2f", $1 / $2 / 1000}')"
+
+bench()
+{
+	local name t
+	name="$1"; shift
+	t="$(run "$@" -k --stack-unwinder="$name")"
+	printf '%-12s %10s us/syscall %10s us/stack\n' "$name" \
+		"$(echo "$t $calls" | awk '{printf "%.2f", $1 / $2 / 1000}')" \
+		"$(echo "$t $base $calls" |
+		   awk '{printf "%.2f", ($1 - $2) / $3 / 1000}')"
+}
+
+bench libdw "$strace"
+bench fp "$strace"
+[ -z "$strace_libunwind" ] ||
+	bench libunwind "$strace_libunwind"
@@ -12,6 +12,7 @@
 
 #include "defs.h"
 #include "scno.h"
+#include "sen.h"
 #include <linux/sched.h>
 
 #include "xlat/clone_flags.h"
@@ -295,6 +296,19 @@ out:
 }
 
 
+bool
+get_clone_flags(struct tcb *const tcp, uint64_t *const flags)
+{
+	if (tcp_sysent(tcp)->sen == SEN_clone3) {
+		/* flags is the first field of struct clone_args. */
+		return tcp->u_arg[1] >= sizeof(*flags) &&
+			!umove(tcp, tcp->u_arg[0], flags);
+	}
+
+	*flags = tcp->u_arg[ARG_FLAGS];
+	return true;
+}
+
 SYS_FUNC(setns)
 {
 	printfd(tcp, tcp->u_arg[0]);
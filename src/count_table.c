@@ -0,0 +1,71 @@
+/*
+ * Printing of the summary tables reported on exit.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "count_table.h"
+
+void
+count_table_header(FILE *outf, const struct count_table_column *columns,
+		   size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		if (i)
+			fputc(' ', outf);
+		if (i == count - 1)
+			fputs(columns[i].title, outf);
+		else
+			fprintf(outf, "%*s", columns[i].width,
+				columns[i].title);
+	}
+	fputc('\n', outf);
+
+	count_table_divider(outf, columns, count);
+}
+
+void
+count_table_divider(FILE *outf, const struct count_table_column *columns,
+		    size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		const int c = *columns[i].title ? '-' : ' ';
+		const unsigned int width = abs(columns[i].width);
+
+		if (i)
+			fputc(' ', outf);
+		for (unsigned int j = 0; j < width; ++j)
+			fputc(c, outf);
+	}
+	fputc('\n', outf);
+}
+
+static void
+print_time(FILE *outf, double percent, double seconds, uint64_t calls)
+{
+	fprintf(outf, "%6.2f %11.6f ", percent, seconds);
+	if (calls)
+		fprintf(outf, "%11" PRIu64,
+			(uint64_t) (seconds / calls * 1e6));
+	else
+		fprintf(outf, "%11s", "");
+}
+
+void
+count_table_time(FILE *outf, double seconds, double total_seconds,
+		 uint64_t calls)
+{
+	/* total_seconds can be 0.0 too and we get 0/0 = NAN */
+	print_time(outf, seconds != 0.0 ? 100.0 * seconds / total_seconds : 0,
+		   seconds, calls);
+}
+
+void
+count_table_total_time(FILE *outf, double total_seconds, uint64_t calls)
+{
+	print_time(outf, 100.0, total_seconds, calls);
+}
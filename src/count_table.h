@@ -0,0 +1,45 @@
+/*
+ * Printing of the summary tables reported on exit.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_COUNT_TABLE_H
+# define STRACE_COUNT_TABLE_H
+
+# include <stdint.h>
+# include <stdio.h>
+
+struct count_table_column {
+	/* An empty title leaves the column blank in the divider as well. */
+	const char *title;
+	/* The width of the column, negative for a left-aligned column. */
+	int width;
+};
+
+/*
+ * Prints the titles of the columns and the divider under them,
+ * the last column is not padded.
+ */
+extern void
+count_table_header(FILE *, const struct count_table_column *, size_t count);
+
+/* Prints the divider between the rows and the total. */
+extern void
+count_table_divider(FILE *, const struct count_table_column *, size_t count);
+
+/*
+ * Prints the "% time", "seconds", and "usecs/call" cells the way -c does,
+ * usecs/call is left blank if there are no calls.
+ */
+extern void
+count_table_time(FILE *, double seconds, double total_seconds, uint64_t calls);
+
+/* Likewise, for the total. */
+extern void
+count_table_total_time(FILE *, double total_seconds, uint64_t calls);
+
+#endif /* !STRACE_COUNT_TABLE_H */
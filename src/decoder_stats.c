@@ -0,0 +1,186 @@
+/*
+ * Decoder cost profile: the number of invocations, the time spent,
+ * the bytes fetched from tracees, and the bytes of output produced
+ * by each syscall decoder and ioctl and netlink subdecoder,
+ * requested by --decoder-stats option.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include "count_table.h"
+#include "hash_index.h"
+
+bool decoder_stats_enabled;
+uint64_t decoder_stats_fetched;
+uint64_t decoder_stats_printed;
+
+struct decoder_counts {
+	/* "ioctl" or "netlink" for subdecoders, empty for syscalls. */
+	const char *prefix;
+	const char *name;
+	uint64_t calls;
+	uint64_t ns;
+	uint64_t fetched;
+	uint64_t printed;
+};
+
+static struct decoder_counts *decoder_counts;
+static size_t decoder_counts_count;
+static size_t decoder_counts_size;
+
+static struct hash_index decoder_index;
+
+/*
+ * The decoders in progress, subdecoders are invoked by syscall decoders.
+ * The decoders nested deeper than the stack are not accounted.
+ */
+#define DECODER_STATS_DEPTH	8
+static struct {
+	size_t idx;
+	uint64_t ns;
+	uint64_t fetched;
+	uint64_t printed;
+} stack[DECODER_STATS_DEPTH];
+static unsigned int depth;
+
+/* The key of decoder_index. */
+struct decoder_key {
+	const char *prefix;
+	const char *name;
+};
+
+static bool
+decoder_counts_match(size_t idx, const void *data)
+{
+	const struct decoder_key *key = data;
+
+	return !strcmp(decoder_counts[idx].name, key->name) &&
+	       !strcmp(decoder_counts[idx].prefix, key->prefix);
+}
+
+static size_t
+get_decoder_counts_idx(const char *prefix, const char *name)
+{
+	const struct decoder_key key = { prefix, name };
+	const uint64_t hash =
+		hash_str(hash_str(hash_str(HASH_STR_INIT, prefix), " "), name);
+	const size_t idx = hash_index_get(&decoder_index, hash, &key,
+					  decoder_counts_match,
+					  decoder_counts_count);
+	if (idx < decoder_counts_count)
+		return idx;
+
+	if (decoder_counts_count >= decoder_counts_size)
+		decoder_counts = xgrowarray(decoder_counts,
+					    &decoder_counts_size,
+					    sizeof(*decoder_counts));
+
+	decoder_counts[decoder_counts_count++] = (struct decoder_counts) {
+		.prefix = prefix,
+		.name = name,
+	};
+
+	return idx;
+}
+
+void
+decoder_stats_push(const char *prefix, const char *name, bool invocation)
+{
+	if (depth++ >= DECODER_STATS_DEPTH)
+		return;
+
+	/* The counts may move as the array grows, keep the index. */
+	const size_t idx = get_decoder_counts_idx(prefix ? prefix : "",
+						  name ? name : "???");
+
+	if (invocation)
+		decoder_counts[idx].calls++;
+	stack[depth - 1].idx = idx;
+	stack[depth - 1].fetched = decoder_stats_fetched;
+	stack[depth - 1].printed = decoder_stats_printed;
+	stack[depth - 1].ns = monotonic_ns();
+}
+
+void
+decoder_stats_pop(void)
+{
+	if (!depth || depth-- > DECODER_STATS_DEPTH)
+		return;
+
+	const uint64_t ns = monotonic_ns();
+	struct decoder_counts *dc = &decoder_counts[stack[depth].idx];
+
+	dc->ns += ns - stack[depth].ns;
+	dc->fetched += decoder_stats_fetched - stack[depth].fetched;
+	dc->printed += decoder_stats_printed - stack[depth].printed;
+}
+
+static int
+decoder_counts_cmp(const void *a, const void *b)
+{
+	const struct decoder_counts *dca = a;
+	const struct decoder_counts *dcb = b;
+	int rc;
+
+	if (dca->ns != dcb->ns)
+		return dca->ns < dcb->ns ? 1 : -1;
+	if ((rc = strcmp(dca->prefix, dcb->prefix)))
+		return rc;
+	return strcmp(dca->name, dcb->name);
+}
+
+void
+decoder_stats_print(FILE *outf)
+{
+	uint64_t ns_cum = 0, calls_cum = 0;
+	uint64_t fetched_cum = 0, printed_cum = 0;
+
+	hash_index_free(&decoder_index);
+	qsort(decoder_counts, decoder_counts_count, sizeof(*decoder_counts),
+	      decoder_counts_cmp);
+
+	/* Subdecoders are accounted in their syscall decoders as well. */
+	for (size_t i = 0; i < decoder_counts_count; ++i) {
+		const struct decoder_counts *dc = &decoder_counts[i];
+
+		if (*dc->prefix)
+			continue;
+		ns_cum += dc->ns;
+		calls_cum += dc->calls;
+		fetched_cum += dc->fetched;
+		printed_cum += dc->printed;
+	}
+
+	static const struct count_table_column columns[] = {
+		{ "% time", 6 },
+		{ "seconds", 11 },
+		{ "usecs/call", 11 },
+		{ "calls", 9 },
+		{ "fetched", 11 },
+		{ "printed", 11 },
+		{ "decoder", -16 },
+	};
+
+	fprintf(outf, "Decoder costs:\n");
+	count_table_header(outf, columns, ARRAY_SIZE(columns));
+
+	for (size_t i = 0; i < decoder_counts_count; ++i) {
+		const struct decoder_counts *dc = &decoder_counts[i];
+
+		count_table_time(outf, dc->ns / 1e9, ns_cum / 1e9, dc->calls);
+		fprintf(outf, " %9" PRIu64 " %11" PRIu64 " %11" PRIu64
+			" %s%s%s\n",
+			dc->calls, dc->fetched, dc->printed,
+			dc->prefix, *dc->prefix ? " " : "", dc->name);
+	}
+
+	count_table_divider(outf, columns, ARRAY_SIZE(columns));
+	count_table_total_time(outf, ns_cum / 1e9, calls_cum);
+	fprintf(outf, " %9" PRIu64 " %11" PRIu64 " %11" PRIu64 " total\n",
+		calls_cum, fetched_cum, printed_cum);
+}
@@ -297,11 +297,25 @@ struct tcb {
 	 */
 	unsigned int pid_ns;
 
+	/*
+	 * Thread group ID of this process as present in /proc
+	 * (0: not initialized)
+	 */
+	int tgid;
+
 # ifdef ENABLE_SECONTEXT
 	int last_dirfd; /* Use AT_FDCWD for 'not set' */
 # endif
 
 	struct mmap_cache_t *mmap_cache;
+	/* Generation of the shared mmap_cache last seen by this tcb */
+	unsigned int mmap_cache_generation;
+
+	/* Cache of the descriptor table shared by all threads */
+	struct fd_cache *fd_cache;
+
+	/* Ring of recent output lines for --flight-recorder */
+	struct flight_recorder *flight_recorder;
 
 	/*
 	 * Data that is stored during process wait traversal.
@@ -363,6 +377,8 @@ struct tcb {
 # define TCB_SECCOMP_FILTER		0x40000	/* This process has a seccomp filter
 						 * attached.
 						 */
+# define TCB_ENTRY_ONLY			0x80000	/* Current syscall has been printed
+						   on entering, --entry-only */
 
 /* qualifier flags */
 # define QUAL_TRACE	0x001	/* this system call should be traced */
@@ -503,14 +519,43 @@ extern cflag_t cflag;
 extern bool Tflag;
 extern int Tflag_scale;
 extern int Tflag_width;
+extern bool entry_only;
 extern bool iflag;
 extern bool count_wallclock;
 extern unsigned int pidns_translation;
+extern bool socket_diag_dump;
+extern bool trace_path_inode;
+extern bool io_summary_enabled;
+/* Only syscalls lasting longer than this are printed, if non-zero. */
+extern struct timespec latency_threshold;
+/* The number of output lines kept per tracee, 0 if not in use. */
+extern unsigned int flight_recorder_size;
+/* The maximum number of -ff output files kept open at the same time. */
+extern unsigned int max_output_files;
+/* Are syscalls and signals written as trace events instead of text? */
+extern bool trace_event_output;
+
+static inline bool
+text_output_enabled(void)
+{
+	return cflag != CFLAG_ONLY_STATS && !trace_event_output;
+}
 /* are we filtering traces based on paths? */
 extern struct path_set {
 	const char **paths_selected;
 	size_t num_selected;
 	size_t size;
+	/* Hash index of paths_selected, NULL if none. */
+	struct hash_index *index;
+	/* Trie of directory prefixes and glob patterns, NULL if none. */
+	struct path_trie_node *trie;
+	/* The selected files for --trace-path-inode and their hash index. */
+	struct path_file_id *file_ids;
+	size_t num_file_ids;
+	size_t file_ids_size;
+	struct hash_index *file_id_index;
+	/* Some selected paths could not be stat'ed. */
+	bool unresolved;
 } global_path_set;
 # define tracing_paths (global_path_set.num_selected != 0)
 enum xflag_opts {
@@ -526,8 +571,13 @@ extern bool output_separately;
 # ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 extern bool stack_trace_enabled;
+/* if this is true symbolize stack traces after restarting the tracee */
+extern bool stack_trace_deferred;
+/* if this is true aggregate syscalls by stack for --stack-summary */
+extern bool stack_summary_enabled;
 # else
 #  define stack_trace_enabled 0
+#  define stack_summary_enabled 0
 # endif
 extern unsigned ptrace_setoptions;
 extern unsigned max_strlen;
@@ -543,6 +593,7 @@ extern void set_count_summary_columns(const char *columns);
 
 extern bool get_instruction_pointer(struct tcb *, kernel_ulong_t *);
 extern bool get_stack_pointer(struct tcb *, kernel_ulong_t *);
+extern bool get_frame_pointer(struct tcb *, kernel_ulong_t *);
 extern void print_instruction_pointer(struct tcb *);
 
 extern void print_syscall_number(struct tcb *);
@@ -552,6 +603,7 @@ extern void print_syscall_resume(struct tcb *tcp);
 extern int syscall_entering_decode(struct tcb *);
 extern int syscall_entering_trace(struct tcb *, unsigned int *);
 extern void syscall_entering_finish(struct tcb *, int);
+extern bool syscall_exit_needed(struct tcb *);
 
 extern int syscall_exiting_decode(struct tcb *, struct timespec *);
 extern int syscall_exiting_trace(struct tcb *, struct timespec *, int);
@@ -559,6 +611,113 @@ extern void syscall_exiting_finish(struct tcb *);
 
 extern void count_syscall(struct tcb *, const struct timespec *);
 extern void call_summary(FILE *);
+extern void count_io_syscall(struct tcb *, const struct timespec *);
+extern void io_summary(FILE *);
+
+/*
+ * Decoding of io_uring submission and completion queue entries.
+ */
+extern void io_uring_ring_init(void);
+extern bool io_uring_seccomp_affects(const struct_sysent *);
+extern bool io_uring_syscall_affects(const struct_sysent *);
+extern void io_uring_syscall_exit(struct tcb *, bool has_result);
+extern void print_io_uring_events(struct tcb *);
+extern void io_uring_summary(FILE *);
+
+/*
+ * Process lifecycle profile requested by --process-profile option.
+ */
+struct rusage;
+extern bool process_profile_enabled;
+extern void process_profile_start(struct tcb *);
+extern void process_profile_exec(struct tcb *);
+extern void process_profile_exit(struct tcb *, int status,
+				 const struct rusage *);
+extern void process_profile_print(FILE *);
+
+/*
+ * Futex contention profile requested by --futex-profile option.
+ */
+extern bool futex_profile_enabled;
+extern void count_futex_syscall(struct tcb *, const struct timespec *);
+extern void futex_profile(FILE *);
+
+/*
+ * Tracer time breakdown requested by --self-stats option.
+ * The time between self_stats_begin and self_stats_end is accounted
+ * to the activity, except for the time of the activities nested in it.
+ */
+enum self_stats_activity {
+	SELF_STATS_OTHER,
+	SELF_STATS_WAIT,
+	SELF_STATS_PTRACE,
+	SELF_STATS_VM_READ,
+	SELF_STATS_DECODE,
+	SELF_STATS_OUTPUT,
+
+	SELF_STATS_ACTIVITIES
+};
+extern bool self_stats_enabled;
+extern void self_stats_start(void);
+extern void self_stats_push(enum self_stats_activity, unsigned int request);
+extern void self_stats_pop(void);
+extern void self_stats_event(void);
+extern void self_stats_print(FILE *);
+
+/*
+ * The request argument is the ptrace request for SELF_STATS_PTRACE
+ * activity and is ignored otherwise.
+ */
+static inline void
+self_stats_begin(const enum self_stats_activity activity,
+		 const unsigned int request)
+{
+	if (self_stats_enabled)
+		self_stats_push(activity, request);
+}
+
+static inline void
+self_stats_end(void)
+{
+	if (self_stats_enabled)
+		self_stats_pop();
+}
+
+/*
+ * Decoder cost profile requested by --decoder-stats option.
+ * decoder_stats_fetched and decoder_stats_printed are the numbers of bytes
+ * fetched from tracees and of bytes printed since the start of strace.
+ */
+extern bool decoder_stats_enabled;
+extern uint64_t decoder_stats_fetched;
+extern uint64_t decoder_stats_printed;
+extern void decoder_stats_push(const char *prefix, const char *name,
+			       bool invocation);
+extern void decoder_stats_pop(void);
+extern void decoder_stats_print(FILE *);
+
+/*
+ * The prefix is NULL for syscall decoders and names the kind of
+ * subdecoders, e.g. "ioctl".  The invocation argument is false
+ * when the decoder is resumed on exiting.
+ * decoder_stats_begin is paired with decoder_stats_end; callers that check
+ * decoder_stats_enabled themselves to avoid computing the name pair
+ * decoder_stats_push with decoder_stats_pop.
+ */
+static inline void
+decoder_stats_begin(const char *const prefix, const char *const name,
+		    const bool invocation)
+{
+	if (decoder_stats_enabled)
+		decoder_stats_push(prefix, name, invocation);
+}
+
+static inline void
+decoder_stats_end(void)
+{
+	if (decoder_stats_enabled)
+		decoder_stats_pop();
+}
 
 extern void clear_regs(struct tcb *tcp);
 extern int get_scno(struct tcb *);
@@ -639,12 +798,12 @@ upoken(struct tcb *, kernel_ulong_t addr, unsigned int len, void *laddr);
 extern bool
 tfetch_mem64(struct tcb *, uint64_t addr, unsigned int len, void *laddr);
 
-static inline bool
-tfetch_mem(struct tcb *tcp, const kernel_ulong_t addr,
-	   unsigned int len, void *laddr)
-{
-	return tfetch_mem64(tcp, addr, len, laddr);
-}
+/*
+ * Not inline, so that print_array_ex could recognise it
+ * as the fetcher of the elements it can prefetch.
+ */
+extern bool
+tfetch_mem(struct tcb *, kernel_ulong_t addr, unsigned int len, void *laddr);
 # define tfetch_obj(pid, addr, objp)	\
 	tfetch_mem((pid), (addr), sizeof(*(objp)), (void *) (objp))
 
@@ -655,12 +814,9 @@ extern bool
 tfetch_mem64_ignore_syserror(struct tcb *, uint64_t addr,
 			     unsigned int len, void *laddr);
 
-static inline bool
-tfetch_mem_ignore_syserror(struct tcb *tcp, const kernel_ulong_t addr,
-			   unsigned int len, void *laddr)
-{
-	return tfetch_mem64_ignore_syserror(tcp, addr, len, laddr);
-}
+extern bool
+tfetch_mem_ignore_syserror(struct tcb *, kernel_ulong_t addr,
+			   unsigned int len, void *laddr);
 
 /**
  * @return 0 on success, -1 on error (and print addr).
@@ -706,6 +862,27 @@ umoven_or_printaddr_ignore_syserror(struct tcb *tcp, const kernel_ulong_t addr,
 extern int
 umovestr(struct tcb *, kernel_ulong_t addr, unsigned int len, char *laddr);
 
+/**
+ * Like umoven, but a read that stops at an inaccessible page is neither
+ * an error nor reported, the errors are left to be reported by umoven.
+ *
+ * @return the number of leading bytes copied.
+ */
+extern unsigned int
+umoven_partial(struct tcb *, kernel_ulong_t addr, unsigned int len,
+	       void *laddr);
+
+/**
+ * Fetch the beginnings of `count' NUL-terminated strings at `addrs'
+ * with as few process_vm_readv calls as possible.  Up to `size' bytes
+ * of the i-th string are stored at laddr + i * size without crossing
+ * a page boundary, lens[i] is set to the number of bytes fetched,
+ * 0 if the string has not been fetched.
+ */
+extern void
+umovestr_vec(struct tcb *, const kernel_ulong_t *addrs, unsigned int count,
+	     unsigned int size, char *laddr, unsigned int *lens);
+
 /* Invalidate the cache used by umove* functions.  */
 extern void invalidate_umove_cache(void);
 
@@ -734,12 +911,7 @@ pathtrace_match(struct tcb *tcp)
 }
 
 extern int getfdpath_pid(pid_t pid, int fd, char *buf, unsigned bufsize);
-
-static inline int
-getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
-{
-	return getfdpath_pid(tcp->pid, fd, buf, bufsize);
-}
+extern int getfdpath(struct tcb *, int fd, char *buf, unsigned bufsize);
 
 extern unsigned long getfdinode(struct tcb *, int);
 extern enum sock_proto getfdproto(struct tcb *, int);
@@ -1063,6 +1235,10 @@ extern kernel_ulong_t *
 fetch_indirect_syscall_args(struct tcb *, kernel_ulong_t addr, unsigned int n_args);
 
 extern void pidns_init(void);
+/** Keeps the PID namespace translation index up to date. */
+extern void pidns_tcb_init(struct tcb *);
+extern void pidns_tcb_fin(struct tcb *);
+extern void pidns_print_stats(void);
 
 /**
  * Returns PID as present in /proc of the tracer (can be different from tracee
@@ -1070,6 +1246,19 @@ extern void pidns_init(void);
  */
 extern int get_proc_pid(int pid);
 
+/**
+ * Returns the thread group ID (as present in /proc of the tracer) the tracee
+ * belongs to, caching it in tcp->tgid.  Falls back to tcp->pid if it cannot
+ * be determined.
+ */
+extern int get_tcb_tgid(struct tcb *);
+
+/**
+ * Fetches the flags of clone or clone3 syscall being traced,
+ * returns false if they cannot be fetched.
+ */
+extern bool get_clone_flags(struct tcb *, uint64_t *flags);
+
 /**
  * Translates a pid from tracee's namespace to our namespace.
  *
@@ -1096,10 +1285,40 @@ dumpiov_upto(struct tcb *, int len, kernel_ulong_t addr, kernel_ulong_t data_siz
 extern void
 dumpstr(struct tcb *, kernel_ulong_t addr, kernel_ulong_t len);
 
+/*
+ * Capture of the data dumped by -e read and -e write options in raw form,
+ * requested by --dump-dir and --pcap options.  While a transfer is being
+ * captured, dumpstr passes the data to payload_capture_data instead of
+ * printing it.
+ */
+extern const char *dump_dir;
+extern const char *pcap_file;
+extern void payload_capture_init(void);
+/* Returns true if the syscall may close or replace descriptors. */
+extern bool payload_capture_syscall_affects(const struct_sysent *);
+extern void payload_capture_syscall_exit(struct tcb *, bool has_result);
+extern void payload_capture_begin(struct tcb *, int fd, bool sent);
+extern bool payload_capturing(void);
+extern bool
+payload_capture_data(struct tcb *, kernel_ulong_t addr, kernel_ulong_t len);
+/* Start capturing the next message of the same transfer. */
+extern void payload_capture_next(struct tcb *);
+extern void payload_capture_end(struct tcb *);
+extern void payload_capture_finish(void);
+
 extern int
 printstr_ex(struct tcb *, kernel_ulong_t addr, kernel_ulong_t len,
 	    unsigned int user_style);
 
+/**
+ * Print a NUL-terminated string like printstr does, given the first
+ * `buf_len' bytes of it fetched from the tracee already.
+ *
+ * @return false if `buf' does not contain enough of the string.
+ */
+extern bool
+printstr_prefetched(const char *buf, unsigned int buf_len);
+
 /**
  * Print a region of tracee memory only in case non-zero bytes are present
  * there.  It almost fits into printstr_ex, but it has some pretty specific
@@ -1206,6 +1425,18 @@ extern void print_ax25_addr(const void /* ax25_address */ *addr);
 extern void print_x25_addr(const void /* struct x25_address */ *addr);
 extern const char *get_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
 extern bool print_sockaddr_by_inode(struct tcb *, int fd, unsigned long inode);
+extern void invalidate_sockaddr_by_inode(unsigned long inode);
+
+/* The addresses of an inet socket as reported by NETLINK_SOCK_DIAG.  */
+struct inet_sock_addrs {
+	int family;		/* AF_INET or AF_INET6 */
+	int protocol;		/* IPPROTO_* */
+	uint16_t src_port;	/* in network byte order */
+	uint16_t dst_port;	/* in network byte order */
+	uint8_t src[16];
+	uint8_t dst[16];
+};
+extern const struct inet_sock_addrs *get_inet_sock_addrs(struct tcb *, int fd);
 
 /**
  * Prints dirfd file descriptor and saves it in tcp->last_dirfd,
@@ -1291,7 +1522,9 @@ extern void qualify_write(const char *);
 extern void qualify_fault(const char *);
 extern void qualify_inject(const char *);
 extern void qualify_kvm(const char *);
+extern void qualify_trigger(const char *);
 extern unsigned int qual_flags(const unsigned int);
+extern bool is_flight_recorder_trigger(const struct tcb *);
 
 # define DECL_IOCTL(name)						\
 extern int								\
@@ -1422,14 +1655,21 @@ extern void ts_mul(struct timespec *, const struct timespec *, uint64_t);
 extern void ts_div(struct timespec *, const struct timespec *, uint64_t);
 extern const struct timespec *ts_min(const struct timespec *, const struct timespec *);
 extern const struct timespec *ts_max(const struct timespec *, const struct timespec *);
+extern uint64_t monotonic_ns(void);
 extern int parse_ts(const char *s, struct timespec *t);
 
 # ifdef ENABLE_STACKTRACE
+extern bool unwind_select_unwinder(const char *name);
 extern void unwind_init(void);
 extern void unwind_tcb_init(struct tcb *);
 extern void unwind_tcb_fin(struct tcb *);
 extern void unwind_tcb_print(struct tcb *);
+extern char *unwind_tcb_sprint(struct tcb *);
 extern void unwind_tcb_capture(struct tcb *);
+extern void unwind_tcb_flush(struct tcb *);
+extern void unwind_tcb_summary_capture(struct tcb *);
+extern void unwind_tcb_summary_add(struct tcb *, const struct timespec *);
+extern void unwind_summary_print(FILE *, bool by_time);
 # endif
 
 # ifdef HAVE_LINUX_KVM_H
@@ -1593,11 +1833,36 @@ extern void tprintf_comment(const char *fmt, ...) ATTRIBUTE_FORMAT((printf, 1, 2
 extern void tprints_comment(const char *str);
 
 /*
- * Staging output for status qualifier.
+ * Staging output for status qualifier and --latency-threshold option.
  */
+extern bool is_output_staged(void);
 extern FILE *strace_open_memstream(struct tcb *tcp);
 extern void strace_close_memstream(struct tcb *tcp, bool publish);
 
+/*
+ * Keeping output in memory for --flight-recorder option.
+ */
+extern void flight_recorder_tcb_init(struct tcb *);
+extern void flight_recorder_tcb_fin(struct tcb *);
+extern void flight_recorder_line_ended(struct tcb *);
+extern void flight_recorder_dump(void);
+
+/*
+ * Trace event output for --output-format=trace-event option.
+ */
+extern void trace_event_init(FILE *);
+extern void trace_event_finish(void);
+extern void trace_event_syscall(struct tcb *, const struct timespec *,
+				int res);
+extern void trace_event_instant(struct tcb *, const char *name,
+				const char *cat);
+
+extern int merge_logs(const char *prefix);
+
+extern int open_output_file(const char *path, int flags);
+extern void output_pool_init(void);
+extern FILE *output_pool_fopen(const char *path, bool append);
+
 static inline void
 printaddr_comment(const kernel_ulong_t addr)
 {
@@ -14,6 +14,41 @@
 
 #include "defs.h"
 
+/* The maximum number of argv/envp pointers fetched at once. */
+#define ARGV_CHUNK	512
+
+/*
+ * Fetch up to `count' pointers of argv/envp array located at `addr'
+ * with a single umoven call.  The read does not cross a page boundary
+ * unless the first pointer does, so a failure means that the first
+ * pointer is not accessible.
+ *
+ * Returns the number of pointers fetched, 0 on error.
+ */
+static unsigned int
+fetch_argv_chunk(struct tcb *const tcp, const kernel_ulong_t addr,
+		 unsigned int count, kernel_ulong_t *const words)
+{
+	const unsigned int wordsize = current_wordsize;
+	const unsigned int page_size = get_pagesize();
+	const unsigned int in_page =
+		(page_size - (addr & (page_size - 1))) / wordsize;
+	union {
+		uint32_t w32[ARGV_CHUNK];
+		kernel_ulong_t wl[ARGV_CHUNK];
+	} buf;
+
+	count = MAX(1, MIN(count, MIN(in_page, ARGV_CHUNK)));
+	if (umoven(tcp, addr, count * wordsize, &buf))
+		return 0;
+
+	for (unsigned int i = 0; i < count; ++i)
+		words[i] = (wordsize == sizeof(buf.w32[0]))
+			   ? (kernel_ulong_t) buf.w32[i] : buf.wl[i];
+
+	return count;
+}
+
 static void
 printargv(struct tcb *const tcp, kernel_ulong_t addr)
 {
@@ -22,18 +57,30 @@ printargv(struct tcb *const tcp, kernel_ulong_t addr)
 		return;
 	}
 
+	/*
+	 * The beginnings of the strings are fetched with one
+	 * umovestr_vec call per chunk, printstr falls back to
+	 * fetching those that do not fit.
+	 */
+	static char *strs;
+	/* Fetch one byte more as printstr does. */
+	const unsigned int str_size = MIN(max_strlen + 1, get_pagesize());
+	if (!strs)
+		strs = xallocarray(ARGV_CHUNK, str_size);
+
 	const unsigned int wordsize = current_wordsize;
+	kernel_ulong_t words[ARGV_CHUNK];
+	unsigned int lens[ARGV_CHUNK];
 	kernel_ulong_t prev_addr = 0;
 	unsigned int n = 0;
 
-	for (;; prev_addr = addr, addr += wordsize, ++n) {
-		union {
-			unsigned int w32;
-			kernel_ulong_t wl;
-			char data[sizeof(kernel_ulong_t)];
-		} cp;
+	for (;;) {
+		const unsigned int limit = abbrev(tcp) ? max_strlen + 1 - n
+						       : ARGV_CHUNK;
+		const unsigned int count = addr < prev_addr ? 0
+			: fetch_argv_chunk(tcp, addr, limit, words);
 
-		if (addr < prev_addr || umoven(tcp, addr, wordsize, cp.data)) {
+		if (!count) {
 			if (n == 0) {
 				printaddr(addr);
 				return;
@@ -44,21 +91,34 @@ printargv(struct tcb *const tcp, kernel_ulong_t addr)
 			break;
 		}
 
-		const kernel_ulong_t word = (wordsize == sizeof(cp.w32))
-					    ? (kernel_ulong_t) cp.w32 : cp.wl;
 		if (n == 0)
 			tprint_array_begin();
-		if (word == 0)
-			break;
-		if (n != 0)
-			tprint_array_next();
 
-		if (abbrev(tcp) && n >= max_strlen) {
-			tprint_more_data_follows();
+		unsigned int nstrs = 0;
+		while (nstrs < count && words[nstrs] &&
+		       !(abbrev(tcp) && n + nstrs >= max_strlen))
+			++nstrs;
+
+		umovestr_vec(tcp, words, nstrs, str_size, strs, lens);
+
+		for (unsigned int i = 0; i < nstrs; ++i, ++n) {
+			if (n != 0)
+				tprint_array_next();
+			if (!printstr_prefetched(strs + i * str_size, lens[i]))
+				printstr(tcp, words[i]);
+		}
+
+		if (nstrs < count) {
+			if (words[nstrs]) {
+				if (n != 0)
+					tprint_array_next();
+				tprint_more_data_follows();
+			}
 			break;
 		}
 
-		printstr(tcp, word);
+		prev_addr = addr;
+		addr += count * wordsize;
 	}
 
 	tprint_array_end();
@@ -73,20 +133,30 @@ printargc(struct tcb *const tcp, kernel_ulong_t addr)
 		return;
 
 	const unsigned int wordsize = current_wordsize;
+	kernel_ulong_t words[ARGV_CHUNK];
 	kernel_ulong_t prev_addr = 0;
-	unsigned int n;
+	unsigned int n = 0;
 
-	for (n = 0; addr > prev_addr; prev_addr = addr, addr += wordsize, ++n) {
-		kernel_ulong_t word = 0;
-		if (umoven(tcp, addr, wordsize, &word)) {
+	while (addr > prev_addr) {
+		const unsigned int count =
+			fetch_argv_chunk(tcp, addr, ARGV_CHUNK, words);
+		if (!count) {
 			if (n == 0)
 				return;
 
 			addr = 0;
 			break;
 		}
-		if (word == 0)
+
+		unsigned int i = 0;
+		while (i < count && words[i])
+			++i;
+		n += i;
+		if (i < count)
 			break;
+
+		prev_addr = addr;
+		addr += count * wordsize;
 	}
 	tprintf_comment("%u var%s%s",
 			n, n == 1 ? "" : "s",
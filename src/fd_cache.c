@@ -0,0 +1,487 @@
+/*
+ * Caching of the information about file descriptors of tracees,
+ * used by -y/--decode-fds and -P/--path.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <linux/close_range.h>
+#include <linux/sched.h>
+
+#include "fd_cache.h"
+#include "largefile_wrappers.h"
+#include "sen.h"
+#include "trie.h"
+#include "xstring.h"
+
+/* Descriptors greater than or equal to this are not cached. */
+#define FD_CACHE_MAX_FD	65536
+
+/*
+ * The cache of a descriptor table.
+ *
+ * The table is shared by all threads of the process,
+ * refcount is the number of tcbs referring to it.
+ */
+struct fd_cache {
+	struct fd_cache_entry *entries;
+	size_t size;
+	unsigned int refcount;
+	int tgid;
+	/*
+	 * The descriptor table may be changed unnoticed: it is shared
+	 * with another process, or some threads of the process have
+	 * a separate one.  The entries are checked before use then,
+	 * see check_entry.
+	 */
+	bool shared;
+};
+
+/**
+ * Key:   thread group ID (as present in /proc)
+ * Value: struct fd_cache shared by all threads of the process
+ */
+static struct trie *fd_caches;
+
+static bool use_fd_cache;
+
+/* Incremented on every tracing event, see check_entry. */
+static unsigned int event = 1;
+
+void
+fd_cache_enable(void)
+{
+	if (use_fd_cache)
+		return;
+
+	fd_caches = trie_create(sizeof(int) * 8, sizeof(void *) == 8 ? 6 : 5,
+				4, 4, 0);
+	if (!fd_caches)
+		error_msg_and_die("creating trie failed");
+	use_fd_cache = true;
+}
+
+void
+fd_cache_event(void)
+{
+	++event;
+}
+
+static void
+clear_entry(struct fd_cache_entry *entry)
+{
+	if (entry->path) {
+		/* The details of a socket are cached by its inode. */
+		const char *str = STR_STRIP_PREFIX(entry->path, "socket:[");
+
+		if (str != entry->path)
+			invalidate_sockaddr_by_inode(strtoul(str, NULL, 10));
+	}
+
+	free(entry->path);
+	memset(entry, 0, sizeof(*entry));
+}
+
+static void
+clear_range(struct fd_cache *cache, unsigned int first, unsigned int last)
+{
+	if (first >= cache->size)
+		return;
+	if (last >= cache->size)
+		last = cache->size - 1;
+
+	for (unsigned int fd = first; fd <= last; ++fd)
+		clear_entry(&cache->entries[fd]);
+}
+
+static void
+clear_all(struct fd_cache *cache)
+{
+	clear_range(cache, 0, -1U);
+}
+
+/*
+ * When the descriptor table may be changed unnoticed, e.g. by untraced
+ * processes sharing it, or by tracees filtered with --seccomp-bpf that
+ * are not stopped on close, trust the entry only if the descriptor still
+ * refers to the same inode that has not been changed since, and check
+ * that once per event.
+ */
+static void
+check_entry(struct tcb *tcp, int fd, struct fd_cache_entry *entry)
+{
+	if (entry->checked_event == event)
+		return;
+
+	char path[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int) * 3];
+	strace_stat_t st;
+
+	xsprintf(path, "/proc/%u/fd/%u", get_proc_pid(tcp->pid), fd);
+	if (stat_file(path, &st)) {
+		clear_entry(entry);
+		return;
+	}
+
+	if (!entry->file_id_cached || entry->dev != st.st_dev ||
+	    entry->ino != st.st_ino ||
+	    entry->ctime.tv_sec != st.st_ctim.tv_sec ||
+	    entry->ctime.tv_nsec != st.st_ctim.tv_nsec) {
+		clear_entry(entry);
+		entry->dev = st.st_dev;
+		entry->ino = st.st_ino;
+		entry->ctime = st.st_ctim;
+		entry->file_id_cached = true;
+	}
+	entry->checked_event = event;
+}
+
+static struct fd_cache *
+get_fd_cache_by_tgid(int tgid)
+{
+	struct fd_cache *cache = (struct fd_cache *) (uintptr_t)
+		trie_get(fd_caches, tgid);
+
+	if (!cache) {
+		cache = xzalloc(sizeof(*cache));
+		cache->tgid = tgid;
+		trie_set(fd_caches, tgid, (uint64_t) (uintptr_t) cache);
+	}
+
+	return cache;
+}
+
+/*
+ * Attach the tcb to the cache of its thread group, creating an empty one
+ * if this is the first thread of the process asking for it.
+ */
+static struct fd_cache *
+get_fd_cache(struct tcb *tcp)
+{
+	if (tcp->fd_cache)
+		return tcp->fd_cache;
+
+	struct fd_cache *cache = get_fd_cache_by_tgid(get_tcb_tgid(tcp));
+
+	cache->refcount++;
+	tcp->fd_cache = cache;
+
+	return cache;
+}
+
+void
+fd_cache_tcb_fin(struct tcb *tcp)
+{
+	struct fd_cache *cache = tcp->fd_cache;
+
+	if (!cache)
+		return;
+
+	tcp->fd_cache = NULL;
+	if (--cache->refcount)
+		return;
+
+	trie_set(fd_caches, cache->tgid, 0);
+	clear_all(cache);
+	free(cache->entries);
+	free(cache);
+}
+
+struct fd_cache_entry *
+fd_cache_get(struct tcb *tcp, int fd)
+{
+	if (!use_fd_cache || fd < 0 || fd >= FD_CACHE_MAX_FD)
+		return NULL;
+
+	struct fd_cache *cache = get_fd_cache(tcp);
+
+	if ((size_t) fd >= cache->size) {
+		size_t new_size = MAX(cache->size * 2, (size_t) fd + 1);
+
+		new_size = MIN(new_size, FD_CACHE_MAX_FD);
+		cache->entries = xreallocarray(cache->entries, new_size,
+					       sizeof(*cache->entries));
+		memset(cache->entries + cache->size, 0,
+		       (new_size - cache->size) * sizeof(*cache->entries));
+		cache->size = new_size;
+	}
+
+	if (cache->shared || has_seccomp_filter(tcp))
+		check_entry(tcp, fd, &cache->entries[fd]);
+	return &cache->entries[fd];
+}
+
+void
+fd_cache_set_path(struct fd_cache_entry *entry, const char *path,
+		  unsigned int len)
+{
+	free(entry->path);
+	entry->path = xstrndup(path, len);
+	entry->path_len = len;
+}
+
+bool
+fd_cache_syscall_affects(const struct_sysent *s)
+{
+	if (!use_fd_cache)
+		return false;
+
+	switch (s->sen) {
+	case SEN_clone:
+	case SEN_clone3:
+	case SEN_close:
+	case SEN_close_range:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_execve:
+	case SEN_execveat:
+	case SEN_io_uring_enter:
+	case SEN_rename:
+	case SEN_renameat:
+	case SEN_renameat2:
+	case SEN_rmdir:
+	case SEN_unlink:
+	case SEN_unlinkat:
+	case SEN_unshare:
+		return true;
+	}
+
+	return false;
+}
+
+static void
+update_on_clone(struct tcb *tcp, struct fd_cache *cache)
+{
+	uint64_t flags;
+
+	if (!get_clone_flags(tcp, &flags)) {
+		cache->shared = true;
+		return;
+	}
+
+	if ((flags & CLONE_FILES) && !(flags & CLONE_THREAD)) {
+		/* The new process has a cache of its own. */
+		const int pid = translate_pid(tcp, tcp->u_rval, PT_TID, NULL);
+
+		cache->shared = true;
+		if (pid > 0)
+			get_fd_cache_by_tgid(pid)->shared = true;
+	} else if ((flags & CLONE_THREAD) && !(flags & CLONE_FILES)) {
+		/* The new thread has a separate descriptor table. */
+		cache->shared = true;
+	} else if ((flags & CLONE_FILES) && !followfork) {
+		/* The new thread is not traced. */
+		cache->shared = true;
+	}
+}
+
+static void
+update_on_unshare(struct tcb *tcp, struct fd_cache *cache)
+{
+	/* The other threads keep the old descriptor table. */
+	if (cache->refcount > 1)
+		cache->shared = true;
+}
+
+static void
+update_on_close_range(struct tcb *tcp, struct fd_cache *cache)
+{
+	const unsigned int first = tcp->u_arg[0];
+	const unsigned int last = tcp->u_arg[1];
+	const unsigned int flags = tcp->u_arg[2];
+
+	if (flags & CLOSE_RANGE_UNSHARE)
+		update_on_unshare(tcp, cache);
+	/* Descriptors marked close-on-exec are dropped on execve. */
+	if (!(flags & CLOSE_RANGE_CLOEXEC))
+		clear_range(cache, first, last);
+}
+
+/*
+ * Resolves the path argument of a syscall the way the kernel prints it
+ * in /proc/PID/fd/FD symlinks.  As the last component may not exist
+ * anymore, only the directory it is in is resolved.
+ *
+ * @param dirfd_arg The index of the directory descriptor argument,
+ *                  or -1 if the path is relative to the working directory.
+ * @param path_arg  The index of the path argument.
+ * @param buf       The buffer of PATH_MAX bytes to store the path in.
+ * @return          The length of the path, 0 on error.
+ */
+static size_t
+resolve_path_arg(struct tcb *tcp, int dirfd_arg, int path_arg, char *buf)
+{
+	char path[PATH_MAX];
+
+	if (umovestr(tcp, tcp->u_arg[path_arg], sizeof(path), path) <= 0)
+		return 0;
+
+	size_t len = strlen(path);
+	while (len > 1 && path[len - 1] == '/')
+		path[--len] = '\0';
+
+	char *base = strrchr(path, '/');
+	const char *dir = "";
+	if (base) {
+		*base++ = '\0';
+		dir = path;
+	} else {
+		base = path;
+	}
+
+	if (!*base || !strcmp(base, ".") || !strcmp(base, ".."))
+		return 0;
+
+	char proc_path[sizeof("/proc/%u/fd/%d/") + 2 * sizeof(int) * 3
+		       + PATH_MAX];
+	const unsigned int pid = get_proc_pid(tcp->pid);
+
+	if (base != path && !*dir)
+		xsprintf(proc_path, "/proc/%u/root", pid);
+	else if (base != path && *dir == '/')
+		xsprintf(proc_path, "/proc/%u/root%s", pid, dir);
+	else if (dirfd_arg < 0 || (int) tcp->u_arg[dirfd_arg] == AT_FDCWD)
+		xsprintf(proc_path, "/proc/%u/cwd/%s", pid, dir);
+	else
+		xsprintf(proc_path, "/proc/%u/fd/%d/%s", pid,
+			 (int) tcp->u_arg[dirfd_arg], dir);
+
+	char resolved[PATH_MAX];
+	if (!realpath(proc_path, resolved))
+		return 0;
+
+	const size_t dir_len = strcmp(resolved, "/") ? strlen(resolved) : 0;
+	const size_t base_len = strlen(base);
+	if (dir_len + 1 + base_len >= PATH_MAX)
+		return 0;
+
+	memcpy(buf, resolved, dir_len);
+	buf[dir_len] = '/';
+	memcpy(buf + dir_len + 1, base, base_len + 1);
+
+	return dir_len + 1 + base_len;
+}
+
+struct drop_path_data {
+	const char *path;
+	size_t len;
+};
+
+/* Drops the entries of the path and of the paths beneath it. */
+static void
+drop_path_iterator_fn(void *fn_data, uint64_t key, uint64_t val)
+{
+	const struct drop_path_data *data = fn_data;
+	struct fd_cache *cache = (struct fd_cache *) (uintptr_t) val;
+
+	if (!cache)
+		return;
+
+	if (!data->path) {
+		clear_all(cache);
+		return;
+	}
+
+	for (size_t fd = 0; fd < cache->size; ++fd) {
+		struct fd_cache_entry *entry = &cache->entries[fd];
+
+		if (entry->path && entry->path_len >= data->len &&
+		    !memcmp(entry->path, data->path, data->len) &&
+		    (entry->path[data->len] == '\0' ||
+		     entry->path[data->len] == ' ' ||
+		     entry->path[data->len] == '/'))
+			clear_entry(entry);
+	}
+}
+
+/*
+ * Drops the entries of all processes referring to the path argument,
+ * or to anything beneath it, as descriptors of any process may refer
+ * to the path.  If the path cannot be resolved, drops all entries.
+ */
+static void
+drop_path_arg(struct tcb *tcp, int dirfd_arg, int path_arg)
+{
+	char path[PATH_MAX];
+	struct drop_path_data data = {
+		.path = path,
+		.len = resolve_path_arg(tcp, dirfd_arg, path_arg, path),
+	};
+
+	if (!data.len)
+		data.path = NULL;
+
+	trie_iterate_keys(fd_caches, 0, INT_MAX, drop_path_iterator_fn, &data);
+}
+
+void
+fd_cache_syscall_exit(struct tcb *tcp, bool valid)
+{
+	struct fd_cache *cache = get_fd_cache(tcp);
+
+	if (!valid) {
+		clear_all(cache);
+		return;
+	}
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_close:
+		/* The descriptor is closed even if close fails. */
+		clear_range(cache, tcp->u_arg[0], tcp->u_arg[0]);
+		return;
+	case SEN_io_uring_enter:
+		/* Descriptors may be closed by IORING_OP_CLOSE. */
+		clear_all(cache);
+		return;
+	}
+
+	if (syserror(tcp))
+		return;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_clone:
+	case SEN_clone3:
+		update_on_clone(tcp, cache);
+		break;
+	case SEN_close_range:
+		update_on_close_range(tcp, cache);
+		break;
+	case SEN_dup2:
+	case SEN_dup3:
+		clear_range(cache, tcp->u_arg[1], tcp->u_arg[1]);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+		/* The descriptor table is unshared on execve. */
+		clear_all(cache);
+		cache->shared = false;
+		break;
+	case SEN_rename:
+		drop_path_arg(tcp, -1, 0);
+		drop_path_arg(tcp, -1, 1);
+		break;
+	case SEN_renameat:
+	case SEN_renameat2:
+		drop_path_arg(tcp, 0, 1);
+		drop_path_arg(tcp, 2, 3);
+		break;
+	case SEN_rmdir:
+	case SEN_unlink:
+		drop_path_arg(tcp, -1, 0);
+		break;
+	case SEN_unlinkat:
+		drop_path_arg(tcp, 0, 1);
+		break;
+	case SEN_unshare:
+		if (tcp->u_arg[0] & CLONE_FILES)
+			update_on_unshare(tcp, cache);
+		break;
+	}
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2021 The strace developers.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_FD_CACHE_H
+# define STRACE_FD_CACHE_H
+
+/*
+ * Information about a file descriptor of a tracee fetched from /proc.
+ *
+ * Only the information about open descriptors is cached, so the entries
+ * have to be dropped when descriptors are closed or replaced, but not
+ * when they are created.  The paths are dropped when files are renamed
+ * or removed.
+ */
+struct fd_cache_entry {
+	/* The target of /proc/PID/fd/FD symlink, NULL if not cached. */
+	char *path;
+	unsigned int path_len;
+	bool inode_cached;
+	bool proto_cached;
+	bool stat_cached;
+	bool file_id_cached;
+	/* Socket inode number, 0 if the descriptor is not a socket. */
+	unsigned long inode;
+	enum sock_proto proto;
+	/* File type and device number of the path, for -yy. */
+	unsigned int mode;
+	unsigned long long rdev;
+	/*
+	 * Device and inode numbers of the open file, for --trace-path-inode,
+	 * and the ctime of the inode, to check the entry when the descriptor
+	 * table may be changed unnoticed.
+	 */
+	unsigned long long dev;
+	unsigned long long ino;
+	struct timespec ctime;
+	/* The event the entry has been checked on last time. */
+	unsigned int checked_event;
+};
+
+extern void
+fd_cache_enable(void);
+
+/* Called on every tracing event. */
+extern void
+fd_cache_event(void);
+
+/*
+ * Returns the cache entry for the descriptor fd of the tracee,
+ * NULL if the cache is not available.
+ */
+extern struct fd_cache_entry *
+fd_cache_get(struct tcb *, int fd);
+
+extern void
+fd_cache_set_path(struct fd_cache_entry *, const char *path,
+		  unsigned int len);
+
+/* Returns true if the syscall may close or replace descriptors. */
+extern bool
+fd_cache_syscall_affects(const struct_sysent *);
+
+extern void
+fd_cache_syscall_exit(struct tcb *, bool valid);
+
+extern void
+fd_cache_tcb_fin(struct tcb *);
+
+#endif /* !STRACE_FD_CACHE_H */
@@ -30,6 +30,9 @@ static struct number_set *abbrev_set;
 static struct number_set *inject_set;
 static struct number_set *raw_set;
 static struct number_set *verbose_set;
+static struct number_set *trigger_set;
+/* The error code of syscalls in trigger_set that fire, 0 means any. */
+static unsigned int trigger_error;
 
 /* Only syscall numbers are personality-specific so far.  */
 struct inject_personality_data {
@@ -499,6 +502,35 @@ qualify_raw(const char *const str)
 	qualify_syscall_tokens(str, raw_set);
 }
 
+void
+qualify_trigger(const char *const str)
+{
+	char *copy = xstrdup(str);
+	char *token = strchr(copy, ':');
+
+	if (token) {
+		*token++ = '\0';
+
+		const char *val = STR_STRIP_PREFIX(token, "error=");
+		int intval = -1;
+
+		if (val != token) {
+			intval = string_to_uint_upto(val, MAX_ERRNO_VALUE);
+			if (intval < 0)
+				intval = find_errno_by_name(val);
+		}
+		if (intval < 1)
+			error_msg_and_die("invalid -e trigger= argument: '%s'",
+					  str);
+		trigger_error = intval;
+	}
+
+	if (!trigger_set)
+		trigger_set = alloc_number_set_array(SUPPORTED_PERSONALITIES);
+	qualify_syscall_tokens(copy, trigger_set);
+	free(copy);
+}
+
 static void
 qualify_inject_common(const char *const str,
 		      const bool fault_tokens_only,
@@ -632,6 +664,7 @@ static const struct qual_options {
 	{ "kvm",	qualify_kvm	},
 	{ "decode-fd",	qualify_decode_fd },
 	{ "decode-fds",	qualify_decode_fd },
+	{ "trigger",	qualify_trigger	},
 };
 
 void
@@ -654,6 +687,15 @@ qualify(const char *str)
 	opt->qualify(str);
 }
 
+bool
+is_flight_recorder_trigger(const struct tcb *tcp)
+{
+	return trigger_set
+	       && is_number_in_set_array(tcp->scno, trigger_set,
+					 current_personality)
+	       && (!trigger_error || tcp->u_error == trigger_error);
+}
+
 unsigned int
 qual_flags(const unsigned int scno)
 {
@@ -285,6 +285,8 @@ traced_by_seccomp(unsigned int scno, unsigned int p)
 		TRACE_INDIRECT_SUBCALL | TRACE_SECCOMP_DEFAULT |
 		(stack_trace_enabled ? MEMORY_MAPPING_CHANGE : 0);
 	return sysent_vec[p][scno].sys_flags & always_trace_flags ||
+		io_uring_seccomp_affects(&sysent_vec[p][scno]) ||
+		payload_capture_syscall_affects(&sysent_vec[p][scno]) ||
 		is_number_in_set_array(scno, trace_set, p);
 }
 
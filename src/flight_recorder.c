@@ -0,0 +1,172 @@
+/*
+ * Flight recorder: keep the last lines of the trace of each tracee
+ * in memory and write them out only when a trigger fires.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "list.h"
+
+struct flight_record {
+	char *text;
+	size_t len;
+	size_t size;
+	/* The order of the record among records of all tracees. */
+	uint64_t seq;
+};
+
+struct flight_recorder {
+	struct list_item list;
+	/* The stream the output of the tracee goes to. */
+	FILE *fp;
+	char *buf;
+	size_t buf_len;
+	/* The stream the records are written to on dump. */
+	FILE *real_outf;
+	/* Ring of flight_recorder_size records, next is the oldest one. */
+	struct flight_record *records;
+	unsigned int next;
+};
+
+static EMPTY_LIST(recorders);
+static uint64_t last_seq;
+
+void
+flight_recorder_tcb_init(struct tcb *tcp)
+{
+#if HAVE_OPEN_MEMSTREAM
+	struct flight_recorder *fr = xzalloc(sizeof(*fr));
+
+	fr->fp = open_memstream(&fr->buf, &fr->buf_len);
+	if (!fr->fp)
+		perror_msg_and_die("open_memstream");
+	fr->real_outf = tcp->outf;
+	fr->records = xcalloc(flight_recorder_size, sizeof(*fr->records));
+	list_append(&recorders, &fr->list);
+
+	tcp->flight_recorder = fr;
+	tcp->outf = fr->fp;
+#endif
+}
+
+void
+flight_recorder_tcb_fin(struct tcb *tcp)
+{
+	struct flight_recorder *fr = tcp->flight_recorder;
+
+	if (!fr)
+		return;
+
+	tcp->flight_recorder = NULL;
+	if (tcp->outf == fr->fp)
+		tcp->outf = fr->real_outf;
+
+	list_remove(&fr->list);
+	fclose(fr->fp);
+	free(fr->buf);
+	for (unsigned int i = 0; i < flight_recorder_size; ++i)
+		free(fr->records[i].text);
+	free(fr->records);
+	free(fr);
+}
+
+/*
+ * Move the output of the tracee accumulated since the previous call
+ * to the ring, overwriting the oldest record.
+ */
+void
+flight_recorder_line_ended(struct tcb *tcp)
+{
+	struct flight_recorder *fr = tcp->flight_recorder;
+
+	if (!fr)
+		return;
+
+	if (fflush(fr->fp))
+		perror_msg("fflush");
+	if (!fr->buf_len)
+		return;
+
+	struct flight_record *rec = &fr->records[fr->next];
+
+	if (rec->size <= fr->buf_len) {
+		free(rec->text);
+		rec->size = fr->buf_len + 1;
+		rec->text = xmalloc(rec->size);
+	}
+	memcpy(rec->text, fr->buf, fr->buf_len);
+	rec->text[fr->buf_len] = '\0';
+	rec->len = fr->buf_len;
+	rec->seq = ++last_seq;
+
+	fr->next = (fr->next + 1) % flight_recorder_size;
+	rewind(fr->fp);
+}
+
+struct dump_entry {
+	struct flight_record *rec;
+	FILE *outf;
+};
+
+static int
+dump_entry_cmp(const void *a, const void *b)
+{
+	const uint64_t seq_a = ((const struct dump_entry *) a)->rec->seq;
+	const uint64_t seq_b = ((const struct dump_entry *) b)->rec->seq;
+
+	return seq_a < seq_b ? -1 : seq_a > seq_b;
+}
+
+/*
+ * Write the records of all tracees in the order they were recorded,
+ * and empty the rings.  The lines being printed, e.g. of syscalls
+ * the tracees are blocked in, are written after them marked unfinished,
+ * and are recorded as usual when they end.
+ */
+void
+flight_recorder_dump(void)
+{
+	struct flight_recorder *fr;
+	struct dump_entry *entries = NULL;
+	size_t count = 0, size = 0;
+
+	list_foreach(fr, &recorders, list) {
+		for (unsigned int i = 0; i < flight_recorder_size; ++i) {
+			if (!fr->records[i].len)
+				continue;
+			if (count >= size)
+				entries = xgrowarray(entries, &size,
+						     sizeof(*entries));
+			entries[count++] = (struct dump_entry) {
+				.rec = &fr->records[i],
+				.outf = fr->real_outf,
+			};
+		}
+	}
+
+	qsort(entries, count, sizeof(*entries), dump_entry_cmp);
+
+	for (size_t i = 0; i < count; ++i) {
+		fputs_unlocked(entries[i].rec->text, entries[i].outf);
+		entries[i].rec->len = 0;
+	}
+
+	list_foreach(fr, &recorders, list) {
+		if (fflush(fr->fp))
+			perror_msg("fflush");
+		if (fr->buf_len)
+			fprintf(fr->real_outf, "%.*s <unfinished ...>\n",
+				(int) fr->buf_len, fr->buf);
+	}
+
+	list_foreach(fr, &recorders, list) {
+		if (fflush(fr->real_outf))
+			perror_msg("fflush");
+	}
+
+	free(entries);
+}
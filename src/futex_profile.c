@@ -0,0 +1,295 @@
+/*
+ * Futex contention profile: the time spent waiting on futexes and
+ * the number of wakes aggregated by futex address, requested by
+ * --futex-profile option.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include "count_table.h"
+#include "hash_index.h"
+#include "sen.h"
+
+#define XLAT_MACROS_ONLY
+#include "xlat/futexops.h"
+#undef XLAT_MACROS_ONLY
+
+bool futex_profile_enabled;
+
+/* The number of the most contended addresses printed. */
+#define FUTEX_PROFILE_ROWS	20
+
+/*
+ * Wait times are accounted in a log-linear histogram of nanoseconds
+ * with HIST_SUB_BUCKETS buckets per power of two, so that
+ * the percentiles are estimated with an error of at most 1/HIST_SUB_BUCKETS.
+ */
+#define HIST_SUB_BITS		3
+#define HIST_SUB_BUCKETS	(1U << HIST_SUB_BITS)
+#define HIST_BUCKETS		((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct futex_counts {
+	int tgid;
+	kernel_ulong_t uaddr;
+	uint64_t waits, wait_errors;
+	uint64_t wakes, woken;
+	struct timespec wait_time;
+	struct timespec max_wait;
+	uint32_t *hist;
+	/* The stack of the longest wait, if -k option is specified. */
+	char *max_wait_stack;
+};
+
+static struct futex_counts *futex_counts;
+static size_t futex_counts_count;
+static size_t futex_counts_size;
+
+static struct hash_index futex_index;
+
+/* The key of futex_index. */
+struct futex_key {
+	int tgid;
+	kernel_ulong_t uaddr;
+};
+
+static bool
+futex_counts_match(size_t idx, const void *data)
+{
+	const struct futex_key *key = data;
+
+	return futex_counts[idx].tgid == key->tgid &&
+	       futex_counts[idx].uaddr == key->uaddr;
+}
+
+static struct futex_counts *
+get_futex_counts(int tgid, kernel_ulong_t uaddr)
+{
+	const struct futex_key key = { tgid, uaddr };
+	const uint64_t hash =
+		((uint64_t) uaddr ^ ((uint64_t) tgid << 40)) *
+		0x9e3779b97f4a7c15ULL;
+	const size_t idx = hash_index_get(&futex_index, hash, &key,
+					  futex_counts_match,
+					  futex_counts_count);
+	if (idx < futex_counts_count)
+		return &futex_counts[idx];
+
+	if (futex_counts_count >= futex_counts_size)
+		futex_counts = xgrowarray(futex_counts, &futex_counts_size,
+					  sizeof(*futex_counts));
+
+	struct futex_counts *fc = &futex_counts[futex_counts_count++];
+	*fc = (struct futex_counts) {
+		.tgid = tgid,
+		.uaddr = uaddr,
+	};
+
+	return fc;
+}
+
+static unsigned int
+hist_bucket(uint64_t ns)
+{
+	if (ns < HIST_SUB_BUCKETS)
+		return ns;
+
+	const unsigned int exp = 63 - __builtin_clzll(ns);
+	const unsigned int sub = (ns >> (exp - HIST_SUB_BITS)) &
+				 (HIST_SUB_BUCKETS - 1);
+
+	return (exp - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+/* The greatest value that belongs to the bucket. */
+static uint64_t
+hist_bucket_max(unsigned int bucket)
+{
+	if (bucket < HIST_SUB_BUCKETS)
+		return bucket;
+
+	const unsigned int shift = bucket / HIST_SUB_BUCKETS - 1;
+	const uint64_t sub = bucket % HIST_SUB_BUCKETS;
+
+	return ((HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+static void
+count_wait(struct tcb *tcp, kernel_ulong_t uaddr, const struct timespec *ts)
+{
+	struct futex_counts *fc = get_futex_counts(get_tcb_tgid(tcp), uaddr);
+	struct timespec dt;
+
+	ts_sub(&dt, ts, &tcp->etime);
+	if (dt.tv_sec < 0)
+		dt = (struct timespec) { 0, 0 };
+
+	fc->waits++;
+	if (syserror(tcp))
+		fc->wait_errors++;
+	ts_add(&fc->wait_time, &fc->wait_time, &dt);
+
+	if (!fc->hist)
+		fc->hist = xcalloc(HIST_BUCKETS, sizeof(*fc->hist));
+	fc->hist[hist_bucket((uint64_t) dt.tv_sec * 1000000000
+			     + dt.tv_nsec)]++;
+
+	if (fc->waits > 1 && ts_cmp(&dt, &fc->max_wait) <= 0)
+		return;
+	fc->max_wait = dt;
+
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_enabled) {
+		free(fc->max_wait_stack);
+		fc->max_wait_stack = unwind_tcb_sprint(tcp);
+	}
+#endif
+}
+
+static void
+count_wake(struct tcb *tcp, kernel_ulong_t uaddr)
+{
+	struct futex_counts *fc = get_futex_counts(get_tcb_tgid(tcp), uaddr);
+
+	fc->wakes++;
+	if (!syserror(tcp) && tcp->u_rval > 0)
+		fc->woken += tcp->u_rval;
+}
+
+void
+count_futex_syscall(struct tcb *tcp, const struct timespec *ts)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_futex_time32:
+	case SEN_futex_time64:
+		break;
+	default:
+		return;
+	}
+
+	const kernel_ulong_t uaddr = tcp->u_arg[0];
+	const int cmd = tcp->u_arg[1] & 127;
+
+	switch (cmd) {
+	case FUTEX_WAIT:
+	case FUTEX_WAIT_BITSET:
+	case FUTEX_LOCK_PI:
+	case FUTEX_LOCK_PI2:
+		count_wait(tcp, uaddr, ts);
+		break;
+	case FUTEX_WAKE:
+	case FUTEX_WAKE_BITSET:
+	case FUTEX_WAKE_OP:
+	case FUTEX_UNLOCK_PI:
+		count_wake(tcp, uaddr);
+		break;
+	}
+}
+
+static uint64_t
+ts_usec(const struct timespec *ts)
+{
+	return (uint64_t) ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static uint64_t
+p99_usec(const struct futex_counts *fc)
+{
+	const uint64_t rank = fc->waits - fc->waits / 100;
+	uint64_t count = 0;
+
+	for (unsigned int i = 0; i < HIST_BUCKETS; ++i) {
+		count += fc->hist[i];
+		if (count >= rank) {
+			const uint64_t ns = hist_bucket_max(i);
+			const uint64_t max = ts_usec(&fc->max_wait);
+
+			return MIN(ns / 1000, max);
+		}
+	}
+
+	return ts_usec(&fc->max_wait);
+}
+
+static int
+futex_counts_cmp(const void *a, const void *b)
+{
+	const struct futex_counts *fca = a;
+	const struct futex_counts *fcb = b;
+	const int rc = ts_cmp(&fcb->wait_time, &fca->wait_time);
+
+	if (rc)
+		return rc;
+	if (fca->waits != fcb->waits)
+		return fca->waits < fcb->waits ? 1 : -1;
+	if (fca->wakes != fcb->wakes)
+		return fca->wakes < fcb->wakes ? 1 : -1;
+	if (fca->tgid != fcb->tgid)
+		return fca->tgid < fcb->tgid ? -1 : 1;
+	return fca->uaddr < fcb->uaddr ? -1 : fca->uaddr > fcb->uaddr;
+}
+
+void
+futex_profile(FILE *outf)
+{
+	struct timespec tv_cum = { 0, 0 };
+	uint64_t waits_cum = 0, errors_cum = 0;
+	uint64_t wakes_cum = 0, woken_cum = 0;
+
+	hash_index_free(&futex_index);
+	qsort(futex_counts, futex_counts_count, sizeof(*futex_counts),
+	      futex_counts_cmp);
+
+	for (size_t i = 0; i < futex_counts_count; ++i) {
+		ts_add(&tv_cum, &tv_cum, &futex_counts[i].wait_time);
+		waits_cum += futex_counts[i].waits;
+		errors_cum += futex_counts[i].wait_errors;
+		wakes_cum += futex_counts[i].wakes;
+		woken_cum += futex_counts[i].woken;
+	}
+
+	static const struct count_table_column columns[] = {
+		{ "seconds", 11 },
+		{ "p99 usecs", 11 },
+		{ "max usecs", 11 },
+		{ "waits", 9 },
+		{ "errors", 9 },
+		{ "wakes", 9 },
+		{ "woken", 9 },
+		{ "tgid", 7 },
+		{ "address", -16 },
+	};
+	const size_t rows = MIN(futex_counts_count, FUTEX_PROFILE_ROWS);
+
+	fprintf(outf, "Futex contention by address:\n");
+	count_table_header(outf, columns, ARRAY_SIZE(columns));
+
+	for (size_t i = 0; i < rows; ++i) {
+		const struct futex_counts *fc = &futex_counts[i];
+
+		fprintf(outf, "%11.6f %11" PRIu64 " %11" PRIu64 " %9" PRIu64
+			" %9.0" PRIu64 " %9" PRIu64 " %9" PRIu64
+			" %7d %#" PRI_klx "\n",
+			ts_float(&fc->wait_time),
+			fc->waits ? p99_usec(fc) : 0,
+			ts_usec(&fc->max_wait),
+			fc->waits, fc->wait_errors, fc->wakes, fc->woken,
+			fc->tgid, fc->uaddr);
+		if (fc->max_wait_stack)
+			fputs(fc->max_wait_stack, outf);
+	}
+
+	if (rows < futex_counts_count)
+		fprintf(outf, "(%zu less contended addresses are not shown)\n",
+			futex_counts_count - rows);
+
+	count_table_divider(outf, columns, ARRAY_SIZE(columns));
+	fprintf(outf, "%11.6f %11.11s %11.11s %9" PRIu64 " %9.0" PRIu64
+		" %9" PRIu64 " %9" PRIu64 " %7.7s %s\n",
+		ts_float(&tv_cum), "", "", waits_cum, errors_cum,
+		wakes_cum, woken_cum, "", "total");
+}
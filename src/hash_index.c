@@ -0,0 +1,101 @@
+/*
+ * Open addressing hash index of array entries.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "hash_index.h"
+
+struct hash_index_slot {
+	uint64_t hash;
+	/* The array index of the entry + 1, 0 for empty slots. */
+	size_t idx;
+};
+
+static size_t
+slot_pos(const struct hash_index *hi, uint64_t hash)
+{
+	/* Multiplicative hashes keep their entropy in the high bits. */
+	return (size_t) (hash ^ (hash >> 32)) & (hi->size - 1);
+}
+
+static struct hash_index_slot *
+find_slot(const struct hash_index *hi, uint64_t hash, const void *key,
+	  hash_index_match_fn match)
+{
+	const size_t mask = hi->size - 1;
+
+	for (size_t i = slot_pos(hi, hash);; i = (i + 1) & mask) {
+		struct hash_index_slot *slot = &hi->slots[i];
+
+		if (!slot->idx ||
+		    (slot->hash == hash && match(slot->idx - 1, key)))
+			return slot;
+	}
+}
+
+static void
+grow(struct hash_index *hi)
+{
+	struct hash_index_slot *old = hi->slots;
+	const size_t old_size = hi->size;
+
+	hi->size = old_size ? old_size * 2 : 64;
+	hi->slots = xcalloc(hi->size, sizeof(*hi->slots));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (!old[i].idx)
+			continue;
+
+		size_t pos = slot_pos(hi, old[i].hash);
+
+		while (hi->slots[pos].idx)
+			pos = (pos + 1) & (hi->size - 1);
+		hi->slots[pos] = old[i];
+	}
+
+	free(old);
+}
+
+size_t
+hash_index_find(const struct hash_index *hi, uint64_t hash, const void *key,
+		hash_index_match_fn match)
+{
+	if (!hi->count)
+		return HASH_INDEX_NONE;
+
+	const struct hash_index_slot *slot = find_slot(hi, hash, key, match);
+
+	return slot->idx ? slot->idx - 1 : HASH_INDEX_NONE;
+}
+
+size_t
+hash_index_get(struct hash_index *hi, uint64_t hash, const void *key,
+	       hash_index_match_fn match, size_t new_idx)
+{
+	if ((hi->count + 1) * 2 > hi->size)
+		grow(hi);
+
+	struct hash_index_slot *slot = find_slot(hi, hash, key, match);
+
+	if (!slot->idx) {
+		*slot = (struct hash_index_slot) {
+			.hash = hash,
+			.idx = new_idx + 1,
+		};
+		hi->count++;
+	}
+
+	return slot->idx - 1;
+}
+
+void
+hash_index_free(struct hash_index *hi)
+{
+	free(hi->slots);
+	*hi = (struct hash_index) { NULL };
+}
@@ -0,0 +1,70 @@
+/*
+ * Open addressing hash index of array entries.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef STRACE_HASH_INDEX_H
+# define STRACE_HASH_INDEX_H
+
+# include <stdbool.h>
+# include <stddef.h>
+# include <stdint.h>
+
+/*
+ * An index of the entries of an array that is kept by its user:
+ * the index stores the array indices of the entries along with
+ * their hashes, and the entries are compared with a key by a callback.
+ * Entries cannot be removed, and the index is not valid anymore
+ * once the array entries are reordered.
+ */
+struct hash_index {
+	struct hash_index_slot *slots;
+	size_t size;	/* a power of 2 */
+	size_t count;
+};
+
+/* Returned by hash_index_find if there is no entry with the key. */
+# define HASH_INDEX_NONE	((size_t) -1)
+
+/* Returns whether the array entry idx has the key. */
+typedef bool (*hash_index_match_fn)(size_t idx, const void *key);
+
+/*
+ * Returns the array index of the entry with the key and the hash,
+ * or HASH_INDEX_NONE.
+ */
+extern size_t
+hash_index_find(const struct hash_index *, uint64_t hash, const void *key,
+		hash_index_match_fn);
+
+/*
+ * Returns the array index of the entry with the key and the hash;
+ * if there is none, adds new_idx to the index and returns it, the caller
+ * is expected to store the new entry there.
+ */
+extern size_t
+hash_index_get(struct hash_index *, uint64_t hash, const void *key,
+	       hash_index_match_fn, size_t new_idx);
+
+extern void
+hash_index_free(struct hash_index *);
+
+# define HASH_STR_INIT	0xcbf29ce484222325ULL
+
+/* FNV-1a hash of a string, h is HASH_STR_INIT or the hash of preceding data. */
+static inline uint64_t
+hash_str(uint64_t h, const char *str)
+{
+	for (; *str; ++str) {
+		h ^= (unsigned char) *str;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+#endif /* !STRACE_HASH_INDEX_H */
@@ -0,0 +1,258 @@
+/*
+ * I/O summary: the number of calls, bytes transferred, and time spent
+ * in I/O syscalls aggregated by file.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <limits.h>
+
+#include "count_table.h"
+#include "hash_index.h"
+#include "number_set.h"
+#include "sen.h"
+
+struct io_counts {
+	/* Interned description of the file, e.g. its path. */
+	const char *name;
+	struct timespec time;
+	uint64_t calls, errors;
+	uint64_t bytes_read, bytes_written;
+};
+
+/*
+ * The maximum number of files accounted separately, the calls on any other
+ * files are accounted to other_io_counts, so that a tracee opening
+ * an unbounded number of files cannot make the summary grow without bound.
+ */
+#define MAX_IO_COUNTS	4096
+
+static struct io_counts *io_counts;
+static size_t io_counts_count;
+static size_t io_counts_size;
+
+static struct hash_index io_index;
+
+static struct io_counts other_io_counts = { .name = "(other files)" };
+
+static bool
+io_counts_match(size_t idx, const void *name)
+{
+	return !strcmp(io_counts[idx].name, name);
+}
+
+static struct io_counts *
+get_io_counts(const char *name)
+{
+	const uint64_t hash = hash_str(HASH_STR_INIT, name);
+
+	if (io_counts_count >= MAX_IO_COUNTS) {
+		const size_t idx = hash_index_find(&io_index, hash, name,
+						   io_counts_match);
+
+		return idx != HASH_INDEX_NONE ? &io_counts[idx]
+					      : &other_io_counts;
+	}
+
+	const size_t idx = hash_index_get(&io_index, hash, name,
+					  io_counts_match, io_counts_count);
+	if (idx < io_counts_count)
+		return &io_counts[idx];
+
+	if (io_counts_count >= io_counts_size)
+		io_counts = xgrowarray(io_counts, &io_counts_size,
+				       sizeof(*io_counts));
+
+	struct io_counts *ic = &io_counts[io_counts_count++];
+	*ic = (struct io_counts) {
+		.name = xstrdup(name),
+	};
+
+	return ic;
+}
+
+/*
+ * Describe the file the same way -y and -yy options do:
+ * by its path, or by socket details if -yy is in effect.
+ */
+static const char *
+describe_fd(struct tcb *tcp, int fd, char *buf, size_t bufsize)
+{
+	if (getfdpath(tcp, fd, buf, bufsize) < 0)
+		return "?";
+
+	if (is_number_in_set(DECODE_FD_SOCKET, decode_fd_set)) {
+		const char *str = STR_STRIP_PREFIX(buf, "socket:[");
+
+		if (str != buf) {
+			const unsigned long inode = getfdinode(tcp, fd);
+			const char *details =
+				inode ? get_sockaddr_by_inode(tcp, fd, inode)
+				      : NULL;
+
+			if (details)
+				return details;
+		}
+	}
+
+	return buf;
+}
+
+static struct io_counts *
+get_fd_io_counts(struct tcb *tcp, int fd)
+{
+	char path[PATH_MAX + 1];
+
+	return get_io_counts(describe_fd(tcp, fd, path, sizeof(path)));
+}
+
+static void
+count_fd(struct tcb *tcp, int fd, bool is_read, const struct timespec *ts)
+{
+	struct io_counts *ic = get_fd_io_counts(tcp, fd);
+
+	ic->calls++;
+	ts_add(&ic->time, &ic->time, ts);
+
+	if (syserror(tcp)) {
+		ic->errors++;
+		return;
+	}
+
+	if (tcp->u_rval <= 0)
+		return;
+	if (is_read)
+		ic->bytes_read += tcp->u_rval;
+	else
+		ic->bytes_written += tcp->u_rval;
+}
+
+/*
+ * A syscall transferring data from in_fd to out_fd is accounted once,
+ * to out_fd, while the bytes transferred are credited to both of them.
+ */
+static void
+count_fd_pair(struct tcb *tcp, int in_fd, int out_fd,
+	      const struct timespec *ts)
+{
+	count_fd(tcp, out_fd, false, ts);
+
+	if (syserror(tcp) || tcp->u_rval <= 0)
+		return;
+	get_fd_io_counts(tcp, in_fd)->bytes_read += tcp->u_rval;
+}
+
+void
+count_io_syscall(struct tcb *tcp, const struct timespec *ts)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_pread:
+	case SEN_preadv:
+	case SEN_preadv2:
+	case SEN_read:
+	case SEN_readv:
+	case SEN_recv:
+	case SEN_recvfrom:
+	case SEN_recvmsg:
+		count_fd(tcp, tcp->u_arg[0], true, ts);
+		break;
+	case SEN_pwrite:
+	case SEN_pwritev:
+	case SEN_pwritev2:
+	case SEN_send:
+	case SEN_sendmsg:
+	case SEN_sendto:
+	case SEN_write:
+	case SEN_writev:
+		count_fd(tcp, tcp->u_arg[0], false, ts);
+		break;
+	case SEN_sendfile:
+	case SEN_sendfile64:
+		count_fd_pair(tcp, tcp->u_arg[1], tcp->u_arg[0], ts);
+		break;
+	case SEN_copy_file_range:
+	case SEN_splice:
+		count_fd_pair(tcp, tcp->u_arg[0], tcp->u_arg[2], ts);
+		break;
+	case SEN_tee:
+		count_fd_pair(tcp, tcp->u_arg[0], tcp->u_arg[1], ts);
+		break;
+	}
+}
+
+static int
+io_counts_cmp(const void *a, const void *b)
+{
+	const struct io_counts *ica = a;
+	const struct io_counts *icb = b;
+	const int rc = ts_cmp(&icb->time, &ica->time);
+	const uint64_t bytes_a = ica->bytes_read + ica->bytes_written;
+	const uint64_t bytes_b = icb->bytes_read + icb->bytes_written;
+
+	if (rc)
+		return rc;
+	if (bytes_a != bytes_b)
+		return bytes_a < bytes_b ? 1 : -1;
+	return strcmp(ica->name, icb->name);
+}
+
+void
+io_summary(FILE *outf)
+{
+	struct timespec tv_cum = { 0, 0 };
+	uint64_t calls_cum = 0, errors_cum = 0;
+	uint64_t read_cum = 0, written_cum = 0;
+
+	hash_index_free(&io_index);
+	if (other_io_counts.calls || other_io_counts.bytes_read) {
+		if (io_counts_count >= io_counts_size)
+			io_counts = xgrowarray(io_counts, &io_counts_size,
+					       sizeof(*io_counts));
+		io_counts[io_counts_count++] = other_io_counts;
+	}
+	qsort(io_counts, io_counts_count, sizeof(*io_counts), io_counts_cmp);
+
+	for (size_t i = 0; i < io_counts_count; ++i) {
+		ts_add(&tv_cum, &tv_cum, &io_counts[i].time);
+		calls_cum += io_counts[i].calls;
+		errors_cum += io_counts[i].errors;
+		read_cum += io_counts[i].bytes_read;
+		written_cum += io_counts[i].bytes_written;
+	}
+
+	static const struct count_table_column columns[] = {
+		{ "% time", 6 },
+		{ "seconds", 11 },
+		{ "usecs/call", 11 },
+		{ "calls", 9 },
+		{ "errors", 9 },
+		{ "bytes read", 13 },
+		{ "bytes written", 13 },
+		{ "file", -16 },
+	};
+	const double float_tv_cum = ts_float(&tv_cum);
+
+	fprintf(outf, "I/O summary by file:\n");
+	count_table_header(outf, columns, ARRAY_SIZE(columns));
+
+	for (size_t i = 0; i < io_counts_count; ++i) {
+		const struct io_counts *ic = &io_counts[i];
+
+		count_table_time(outf, ts_float(&ic->time), float_tv_cum,
+				 ic->calls);
+		fprintf(outf, " %9" PRIu64 " %9.0" PRIu64 " %13" PRIu64
+			" %13" PRIu64 " %s\n",
+			ic->calls, ic->errors,
+			ic->bytes_read, ic->bytes_written, ic->name);
+	}
+
+	count_table_divider(outf, columns, ARRAY_SIZE(columns));
+	count_table_total_time(outf, float_tv_cum, calls_cum);
+	fprintf(outf, " %9" PRIu64 " %9.0" PRIu64 " %13" PRIu64 " %13" PRIu64
+		" total\n",
+		calls_cum, errors_cum, read_cum, written_cum);
+}
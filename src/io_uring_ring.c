@@ -0,0 +1,676 @@
+/*
+ * Decoding of io_uring submission and completion queue entries
+ * by reading the rings shared between the tracee and the kernel.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include <linux/io_uring.h>
+
+#include "count_table.h"
+#include "list.h"
+#include "mmap_notify.h"
+#include "number_set.h"
+#include "sen.h"
+
+#include "xlat/uring_ops.h"
+#include "xlat/uring_sqe_flags.h"
+
+/* Setup flags of newer kernels changing the layout of the rings. */
+#ifndef IORING_SETUP_SQE128
+# define IORING_SETUP_SQE128	(1U << 10)
+#endif
+#ifndef IORING_SETUP_CQE32
+# define IORING_SETUP_CQE32	(1U << 11)
+#endif
+#ifndef IORING_SETUP_NO_MMAP
+# define IORING_SETUP_NO_MMAP	(1U << 14)
+#endif
+#ifndef IORING_SETUP_NO_SQARRAY
+# define IORING_SETUP_NO_SQARRAY	(1U << 16)
+#endif
+
+struct io_uring_region {
+	kernel_ulong_t addr;
+	kernel_ulong_t len;
+};
+
+/*
+ * An io_uring instance created by io_uring_setup,
+ * and its rings mapped into the address space of the process.
+ */
+struct io_uring_ring {
+	struct list_item list;
+	int tgid;
+	int fd;
+	struct io_uring_params params;
+	struct io_uring_region sq_ring;
+	struct io_uring_region cq_ring;
+	struct io_uring_region sqes;
+	/* CQEs before this CQ ring position have been printed already. */
+	uint32_t cq_seen;
+};
+
+static EMPTY_LIST(rings);
+
+/* Whether io_uring_enter is traced, so that the rings have to be tracked. */
+static bool rings_enabled;
+
+/* SQEs and CQEs fetched on io_uring_enter exit to be printed. */
+struct io_uring_events {
+	unsigned int sqe_count;
+	unsigned int cqe_count;
+	bool sqes_truncated;
+	bool cqes_truncated;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+};
+
+/* The number of submitted SQEs by opcode, for -c. */
+static uint64_t op_counts[256];
+
+static struct io_uring_ring *
+find_ring(const int tgid, const int fd)
+{
+	struct io_uring_ring *ring;
+
+	list_foreach(ring, &rings, list) {
+		if (ring->tgid == tgid && ring->fd == fd)
+			return ring;
+	}
+
+	return NULL;
+}
+
+static void
+free_ring(struct io_uring_ring *ring)
+{
+	list_remove(&ring->list);
+	free(ring);
+}
+
+static void
+unmap_region(struct io_uring_region *r, const kernel_ulong_t addr,
+	     const kernel_ulong_t len)
+{
+	if (r->len && r->addr < addr + len && addr < r->addr + r->len)
+		*r = (struct io_uring_region) { 0 };
+}
+
+static void
+unmap_ring(struct io_uring_ring *ring, const kernel_ulong_t addr,
+	   const kernel_ulong_t len)
+{
+	unmap_region(&ring->sq_ring, addr, len);
+	unmap_region(&ring->cq_ring, addr, len);
+	unmap_region(&ring->sqes, addr, len);
+}
+
+static void
+remap_region(struct io_uring_region *r, const struct mmap_notify_event *ev)
+{
+	if (r->len && r->addr == ev->old_addr)
+		*r = (struct io_uring_region) { ev->addr, ev->len };
+	else
+		unmap_region(r, ev->old_addr, ev->old_len);
+}
+
+static void
+map_ring(struct io_uring_ring *ring, const struct mmap_notify_event *ev)
+{
+	const struct io_uring_region r = { ev->addr, ev->len };
+
+	switch (ev->offset) {
+	case IORING_OFF_SQ_RING:
+		ring->sq_ring = r;
+		if (ring->params.features & IORING_FEAT_SINGLE_MMAP)
+			ring->cq_ring = r;
+		break;
+	case IORING_OFF_CQ_RING:
+		ring->cq_ring = r;
+		break;
+	case IORING_OFF_SQES:
+		ring->sqes = r;
+		break;
+	}
+}
+
+static void
+io_uring_mmap_update(struct tcb *tcp, const struct mmap_notify_event *ev,
+		     void *data)
+{
+	const int tgid = get_tcb_tgid(tcp);
+	struct io_uring_ring *ring, *tmp;
+
+	list_foreach_safe(ring, &rings, list, tmp) {
+		if (ring->tgid != tgid)
+			continue;
+
+		switch (ev->op) {
+		case MMAP_NOTIFY_UNKNOWN:
+			free_ring(ring);
+			break;
+		case MMAP_NOTIFY_MAP:
+			unmap_ring(ring, ev->addr, ev->len);
+			if (ev->fd == ring->fd)
+				map_ring(ring, ev);
+			break;
+		case MMAP_NOTIFY_UNMAP:
+			unmap_ring(ring, ev->addr, ev->len);
+			break;
+		case MMAP_NOTIFY_REMAP:
+			remap_region(&ring->sq_ring, ev);
+			remap_region(&ring->cq_ring, ev);
+			remap_region(&ring->sqes, ev);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void
+ring_setup(struct tcb *tcp)
+{
+	struct io_uring_params params;
+
+	if (umove(tcp, tcp->u_arg[1], &params) ||
+	    (params.flags & IORING_SETUP_NO_MMAP) ||
+	    !params.sq_entries || !params.cq_entries)
+		return;
+
+	const int tgid = get_tcb_tgid(tcp);
+	const int fd = tcp->u_rval;
+	struct io_uring_ring *ring = find_ring(tgid, fd);
+
+	if (ring)
+		free_ring(ring);
+
+	ring = xzalloc(sizeof(*ring));
+	ring->tgid = tgid;
+	ring->fd = fd;
+	ring->params = params;
+	list_append(&rings, &ring->list);
+}
+
+static bool
+fetch_u32(struct tcb *tcp, const struct io_uring_region *r,
+	  const uint32_t offset, uint32_t *val)
+{
+	return r->len >= sizeof(*val) && offset <= r->len - sizeof(*val) &&
+	       !umove(tcp, r->addr + offset, val);
+}
+
+/*
+ * Fetch count ring entries of entry_size bytes starting at ring position pos
+ * into buf, the ring has ring_entries entries at addr.
+ */
+static bool
+fetch_ring_entries(struct tcb *tcp, const kernel_ulong_t addr,
+		   const uint32_t ring_entries, const size_t entry_size,
+		   const uint32_t pos, const uint32_t count, void *buf)
+{
+	const uint32_t first = pos & (ring_entries - 1);
+	const uint32_t n = MIN(count, ring_entries - first);
+
+	return !umoven(tcp, addr + first * entry_size, n * entry_size, buf) &&
+	       (n == count ||
+		!umoven(tcp, addr, (count - n) * entry_size,
+			(char *) buf + n * entry_size));
+}
+
+/* A buffer for entries fetched from the rings. */
+static void *
+get_scratch(const size_t size)
+{
+	static void *buf;
+	static size_t buf_size;
+
+	if (size > buf_size) {
+		free(buf);
+		buf_size = MAX(size, buf_size * 2);
+		buf = xmalloc(buf_size);
+	}
+
+	return buf;
+}
+
+/*
+ * Fetch the count SQEs that have been just consumed by the kernel,
+ * reading runs of consecutive SQEs at once.
+ */
+static struct io_uring_sqe *
+fetch_sqes(struct tcb *tcp, const struct io_uring_ring *ring, uint32_t count)
+{
+	const struct io_uring_params *p = &ring->params;
+	const size_t sqe_size = sizeof(struct io_uring_sqe) *
+				(p->flags & IORING_SETUP_SQE128 ? 2 : 1);
+	uint32_t head;
+
+	if (!ring->sqes.len || !fetch_u32(tcp, &ring->sq_ring,
+					  p->sq_off.head, &head))
+		return NULL;
+
+	count = MIN(count, p->sq_entries);
+
+	uint32_t *idx = xcalloc(count, sizeof(*idx));
+
+	if (p->flags & IORING_SETUP_NO_SQARRAY) {
+		for (uint32_t i = 0; i < count; ++i)
+			idx[i] = (head - count + i) & (p->sq_entries - 1);
+	} else if (p->sq_off.array + (uint64_t) p->sq_entries * sizeof(*idx)
+		   > ring->sq_ring.len ||
+		   !fetch_ring_entries(tcp, ring->sq_ring.addr + p->sq_off.array,
+				       p->sq_entries, sizeof(*idx),
+				       head - count, count, idx)) {
+		free(idx);
+		return NULL;
+	}
+
+	struct io_uring_sqe *sqes = xcalloc(count, sizeof(*sqes));
+
+	for (uint32_t i = 0, run; i < count; i += run) {
+		if (idx[i] >= p->sq_entries ||
+		    (idx[i] + 1) * sqe_size > ring->sqes.len)
+			goto fail;
+
+		for (run = 1; i + run < count &&
+			      idx[i + run] == idx[i] + run &&
+			      (idx[i + run] + 1) * sqe_size <= ring->sqes.len;
+		     ++run)
+			;
+
+		char *buf = get_scratch(run * sqe_size);
+
+		if (umoven(tcp, ring->sqes.addr + idx[i] * sqe_size,
+			   run * sqe_size, buf))
+			goto fail;
+		for (uint32_t j = 0; j < run; ++j)
+			memcpy(&sqes[i + j], buf + j * sqe_size,
+			       sizeof(*sqes));
+	}
+
+	free(idx);
+	return sqes;
+
+fail:
+	free(idx);
+	free(sqes);
+	return NULL;
+}
+
+/*
+ * Fetch CQEs posted since the previous io_uring_enter exit
+ * that have not been consumed by the tracee yet.
+ */
+static struct io_uring_cqe *
+fetch_cqes(struct tcb *tcp, struct io_uring_ring *ring, uint32_t *pcount)
+{
+	const struct io_uring_params *p = &ring->params;
+	const size_t cqe_size = sizeof(struct io_uring_cqe) *
+				(p->flags & IORING_SETUP_CQE32 ? 2 : 1);
+	uint32_t head, tail;
+
+	if (!fetch_u32(tcp, &ring->cq_ring, p->cq_off.head, &head) ||
+	    !fetch_u32(tcp, &ring->cq_ring, p->cq_off.tail, &tail) ||
+	    p->cq_off.cqes + (uint64_t) p->cq_entries * cqe_size
+	    > ring->cq_ring.len)
+		return NULL;
+
+	uint32_t pos = head;
+
+	if ((int32_t) (ring->cq_seen - head) > 0 &&
+	    (int32_t) (tail - ring->cq_seen) >= 0)
+		pos = ring->cq_seen;
+	ring->cq_seen = tail;
+
+	const uint32_t count = MIN(tail - pos, p->cq_entries);
+
+	if (!count)
+		return NULL;
+
+	char *buf = get_scratch(count * cqe_size);
+
+	if (!fetch_ring_entries(tcp, ring->cq_ring.addr + p->cq_off.cqes,
+				p->cq_entries, cqe_size, pos, count, buf))
+		return NULL;
+
+	struct io_uring_cqe *cqes = xcalloc(count, sizeof(*cqes));
+
+	for (uint32_t i = 0; i < count; ++i)
+		memcpy(&cqes[i], buf + i * cqe_size, sizeof(*cqes));
+
+	*pcount = count;
+	return cqes;
+}
+
+static void
+free_io_uring_events(void *data)
+{
+	struct io_uring_events *ev = data;
+
+	free(ev->sqes);
+	free(ev->cqes);
+	free(ev);
+}
+
+static void
+ring_enter(struct tcb *tcp)
+{
+	const bool print = text_output_enabled();
+
+	if (filtered(tcp) || syscall_tampered(tcp) || (!print && !cflag))
+		return;
+
+	struct io_uring_ring *ring = find_ring(get_tcb_tgid(tcp),
+					       tcp->u_arg[0]);
+
+	if (!ring || !ring->sq_ring.len)
+		return;
+
+	struct io_uring_events *ev = xzalloc(sizeof(*ev));
+
+	/*
+	 * The return value is the number of SQEs consumed,
+	 * with SQPOLL they are consumed by the kernel thread instead.
+	 */
+	if (!(ring->params.flags & IORING_SETUP_SQPOLL) && tcp->u_rval > 0) {
+		const uint32_t count = tcp->u_rval;
+
+		ev->sqes = fetch_sqes(tcp, ring, count);
+		if (ev->sqes)
+			ev->sqe_count = MIN(count, ring->params.sq_entries);
+	}
+
+	if (cflag) {
+		for (unsigned int i = 0; i < ev->sqe_count; ++i)
+			op_counts[ev->sqes[i].opcode]++;
+	}
+
+	if (print && ring->cq_ring.len)
+		ev->cqes = fetch_cqes(tcp, ring, &ev->cqe_count);
+
+	if (ev->sqe_count > max_strlen) {
+		ev->sqe_count = max_strlen;
+		ev->sqes_truncated = true;
+	}
+	if (ev->cqe_count > max_strlen) {
+		ev->cqe_count = max_strlen;
+		ev->cqes_truncated = true;
+	}
+
+	if (!print || set_tcb_priv_data(tcp, ev, free_io_uring_events))
+		free_io_uring_events(ev);
+}
+
+void
+io_uring_ring_init(void)
+{
+	for (unsigned int p = 0; p < SUPPORTED_PERSONALITIES; ++p) {
+		for (unsigned int i = 0; i < nsyscall_vec[p]; ++i) {
+			if (sysent_vec[p][i].sen == SEN_io_uring_enter &&
+			    is_number_in_set_array(i, trace_set, p))
+				rings_enabled = true;
+		}
+	}
+
+	/*
+	 * Register before the seccomp filter is built,
+	 * so that it stops on the syscalls changing memory mappings.
+	 */
+	if (rings_enabled)
+		mmap_notify_register_client(io_uring_mmap_update, NULL);
+}
+
+/*
+ * Unlike io_uring_syscall_affects, does not depend on the rings set up
+ * so far, as the seccomp filter is built before any of them.
+ */
+bool
+io_uring_seccomp_affects(const struct_sysent *s)
+{
+	if (!rings_enabled)
+		return false;
+
+	switch (s->sen) {
+	case SEN_close:
+	case SEN_io_uring_enter:
+	case SEN_io_uring_setup:
+		return true;
+	}
+
+	return s->sys_flags & MEMORY_MAPPING_CHANGE;
+}
+
+bool
+io_uring_syscall_affects(const struct_sysent *s)
+{
+	if (!rings_enabled)
+		return false;
+
+	switch (s->sen) {
+	case SEN_io_uring_setup:
+		return true;
+	case SEN_close:
+	case SEN_io_uring_enter:
+		return !list_is_empty(&rings);
+	}
+
+	return false;
+}
+
+void
+io_uring_syscall_exit(struct tcb *tcp, const bool has_result)
+{
+	if (!has_result || syserror(tcp))
+		return;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_io_uring_setup:
+		ring_setup(tcp);
+		break;
+	case SEN_close: {
+		struct io_uring_ring *ring =
+			find_ring(get_tcb_tgid(tcp), tcp->u_arg[0]);
+
+		if (ring)
+			free_ring(ring);
+		break;
+	}
+	case SEN_io_uring_enter:
+		ring_enter(tcp);
+		break;
+	}
+}
+
+static const char *
+sqe_op_flags_name(const uint8_t opcode)
+{
+	switch (opcode) {
+	case IORING_OP_FSYNC:
+		return "fsync_flags";
+	case IORING_OP_POLL_ADD:
+	case IORING_OP_POLL_REMOVE:
+		return "poll32_events";
+	case IORING_OP_SYNC_FILE_RANGE:
+		return "sync_range_flags";
+	case IORING_OP_SENDMSG:
+	case IORING_OP_RECVMSG:
+	case IORING_OP_SEND:
+	case IORING_OP_RECV:
+		return "msg_flags";
+	case IORING_OP_TIMEOUT:
+	case IORING_OP_TIMEOUT_REMOVE:
+	case IORING_OP_LINK_TIMEOUT:
+		return "timeout_flags";
+	case IORING_OP_ACCEPT:
+		return "accept_flags";
+	case IORING_OP_ASYNC_CANCEL:
+		return "cancel_flags";
+	case IORING_OP_OPENAT:
+	case IORING_OP_OPENAT2:
+		return "open_flags";
+	case IORING_OP_STATX:
+		return "statx_flags";
+	case IORING_OP_FADVISE:
+		return "fadvise_advice";
+	case IORING_OP_SPLICE:
+	case IORING_OP_TEE:
+		return "splice_flags";
+	case IORING_OP_RENAMEAT:
+		return "rename_flags";
+	case IORING_OP_UNLINKAT:
+		return "unlink_flags";
+	default:
+		return "rw_flags";
+	}
+}
+
+static void
+print_io_uring_sqe(struct tcb *tcp, const struct io_uring_sqe *sqe)
+{
+	tprint_struct_begin();
+	PRINT_FIELD_XVAL(*sqe, opcode, uring_ops, "IORING_OP_???");
+	if (sqe->flags) {
+		tprint_struct_next();
+		PRINT_FIELD_FLAGS(*sqe, flags, uring_sqe_flags, "IOSQE_???");
+	}
+	if (sqe->ioprio) {
+		tprint_struct_next();
+		PRINT_FIELD_X(*sqe, ioprio);
+	}
+	tprint_struct_next();
+	if (sqe->flags & IOSQE_FIXED_FILE)
+		PRINT_FIELD_D(*sqe, fd);
+	else
+		PRINT_FIELD_FD(*sqe, fd, tcp);
+	tprint_struct_next();
+	PRINT_FIELD_U(*sqe, off);
+	tprint_struct_next();
+	PRINT_FIELD_ADDR64(*sqe, addr);
+	tprint_struct_next();
+	PRINT_FIELD_U(*sqe, len);
+	if (sqe->rw_flags) {
+		tprint_struct_next();
+		tprints_field_name(sqe_op_flags_name(sqe->opcode));
+		PRINT_VAL_X((uint32_t) sqe->rw_flags);
+	}
+	tprint_struct_next();
+	PRINT_FIELD_X(*sqe, user_data);
+	if (sqe->buf_index) {
+		tprint_struct_next();
+		PRINT_FIELD_U(*sqe, buf_index);
+	}
+	if (sqe->personality) {
+		tprint_struct_next();
+		PRINT_FIELD_U(*sqe, personality);
+	}
+	if (sqe->opcode == IORING_OP_SPLICE || sqe->opcode == IORING_OP_TEE) {
+		tprint_struct_next();
+		PRINT_FIELD_FD(*sqe, splice_fd_in, tcp);
+	}
+	tprint_struct_end();
+}
+
+static void
+print_io_uring_cqe(const struct io_uring_cqe *cqe)
+{
+	tprint_struct_begin();
+	PRINT_FIELD_X(*cqe, user_data);
+	tprint_struct_next();
+	if (cqe->res < 0)
+		PRINT_FIELD_ERR_D(*cqe, res);
+	else
+		PRINT_FIELD_D(*cqe, res);
+	tprint_struct_next();
+	PRINT_FIELD_X(*cqe, flags);
+	tprint_struct_end();
+}
+
+/*
+ * Print the SQEs submitted and the CQEs posted by io_uring_enter
+ * on separate lines after the syscall.
+ */
+void
+print_io_uring_events(struct tcb *tcp)
+{
+	if (tcp_sysent(tcp)->sen != SEN_io_uring_enter)
+		return;
+
+	const struct io_uring_events *ev = get_tcb_priv_data(tcp);
+
+	if (!ev)
+		return;
+
+	for (unsigned int i = 0; i < ev->sqe_count; ++i) {
+		tprints(" > io_uring_sqe ");
+		print_io_uring_sqe(tcp, &ev->sqes[i]);
+		tprints("\n");
+	}
+	if (ev->sqes_truncated)
+		tprints(" > io_uring_sqe ...\n");
+
+	for (unsigned int i = 0; i < ev->cqe_count; ++i) {
+		tprints(" < io_uring_cqe ");
+		print_io_uring_cqe(&ev->cqes[i]);
+		tprints("\n");
+	}
+	if (ev->cqes_truncated)
+		tprints(" < io_uring_cqe ...\n");
+}
+
+static int
+op_cmp(const void *a, const void *b)
+{
+	const uint64_t count_a = op_counts[*(const uint8_t *) a];
+	const uint64_t count_b = op_counts[*(const uint8_t *) b];
+
+	if (count_a != count_b)
+		return count_a < count_b ? 1 : -1;
+	return *(const uint8_t *) a - *(const uint8_t *) b;
+}
+
+void
+io_uring_summary(FILE *outf)
+{
+	uint8_t ops[ARRAY_SIZE(op_counts)];
+	unsigned int nops = 0;
+	uint64_t total = 0;
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(op_counts); ++i) {
+		if (op_counts[i]) {
+			ops[nops++] = i;
+			total += op_counts[i];
+		}
+	}
+
+	if (!nops)
+		return;
+
+	qsort(ops, nops, sizeof(ops[0]), op_cmp);
+
+	static const struct count_table_column columns[] = {
+		{ "calls", 9 },
+		{ "operation", -16 },
+	};
+
+	fprintf(outf, "io_uring operations submitted:\n");
+	count_table_header(outf, columns, ARRAY_SIZE(columns));
+	for (unsigned int i = 0; i < nops; ++i) {
+		const char *name = xlookup(uring_ops, ops[i]);
+
+		if (name)
+			fprintf(outf, "%9" PRIu64 " %s\n",
+				op_counts[ops[i]], name);
+		else
+			fprintf(outf, "%9" PRIu64 " IORING_OP_%u\n",
+				op_counts[ops[i]], ops[i]);
+	}
+	count_table_divider(outf, columns, ARRAY_SIZE(columns));
+	fprintf(outf, "%9" PRIu64 " %s\n", total, "total");
+}
@@ -11,6 +11,8 @@
 
 #include "defs.h"
 #include <linux/ioctl.h>
+#include "print_utils.h"
+#include "xstring.h"
 #include "xlat/ioctl_dirs.h"
 
 #if defined(SPARC) || defined(SPARC64)
@@ -418,6 +420,38 @@ ioctl_decode(struct tcb *tcp)
 	return 0;
 }
 
+/* The name of the ioctl subdecoder of the command type for --decoder-stats. */
+static const char *
+ioctl_decoder_name(const unsigned int type)
+{
+	static char names[_IOC_TYPEMASK + 1][sizeof("0xff")];
+	char *const name = names[type & _IOC_TYPEMASK];
+
+	if (!*name) {
+		if (is_print(type))
+			xsprintf(names[type & _IOC_TYPEMASK], "'%c'", type);
+		else
+			xsprintf(names[type & _IOC_TYPEMASK], "%#x", type);
+	}
+
+	return name;
+}
+
+static int
+ioctl_decode_accounted(struct tcb *tcp)
+{
+	if (!decoder_stats_enabled)
+		return ioctl_decode(tcp);
+
+	decoder_stats_push("ioctl",
+			   ioctl_decoder_name(_IOC_TYPE(tcp->u_arg[1])),
+			   entering(tcp));
+	const int rc = ioctl_decode(tcp);
+	decoder_stats_pop();
+
+	return rc;
+}
+
 SYS_FUNC(ioctl)
 {
 	const struct_ioctlent *iop;
@@ -451,9 +485,9 @@ SYS_FUNC(ioctl)
 		if (xlat_verbosity == XLAT_STYLE_VERBOSE)
 			tprint_comment_end();
 
-		ret = ioctl_decode(tcp);
+		ret = ioctl_decode_accounted(tcp);
 	} else {
-		ret = ioctl_decode(tcp) | RVAL_DECODED;
+		ret = ioctl_decode_accounted(tcp) | RVAL_DECODED;
 	}
 
 	if (ret & RVAL_IOCTL_DECODED) {
@@ -0,0 +1,441 @@
+/*
+ * Merging of per-process output files produced by strace -ff -tt[t].
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/resource.h>
+
+#include "list.h"
+#include "xstring.h"
+
+/* stdout is written in large chunks rather than line by line. */
+#define MERGE_LOGS_BUFSIZE	(1024 * 1024)
+
+/*
+ * The input files are read in chunks of at most MERGE_LOGS_READ_MAX bytes,
+ * less if there are many of them, so that all the buffers together
+ * take about MERGE_LOGS_READ_TOTAL bytes.
+ */
+#define MERGE_LOGS_READ_MIN	4096
+#define MERGE_LOGS_READ_MAX	(64 * 1024)
+#define MERGE_LOGS_READ_TOTAL	(64 * 1024 * 1024)
+
+static size_t read_size;
+/* Set when an input file could not be read or has no -tt[t] timestamps. */
+static bool input_failed;
+
+/*
+ * Input files with open descriptors, the most recently read one first.
+ * At most max_open_files of them are kept open, so that the number
+ * of files merged is not limited by the limit on open descriptors.
+ */
+static EMPTY_LIST(open_files);
+static unsigned int open_count;
+static unsigned int max_open_files;
+
+/* An output file of a process and the data read from it. */
+struct log_file {
+	/* In open_files if fd is open. */
+	struct list_item lru;
+	unsigned long pid;
+	char *name;
+	int fd;
+	/*
+	 * The data read from the file, the unconsumed part starts with
+	 * the next record at the offset off.
+	 */
+	char *buf;
+	size_t off;
+	size_t len;
+	size_t size;
+	/* The file offset of the end of the data read. */
+	off_t pos;
+	bool eof;
+	/* The next record, a timestamped line followed by untimestamped ones. */
+	size_t rec_len;
+	/* The timestamp of the next record, in seconds and nanoseconds. */
+	uint64_t sec;
+	uint32_t nsec;
+};
+
+/*
+ * Parse the timestamp at the beginning of a line printed with -tt,
+ * -ttt, or --absolute-timestamps=precision:us and alike:
+ * [[HH:]MM:]SS.FRACTION followed by a space.  Timestamps printed with -t
+ * have no fraction and are not accepted, the order of the lines printed
+ * within a second would be lost.
+ */
+static bool
+parse_timestamp(const char *p, const char *end, uint64_t *psec,
+		uint32_t *pnsec)
+{
+	uint64_t sec = 0;
+	uint64_t val = 0;
+	unsigned int fields = 0;
+
+	for (;;) {
+		const char *start = p;
+
+		for (val = 0; p < end && *p >= '0' && *p <= '9'; ++p)
+			val = val * 10 + (*p - '0');
+		if (p == start || p == end)
+			return false;
+		++fields;
+		if (*p != ':')
+			break;
+		if (fields == 3)
+			return false;
+		sec = (sec + val) * 60;
+		++p;
+	}
+	sec += val;
+
+	uint32_t nsec = 0;
+
+	if (*p != '.')
+		return false;
+
+	const char *start = ++p;
+
+	for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+		if (p - start < 9)
+			nsec = nsec * 10 + (*p - '0');
+	}
+	if (p == start || p == end)
+		return false;
+	for (ptrdiff_t i = p - start; i < 9; ++i)
+		nsec *= 10;
+
+	if (*p != ' ')
+		return false;
+
+	*psec = sec;
+	*pnsec = nsec;
+	return true;
+}
+
+static void
+close_fd(struct log_file *f)
+{
+	close(f->fd);
+	f->fd = -1;
+	list_remove(&f->lru);
+	--open_count;
+}
+
+static bool
+open_fd(struct log_file *f)
+{
+	if (f->fd >= 0) {
+		if (list_head(&open_files, struct log_file, lru) != f) {
+			list_remove(&f->lru);
+			list_insert(&open_files, &f->lru);
+		}
+		return true;
+	}
+
+	if (open_count >= max_open_files)
+		close_fd(list_tail(&open_files, struct log_file, lru));
+
+	f->fd = open(f->name, O_RDONLY);
+	if (f->fd < 0) {
+		perror_msg("%s", f->name);
+		return false;
+	}
+
+	list_insert(&open_files, &f->lru);
+	++open_count;
+	return true;
+}
+
+/* Reads more data into the buffer, returns false at the end of file. */
+static bool
+read_more(struct log_file *f)
+{
+	if (f->eof)
+		return false;
+
+	/* Move the unconsumed data to the beginning of the buffer. */
+	if (f->off) {
+		memmove(f->buf, f->buf + f->off, f->len - f->off);
+		f->len -= f->off;
+		f->off = 0;
+	}
+
+	if (f->size - f->len < read_size) {
+		f->size = f->len + read_size;
+		f->buf = xreallocarray(f->buf, f->size, 1);
+	}
+
+	ssize_t n = -1;
+
+	if (open_fd(f)) {
+		n = pread(f->fd, f->buf + f->len, f->size - f->len, f->pos);
+		if (n < 0)
+			perror_msg("read: %s", f->name);
+	}
+
+	if (n <= 0) {
+		if (n < 0)
+			input_failed = true;
+		if (f->fd >= 0)
+			close_fd(f);
+		f->eof = true;
+		return false;
+	}
+
+	f->len += n;
+	f->pos += n;
+	return true;
+}
+
+/*
+ * Returns the end of the line starting at the offset start of
+ * the unconsumed data, reading more data as needed, or start if there
+ * are no more lines.  The last line of a file may be incomplete.
+ */
+static size_t
+get_line(struct log_file *f, const size_t start)
+{
+	for (size_t scanned = start;;) {
+		const char *const data = f->buf + f->off;
+		const size_t avail = f->len - f->off;
+		const char *nl = avail > scanned
+				 ? memchr(data + scanned, '\n', avail - scanned)
+				 : NULL;
+
+		if (nl)
+			return nl - data + 1;
+		scanned = avail;
+		if (!read_more(f))
+			return avail;
+	}
+}
+
+/*
+ * Drop the current record and find the next one.  Lines without
+ * a timestamp (e.g. stack traces printed with -k) belong to the preceding
+ * record, a file that does not start with a timestamp is rejected.
+ */
+static bool
+next_record(struct log_file *f)
+{
+	const size_t start = f->rec_len;
+	size_t end = get_line(f, start);
+
+	if (end == start) {
+		f->rec_len = 0;
+		return false;
+	}
+	if (!parse_timestamp(f->buf + f->off + start, f->buf + f->off + end,
+			     &f->sec, &f->nsec)) {
+		/* Only the first line can be untimestamped here. */
+		error_msg("%s: strace -tt or -ttt output expected", f->name);
+		input_failed = true;
+		f->rec_len = 0;
+		return false;
+	}
+	f->off += start;
+	end -= start;
+
+	for (;;) {
+		const size_t next = get_line(f, end);
+		uint64_t sec;
+		uint32_t nsec;
+
+		if (next == end ||
+		    parse_timestamp(f->buf + f->off + end,
+				    f->buf + f->off + next, &sec, &nsec))
+			break;
+		end = next;
+	}
+
+	f->rec_len = end;
+	return true;
+}
+
+static void
+close_log_file(struct log_file *f)
+{
+	if (f->fd >= 0)
+		close_fd(f);
+	free(f->buf);
+	free(f->name);
+}
+
+/*
+ * The records with the same timestamp are merged in the order of
+ * the files, sorted by name, like strace-log-merge does.
+ */
+static bool
+log_file_less(const struct log_file *a, const struct log_file *b)
+{
+	if (a->sec != b->sec)
+		return a->sec < b->sec;
+	if (a->nsec != b->nsec)
+		return a->nsec < b->nsec;
+	return a < b;
+}
+
+static int
+log_file_name_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct log_file *) a)->name,
+		      ((const struct log_file *) b)->name);
+}
+
+/* Binary min-heap of files ordered by the timestamp of their next records. */
+static void
+heap_sift_down(struct log_file **heap, size_t count, size_t i)
+{
+	for (;;) {
+		size_t min = i;
+		const size_t l = 2 * i + 1;
+		const size_t r = l + 1;
+
+		if (l < count && log_file_less(heap[l], heap[min]))
+			min = l;
+		if (r < count && log_file_less(heap[r], heap[min]))
+			min = r;
+		if (min == i)
+			return;
+
+		struct log_file *tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/*
+ * Merge PREFIX.PID files into a single log sorted by timestamps
+ * on stdout, every line is prefixed with the PID.
+ * Each file is sorted already, so a k-way merge is sufficient.
+ */
+int
+merge_logs(const char *prefix)
+{
+	const char *slash = strrchr(prefix, '/');
+	const char *base = slash ? slash + 1 : prefix;
+	const size_t base_len = strlen(base);
+	char dirname[PATH_MAX];
+
+	if (!slash)
+		strcpy(dirname, ".");
+	else if (slash == prefix)
+		strcpy(dirname, "/");
+	else if ((size_t) (slash - prefix) >= sizeof(dirname))
+		error_msg_and_die("%s: %s", prefix, strerror(ENAMETOOLONG));
+	else
+		xsprintf(dirname, "%.*s", (int) (slash - prefix), prefix);
+
+	DIR *dir = opendir(dirname);
+
+	if (!dir)
+		perror_msg_and_die("opendir: %s", dirname);
+
+	struct log_file *files = NULL;
+	size_t count = 0, size = 0;
+	struct dirent *de;
+
+	while ((de = readdir(dir))) {
+		if (strncmp(de->d_name, base, base_len) ||
+		    de->d_name[base_len] != '.')
+			continue;
+
+		const char *suffix = de->d_name + base_len + 1;
+		/* Like strace-log-merge, accept any unsigned 32-bit suffix. */
+		const long long pid = string_to_uint_upto(suffix, UINT32_MAX);
+
+		if (pid <= 0)
+			continue;
+
+		if (count >= size)
+			files = xgrowarray(files, &size, sizeof(*files));
+
+		files[count++] = (struct log_file) {
+			.pid = pid,
+			.name = xasprintf("%s/%s", dirname, de->d_name),
+			.fd = -1,
+		};
+	}
+	closedir(dir);
+
+	qsort(files, count, sizeof(*files), log_file_name_cmp);
+
+	read_size = MIN(MAX(MERGE_LOGS_READ_TOTAL / (count + 1),
+			    MERGE_LOGS_READ_MIN), MERGE_LOGS_READ_MAX);
+
+	/* Leave half of the descriptors for everything else. */
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) || rlim.rlim_cur == RLIM_INFINITY)
+		max_open_files = INT_MAX;
+	else
+		max_open_files = MAX(MIN(rlim.rlim_cur, (rlim_t) INT_MAX) / 2, 1);
+
+	/* Files without records are not merged. */
+	struct log_file **heap = xcalloc(count ? count : 1, sizeof(*heap));
+	unsigned int pid_width = 0;
+	size_t live = 0;
+
+	for (size_t i = 0; i < count; ++i) {
+		struct log_file *f = &files[i];
+
+		if (!next_record(f)) {
+			close_log_file(f);
+			continue;
+		}
+		pid_width = MAX(pid_width,
+				(unsigned int) snprintf(NULL, 0, "%lu", f->pid));
+		heap[live++] = f;
+	}
+
+	if (!live)
+		error_msg_and_die("%s: strace output not found", prefix);
+
+	for (size_t i = live / 2; i-- > 0; )
+		heap_sift_down(heap, live, i);
+
+	setvbuf(stdout, NULL, _IOFBF, MERGE_LOGS_BUFSIZE);
+
+	while (live) {
+		struct log_file *f = heap[0];
+		const char *const rec = f->buf + f->off;
+		const char *const rec_end = rec + f->rec_len;
+
+		for (const char *p = rec, *eol; p < rec_end; p = eol) {
+			eol = memchr(p, '\n', rec_end - p);
+			eol = eol ? eol + 1 : rec_end;
+			printf("%-*lu ", pid_width, f->pid);
+			fwrite(p, 1, eol - p, stdout);
+			/* The last line of a file may be incomplete. */
+			if (eol[-1] != '\n')
+				putchar('\n');
+		}
+
+		if (!next_record(f)) {
+			close_log_file(f);
+			heap[0] = heap[--live];
+		}
+		heap_sift_down(heap, live, 0);
+	}
+
+	free(heap);
+	free(files);
+
+	if (fflush(stdout) || ferror(stdout)) {
+		perror_msg("write");
+		return 1;
+	}
+
+	return input_failed;
+}
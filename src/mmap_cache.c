@@ -7,22 +7,357 @@
 
 #include "defs.h"
 #include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
 
 #include "largefile_wrappers.h"
 #include "mmap_cache.h"
 #include "mmap_notify.h"
+#include "trie.h"
 #include "xstring.h"
 
-static unsigned int mmap_cache_generation;
+/**
+ * Key:   thread group ID (as present in /proc)
+ * Value: struct mmap_cache_t shared by all threads of the process
+ */
+static struct trie *mmap_caches;
+
+static void
+clear_mmap_cache_entries(struct mmap_cache_t *cache)
+{
+	while (cache->size) {
+		unsigned int i = --cache->size;
+		free(cache->entry[i].binary_filename);
+		cache->entry[i].binary_filename = NULL;
+	}
+
+	free(cache->entry);
+	cache->entry = NULL;
+	cache->allocated = 0;
+}
+
+/* Returns the index of the first entry that ends after addr. */
+static unsigned int
+lower_bound(const struct mmap_cache_t *cache, unsigned long addr)
+{
+	unsigned int lower = 0;
+	unsigned int upper = cache->size;
+
+	while (lower < upper) {
+		unsigned int mid = lower + (upper - lower) / 2;
+
+		if (cache->entry[mid].end_addr <= addr)
+			lower = mid + 1;
+		else
+			upper = mid;
+	}
+	return lower;
+}
+
+/* Returns a new uninitialized entry inserted at idx. */
+static struct mmap_cache_entry_t *
+insert_entry(struct mmap_cache_t *cache, unsigned int idx)
+{
+	if (cache->size >= cache->allocated)
+		cache->entry = xgrowarray(cache->entry, &cache->allocated,
+					  sizeof(*cache->entry));
+
+	memmove(&cache->entry[idx + 1], &cache->entry[idx],
+		(cache->size - idx) * sizeof(*cache->entry));
+	cache->size++;
+
+	return &cache->entry[idx];
+}
+
+static void
+remove_entries(struct mmap_cache_t *cache, unsigned int idx, unsigned int n)
+{
+	if (!n)
+		return;
+
+	for (unsigned int i = idx; i < idx + n; i++)
+		free(cache->entry[i].binary_filename);
+
+	memmove(&cache->entry[idx], &cache->entry[idx + n],
+		(cache->size - idx - n) * sizeof(*cache->entry));
+	cache->size -= n;
+}
+
+/* Splits the entry at idx into [start_addr, addr) and [addr, end_addr). */
+static void
+split_entry(struct mmap_cache_t *cache, unsigned int idx, unsigned long addr)
+{
+	struct mmap_cache_entry_t *upper = insert_entry(cache, idx + 1);
+	struct mmap_cache_entry_t *lower = &cache->entry[idx];
+
+	*upper = *lower;
+	upper->start_addr = addr;
+	upper->mmap_offset += addr - lower->start_addr;
+	upper->binary_filename = xstrdup(lower->binary_filename);
+	lower->end_addr = addr;
+}
+
+/*
+ * Splits entries on the boundaries of [start, end), the entries
+ * inside the range are [*first, *last).
+ */
+static void
+isolate_range(struct mmap_cache_t *cache, unsigned long start,
+	      unsigned long end, unsigned int *first, unsigned int *last)
+{
+	unsigned int i = lower_bound(cache, start);
+
+	if (i < cache->size && cache->entry[i].start_addr < start) {
+		split_entry(cache, i, start);
+		i++;
+	}
+
+	unsigned int j = i;
+	for (; j < cache->size && cache->entry[j].start_addr < end; j++) {
+		if (cache->entry[j].end_addr > end)
+			split_entry(cache, j, end);
+	}
+
+	*first = i;
+	*last = j;
+}
+
+static bool
+can_merge_entries(const struct mmap_cache_entry_t *a,
+		  const struct mmap_cache_entry_t *b)
+{
+	return a->end_addr == b->start_addr &&
+		a->mmap_offset + (a->end_addr - a->start_addr) ==
+			b->mmap_offset &&
+		a->protections == b->protections &&
+		a->major == b->major &&
+		a->minor == b->minor &&
+		strcmp(a->binary_filename, b->binary_filename) == 0;
+}
+
+/* Merges adjacent entries around [first, last) the way the kernel does. */
+static void
+merge_entries(struct mmap_cache_t *cache, unsigned int first,
+	      unsigned int last)
+{
+	unsigned int i = first ? first - 1 : 0;
+
+	while (i <= last && i + 1 < cache->size) {
+		if (can_merge_entries(&cache->entry[i], &cache->entry[i + 1])) {
+			cache->entry[i].end_addr = cache->entry[i + 1].end_addr;
+			remove_entries(cache, i + 1, 1);
+			if (last > i)
+				--last;
+		} else {
+			i++;
+		}
+	}
+}
 
 static void
-mmap_cache_invalidate(struct tcb *tcp, void *unused)
+unmap_range(struct mmap_cache_t *cache, unsigned long start, unsigned long end)
 {
-	mmap_cache_generation++;
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0);
+	unsigned int first, last;
+
+	if (start >= end)
+		return;
+
+	isolate_range(cache, start, end, &first, &last);
+	remove_entries(cache, first, last - first);
+}
+
+static unsigned char
+prot_to_protections(unsigned int prot)
+{
+	return ((prot & PROT_READ) ? MMAP_CACHE_PROT_READABLE : 0)
+		| ((prot & PROT_WRITE) ? MMAP_CACHE_PROT_WRITABLE : 0)
+		| ((prot & PROT_EXEC) ? MMAP_CACHE_PROT_EXECUTABLE : 0);
+}
+
+static void
+insert_mapping(struct mmap_cache_t *cache, struct mmap_cache_entry_t *tmpl)
+{
+	unsigned int idx = lower_bound(cache, tmpl->start_addr);
+
+	*insert_entry(cache, idx) = *tmpl;
+	merge_entries(cache, idx, idx + 1);
+}
+
+static bool
+update_on_map(struct tcb *tcp, struct mmap_cache_t *cache,
+	      const struct mmap_notify_event *ev)
+{
+	unmap_range(cache, ev->addr, ev->addr + ev->len);
+
+	/*
+	 * Private anonymous mappings have no name, so they are not cached.
+	 * Shared ones show up as "/dev/zero (deleted)".
+	 */
+	if (ev->fd < 0)
+		return !(ev->flags & MAP_SHARED);
+
+	char path[PATH_MAX + 1];
+	if (getfdpath(tcp, ev->fd, path, sizeof(path)) < 0)
+		return false;
+
+	char fdpath[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int) * 3];
+	strace_stat_t st;
+	xsprintf(fdpath, "/proc/%u/fd/%u", get_proc_pid(tcp->pid), ev->fd);
+	if (stat_file(fdpath, &st))
+		return false;
+
+	struct mmap_cache_entry_t entry = {
+		.start_addr = ev->addr,
+		.end_addr = ev->addr + ev->len,
+		.mmap_offset = ev->offset,
+		.protections = prot_to_protections(ev->prot)
+			| ((ev->flags & MAP_SHARED)
+			   ? MMAP_CACHE_PROT_SHARED : 0),
+		.major = major(st.st_dev),
+		.minor = minor(st.st_dev),
+		.binary_filename = xstrdup(path),
+	};
+	insert_mapping(cache, &entry);
+
+	return true;
+}
+
+static bool
+update_on_protect(struct mmap_cache_t *cache,
+		  const struct mmap_notify_event *ev)
+{
+	unsigned int first, last;
+
+	/* These extend the range to the whole stack mapping. */
+	if (ev->prot & (PROT_GROWSDOWN | PROT_GROWSUP))
+		return false;
+
+	isolate_range(cache, ev->addr, ev->addr + ev->len, &first, &last);
+
+	for (unsigned int i = first; i < last; i++) {
+		struct mmap_cache_entry_t *entry = &cache->entry[i];
+
+		entry->protections = prot_to_protections(ev->prot)
+			| (entry->protections & MMAP_CACHE_PROT_SHARED);
+	}
+
+	merge_entries(cache, first, last);
+
+	return true;
+}
+
+static bool
+update_on_remap(struct mmap_cache_t *cache,
+		const struct mmap_notify_event *ev)
+{
+	const unsigned long old_end = ev->old_addr + ev->old_len;
+	unsigned int idx = lower_bound(cache, ev->old_addr);
+
+	/* The old range is not cached, so it was anonymous. */
+	if (idx >= cache->size || cache->entry[idx].start_addr >= old_end) {
+		unmap_range(cache, ev->addr, ev->addr + ev->len);
+		return true;
+	}
+
+	struct mmap_cache_entry_t entry = cache->entry[idx];
+
+	/* The old range spans several mappings. */
+	if (entry.start_addr > ev->old_addr || entry.end_addr < old_end)
+		return false;
+
+	entry.mmap_offset += ev->old_addr - entry.start_addr;
+	entry.start_addr = ev->addr;
+	entry.end_addr = ev->addr + ev->len;
+	entry.binary_filename = xstrdup(entry.binary_filename);
+
+	unmap_range(cache, ev->old_addr, old_end);
+	unmap_range(cache, entry.start_addr, entry.end_addr);
+	insert_mapping(cache, &entry);
+
+	return true;
+}
+
+static bool
+update_on_brk(struct mmap_cache_t *cache, const struct mmap_notify_event *ev)
+{
+	unsigned int idx = cache->size;
+
+	while (idx > 0) {
+		if (!strcmp(cache->entry[--idx].binary_filename, "[heap]"))
+			break;
+	}
+
+	/* The heap mapping has not been created yet. */
+	if (idx >= cache->size ||
+	    strcmp(cache->entry[idx].binary_filename, "[heap]"))
+		return false;
+
+	struct mmap_cache_entry_t *heap = &cache->entry[idx];
+
+	if (ev->addr <= heap->start_addr) {
+		remove_entries(cache, idx, 1);
+	} else if (ev->addr > heap->end_addr) {
+		unmap_range(cache, heap->end_addr, ev->addr);
+		cache->entry[idx].end_addr = ev->addr;
+	} else {
+		heap->end_addr = ev->addr;
+	}
+
+	return true;
+}
+
+/*
+ * Apply the memory mapping change to the cache of the process,
+ * invalidating it if the change cannot be modelled.
+ *
+ * Note that processes sharing memory without being threads of the same
+ * process (CLONE_VM without CLONE_THREAD) have separate caches.
+ */
+static void
+mmap_cache_update(struct tcb *tcp, const struct mmap_notify_event *ev,
+		  void *unused)
+{
+	struct mmap_cache_t *cache = tcp->mmap_cache;
+
+	if (!cache)
+		cache = (struct mmap_cache_t *) (uintptr_t)
+			trie_get(mmap_caches, get_tcb_tgid(tcp));
+	if (!cache || !cache->valid)
+		return;
+
+	bool updated = false;
+
+	switch (ev->op) {
+	case MMAP_NOTIFY_MAP:
+		updated = update_on_map(tcp, cache, ev);
+		break;
+	case MMAP_NOTIFY_UNMAP:
+		unmap_range(cache, ev->addr, ev->addr + ev->len);
+		updated = true;
+		break;
+	case MMAP_NOTIFY_PROTECT:
+		updated = update_on_protect(cache, ev);
+		break;
+	case MMAP_NOTIFY_REMAP:
+		updated = update_on_remap(cache, ev);
+		break;
+	case MMAP_NOTIFY_BRK:
+		updated = update_on_brk(cache, ev);
+		break;
+	default:
+		break;
+	}
+
+	if (!updated) {
+		cache->valid = false;
+		clear_mmap_cache_entries(cache);
+	}
+	cache->generation++;
+
+	debug_func_msg("op=%d, gen=%u, valid=%d, size=%u, tcp=%p, cache=%p",
+		       ev->op, cache->generation, cache->valid, cache->size,
+		       tcp, cache->entry);
 }
 
 void
@@ -31,51 +366,95 @@ mmap_cache_enable(void)
 	static bool use_mmap_cache;
 
 	if (!use_mmap_cache) {
-		mmap_notify_register_client(mmap_cache_invalidate, NULL);
+		mmap_caches = trie_create(sizeof(int) * 8,
+					  sizeof(void *) == 8 ? 6 : 5,
+					  4, 4, 0);
+		if (!mmap_caches)
+			error_msg_and_die("creating trie failed");
+		mmap_notify_register_client(mmap_cache_update, NULL);
 		use_mmap_cache = true;
 	}
 }
 
-/* deleting the cache */
+/* detaching the tcb from the cache, deleting it along with the last user */
 static void
 delete_mmap_cache(struct tcb *tcp, const char *caller)
 {
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache ? tcp->mmap_cache->generation : 0,
-		       mmap_cache_generation, tcp,
-		       tcp->mmap_cache ? tcp->mmap_cache->entry : 0, caller);
+	struct mmap_cache_t *cache = tcp->mmap_cache;
 
-	if (!tcp->mmap_cache)
+	debug_func_msg("gen=%u, tcp=%p, cache=%p, refs=%u, caller=%s",
+		       cache ? cache->generation : 0, tcp,
+		       cache ? cache->entry : 0,
+		       cache ? cache->refcount : 0, caller);
+
+	if (!cache)
+		return;
+
+	tcp->mmap_cache = NULL;
+	if (--cache->refcount)
 		return;
 
-	while (tcp->mmap_cache->size) {
-		unsigned int i = --tcp->mmap_cache->size;
-		free(tcp->mmap_cache->entry[i].binary_filename);
-		tcp->mmap_cache->entry[i].binary_filename = NULL;
+	trie_set(mmap_caches, cache->tgid, 0);
+	clear_mmap_cache_entries(cache);
+	free(cache);
+}
+
+/*
+ * Attach the tcb to the cache of its thread group, creating an empty one
+ * if this is the first thread of the process asking for it.
+ */
+static struct mmap_cache_t *
+get_mmap_cache(struct tcb *tcp)
+{
+	if (tcp->mmap_cache)
+		return tcp->mmap_cache;
+
+	const int tgid = get_tcb_tgid(tcp);
+	struct mmap_cache_t *cache = (struct mmap_cache_t *) (uintptr_t)
+		trie_get(mmap_caches, tgid);
+
+	if (!cache) {
+		cache = xzalloc(sizeof(*cache));
+		cache->free_fn = delete_mmap_cache;
+		cache->tgid = tgid;
+		trie_set(mmap_caches, tgid, (uint64_t) (uintptr_t) cache);
 	}
 
-	free(tcp->mmap_cache->entry);
-	tcp->mmap_cache->entry = NULL;
+	cache->refcount++;
+	tcp->mmap_cache = cache;
+	tcp->mmap_cache_generation = cache->generation - 1;
 
-	free(tcp->mmap_cache);
-	tcp->mmap_cache = NULL;
+	return cache;
 }
 
 /*
  * caching of /proc/ID/maps for each process to speed up stack tracing
  *
- * The cache must be refreshed after syscalls that affect memory mappings,
- * e.g. mmap, mprotect, munmap, execve.
+ * The cache is updated in place after syscalls that affect memory mappings,
+ * e.g. mmap, mprotect, munmap; it is reparsed only after changes that
+ * cannot be modelled, e.g. execve.
+ *
+ * The cache is shared by all threads of the process; a tcb that has not
+ * seen the current contents of the shared cache yet gets
+ * MMAP_CACHE_REBUILD_RENEWED even if another thread has already
+ * updated the cache.
  */
 extern enum mmap_cache_rebuild_result
 mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 {
-	if (tcp->mmap_cache
-	    && tcp->mmap_cache->generation != mmap_cache_generation)
-		delete_mmap_cache(tcp, caller);
+	struct mmap_cache_t *const cache = get_mmap_cache(tcp);
 
-	if (tcp->mmap_cache)
-		return MMAP_CACHE_REBUILD_READY;
+	if (cache->valid) {
+		if (tcp->mmap_cache_generation == cache->generation)
+			return MMAP_CACHE_REBUILD_READY;
+
+		tcp->mmap_cache_generation = cache->generation;
+		return MMAP_CACHE_REBUILD_RENEWED;
+	}
+
+	debug_func_msg("gen=%u, tcp=%p, cache=%p, caller=%s",
+		       cache->generation, tcp, cache->entry, caller);
+	clear_mmap_cache_entries(cache);
 
 	char filename[sizeof("/proc/4294967296/maps")];
 	xsprintf(filename, "/proc/%u/maps", get_proc_pid(tcp->pid));
@@ -86,13 +465,6 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		return MMAP_CACHE_REBUILD_NOCACHE;
 	}
 
-	struct mmap_cache_t cache = {
-		.free_fn = delete_mmap_cache,
-		.generation = mmap_cache_generation
-	};
-
-	/* start with a small dynamically-allocated array and then expand it */
-	size_t allocated = 0;
 	char buffer[PATH_MAX + 80];
 
 	while (fgets(buffer, sizeof(buffer), fp) != NULL) {
@@ -132,8 +504,8 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		 * sanity check to make sure that we're storing
 		 * non-overlapping regions in ascending order
 		 */
-		if (cache.size > 0) {
-			entry = &cache.entry[cache.size - 1];
+		if (cache->size > 0) {
+			entry = &cache->entry[cache->size - 1];
 			if (entry->start_addr == start_addr &&
 			    entry->end_addr == end_addr) {
 				/* duplicate entry, e.g. [vsyscall] */
@@ -151,11 +523,16 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 			}
 		}
 
-		if (cache.size >= allocated)
-			cache.entry = xgrowarray(cache.entry, &allocated,
-						 sizeof(*cache.entry));
+		/*
+		 * start with a small dynamically-allocated array
+		 * and then expand it
+		 */
+		if (cache->size >= cache->allocated)
+			cache->entry = xgrowarray(cache->entry,
+						  &cache->allocated,
+						  sizeof(*cache->entry));
 
-		entry = &cache.entry[cache.size];
+		entry = &cache->entry[cache->size];
 		entry->start_addr = start_addr;
 		entry->end_addr = end_addr;
 		entry->mmap_offset = mmap_offset;
@@ -169,18 +546,19 @@ mmap_cache_rebuild_if_invalid(struct tcb *tcp, const char *caller)
 		entry->major = major;
 		entry->minor = minor;
 		entry->binary_filename = xstrdup(binary_path);
-		cache.size++;
+		cache->size++;
 	}
 	fclose(fp);
 
-	if (!cache.size)
+	if (!cache->size)
 		return MMAP_CACHE_REBUILD_NOCACHE;
 
-	tcp->mmap_cache = xobjdup(&cache);
+	cache->valid = true;
+	cache->generation++;
+	tcp->mmap_cache_generation = cache->generation;
 
-	debug_func_msg("tgen=%u, ggen=%u, tcp=%p, cache=%p, caller=%s",
-		       tcp->mmap_cache->generation, mmap_cache_generation,
-		       tcp, tcp->mmap_cache->entry, caller);
+	debug_func_msg("gen=%u, tcp=%p, cache=%p, caller=%s",
+		       cache->generation, tcp, cache->entry, caller);
 
 	return MMAP_CACHE_REBUILD_RENEWED;
 }
@@ -10,6 +10,10 @@
 /*
  * Keep a sorted array of cache entries,
  * so that we can binary search through it.
+ *
+ * The cache is shared by all threads of a process,
+ * refcount is the number of tcbs referring to it.
+ * generation is incremented on every change of the cache contents.
  */
 
 struct mmap_cache_t {
@@ -17,6 +21,10 @@ struct mmap_cache_t {
 	void (*free_fn)(struct tcb *, const char *caller);
 	unsigned int size;
 	unsigned int generation;
+	unsigned int refcount;
+	int tgid;
+	size_t allocated;
+	bool valid;
 };
 
 struct mmap_cache_entry_t {
@@ -5,6 +5,10 @@
  */
 
 #include "mmap_notify.h"
+#include <linux/mman.h>
+#include <sys/mman.h>
+
+#include "sen.h"
 
 struct mmap_notify_client {
 	mmap_notify_fn fn;
@@ -24,11 +28,101 @@ mmap_notify_register_client(mmap_notify_fn fn, void *data)
 	clients = client;
 }
 
+bool
+mmap_notify_syscall_affects(const struct_sysent *s)
+{
+	return clients && (s->sys_flags & MEMORY_MAPPING_CHANGE);
+}
+
+static kernel_ulong_t
+page_align(const kernel_ulong_t len)
+{
+	const kernel_ulong_t mask = get_pagesize() - 1;
+
+	return (len + mask) & ~mask;
+}
+
+static void
+fill_mmap_event(struct tcb *tcp, struct mmap_notify_event *ev,
+		const unsigned long long offset)
+{
+	ev->op = MMAP_NOTIFY_MAP;
+	ev->addr = truncate_kulong_to_current_wordsize(tcp->u_rval);
+	ev->len = page_align(tcp->u_arg[1]);
+	ev->prot = tcp->u_arg[2];
+	ev->flags = tcp->u_arg[3];
+	ev->fd = (ev->flags & MAP_ANONYMOUS) ? -1 : (int) tcp->u_arg[4];
+	ev->offset = offset;
+}
+
+static void
+fill_event(struct tcb *tcp, struct mmap_notify_event *ev)
+{
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_mmap:
+		fill_mmap_event(tcp, ev, tcp->u_arg[5]);
+		break;
+	case SEN_mmap_pgoff:
+		fill_mmap_event(tcp, ev,
+				(unsigned long long) tcp->u_arg[5]
+				* get_pagesize());
+		break;
+	case SEN_mmap_4koff:
+		fill_mmap_event(tcp, ev,
+				(unsigned long long) tcp->u_arg[5] << 12);
+		break;
+	case SEN_munmap:
+		ev->op = MMAP_NOTIFY_UNMAP;
+		ev->addr = tcp->u_arg[0];
+		ev->len = page_align(tcp->u_arg[1]);
+		break;
+	case SEN_mprotect:
+	case SEN_pkey_mprotect:
+		ev->op = MMAP_NOTIFY_PROTECT;
+		ev->addr = tcp->u_arg[0];
+		ev->len = page_align(tcp->u_arg[1]);
+		ev->prot = tcp->u_arg[2];
+		break;
+	case SEN_mremap:
+		/* old_len == 0 creates a new mapping of the same pages. */
+		if (!tcp->u_arg[1])
+			break;
+		ev->op = MMAP_NOTIFY_REMAP;
+		ev->old_addr = tcp->u_arg[0];
+		ev->old_len = page_align(tcp->u_arg[1]);
+		ev->addr = truncate_kulong_to_current_wordsize(tcp->u_rval);
+		ev->len = page_align(tcp->u_arg[2]);
+		ev->flags = tcp->u_arg[3];
+		break;
+	case SEN_brk:
+		/* brk(NULL) just queries the current program break. */
+		ev->op = tcp->u_arg[0] ? MMAP_NOTIFY_BRK : MMAP_NOTIFY_NONE;
+		ev->addr = page_align(
+			truncate_kulong_to_current_wordsize(tcp->u_rval));
+		break;
+	}
+}
+
 void
-mmap_notify_report(struct tcb *tcp)
+mmap_notify_report(struct tcb *tcp, const bool has_result)
 {
-	struct mmap_notify_client *client;
+	struct mmap_notify_event ev = { .op = MMAP_NOTIFY_UNKNOWN };
+
+	if (!clients)
+		return;
+
+	/* A tampered syscall may have been replaced with another one. */
+	if (has_result && !syscall_tampered(tcp)) {
+		if (syserror(tcp))
+			ev.op = MMAP_NOTIFY_NONE;
+		else
+			fill_event(tcp, &ev);
+	}
+
+	if (ev.op == MMAP_NOTIFY_NONE)
+		return;
 
-	for (client = clients; client; client = client->next)
-		client->fn(tcp, client->data);
+	for (struct mmap_notify_client *client = clients; client;
+	     client = client->next)
+		client->fn(tcp, &ev, client->data);
 }
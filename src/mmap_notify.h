@@ -9,12 +9,55 @@
 
 # include "defs.h"
 
-typedef void (*mmap_notify_fn)(struct tcb *, void *);
+enum mmap_notify_op {
+	/* No change of memory mappings, e.g. the syscall has failed. */
+	MMAP_NOTIFY_NONE,
+	/* The change cannot be described, e.g. execve. */
+	MMAP_NOTIFY_UNKNOWN,
+	/* [addr, addr + len) is mapped, fd is -1 for anonymous mappings. */
+	MMAP_NOTIFY_MAP,
+	/* [addr, addr + len) is unmapped. */
+	MMAP_NOTIFY_UNMAP,
+	/* Protection of [addr, addr + len) is changed to prot. */
+	MMAP_NOTIFY_PROTECT,
+	/* [old_addr, old_addr + old_len) is moved to [addr, addr + len). */
+	MMAP_NOTIFY_REMAP,
+	/* The program break is moved to addr. */
+	MMAP_NOTIFY_BRK,
+};
+
+/*
+ * Memory mapping change made by a syscall,
+ * addresses and lengths are page aligned.
+ */
+struct mmap_notify_event {
+	enum mmap_notify_op op;
+	int fd;
+	unsigned int prot;
+	unsigned int flags;
+	kernel_ulong_t addr;
+	kernel_ulong_t len;
+	kernel_ulong_t old_addr;
+	kernel_ulong_t old_len;
+	unsigned long long offset;
+};
+
+typedef void (*mmap_notify_fn)(struct tcb *, const struct mmap_notify_event *,
+			       void *);
 
 extern void
 mmap_notify_register_client(mmap_notify_fn, void *);
 
+/* Returns true if there are clients and the syscall may change mappings. */
+extern bool
+mmap_notify_syscall_affects(const struct_sysent *);
+
+/*
+ * Notify clients about the memory mapping change made by the syscall
+ * that is exiting, has_result specifies whether tcp->u_rval and
+ * tcp->u_error have been fetched.
+ */
 extern void
-mmap_notify_report (struct tcb *);
+mmap_notify_report(struct tcb *, bool has_result);
 
 #endif /* !STRACE_MMAP_NOTIFY_H */
@@ -609,9 +609,18 @@ decode_payload(struct tcb *const tcp,
 	if ((nlmsghdr->nlmsg_type >= NLMSG_MIN_TYPE
 	    || nlmsghdr->nlmsg_type == NLMSG_DONE)
 	    && (unsigned int) family < ARRAY_SIZE(netlink_decoders)
-	    && netlink_decoders[family]
-	    && netlink_decoders[family](tcp, nlmsghdr, addr, len)) {
-		return;
+	    && netlink_decoders[family]) {
+		if (decoder_stats_enabled)
+			decoder_stats_push("netlink",
+					   xlookup(netlink_protocols, family),
+					   true);
+		const bool decoded =
+			netlink_decoders[family](tcp, nlmsghdr, addr, len);
+		if (decoder_stats_enabled)
+			decoder_stats_pop();
+
+		if (decoded)
+			return;
 	}
 
 	if (nlmsghdr->nlmsg_type == NLMSG_DONE && len == sizeof(int)) {
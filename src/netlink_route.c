@@ -115,7 +115,14 @@ decode_netlink_route(struct tcb *const tcp,
 
 		if (index < ARRAY_SIZE(route_decoders)
 		    && route_decoders[index]) {
+			if (decoder_stats_enabled)
+				decoder_stats_push("netlink",
+						   xlookup(nl_route_types,
+							   nlmsghdr->nlmsg_type),
+						   true);
 			route_decoders[index](tcp, nlmsghdr, family, addr, len);
+			if (decoder_stats_enabled)
+				decoder_stats_pop();
 		} else {
 			decode_family(tcp, family, addr, len);
 		}
@@ -0,0 +1,148 @@
+/*
+ * Pool of descriptors of the per-process output files written with -ff:
+ * at most max_output_files of them are kept open, the least recently
+ * written ones are closed, and reopened for appending when needed.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#ifdef HAVE_FOPENCOOKIE
+
+# include <fcntl.h>
+# include <limits.h>
+# include <sys/resource.h>
+
+# include "list.h"
+
+/*
+ * The cookie of a stream, freed by output_file_close when the stream
+ * is closed, so the stdio buffer is not kept here: it is freed by fclose
+ * after the cookie.
+ */
+struct output_file {
+	/* In open_files if fd is open. */
+	struct list_item lru;
+	char *path;
+	int fd;
+};
+
+/* Files with open descriptors, the most recently written one first. */
+static EMPTY_LIST(open_files);
+static unsigned int open_count;
+
+static void
+output_file_close_fd(struct output_file *of)
+{
+	if (close(of->fd))
+		perror_msg("close: %s", of->path);
+	of->fd = -1;
+	list_remove(&of->lru);
+	--open_count;
+}
+
+static bool
+output_file_open_fd(struct output_file *of, int flags)
+{
+	if (open_count >= max_output_files) {
+		output_file_close_fd(list_tail(&open_files,
+					       struct output_file, lru));
+	}
+
+	of->fd = open_output_file(of->path, flags);
+	if (of->fd < 0)
+		return false;
+
+	list_insert(&open_files, &of->lru);
+	++open_count;
+	return true;
+}
+
+static ssize_t
+output_file_write(void *cookie, const char *buf, size_t size)
+{
+	struct output_file *of = cookie;
+
+	if (of->fd < 0) {
+		if (!output_file_open_fd(of, O_WRONLY | O_APPEND))
+			return -1;
+	} else if (list_head(&open_files, struct output_file, lru) != of) {
+		list_remove(&of->lru);
+		list_insert(&open_files, &of->lru);
+	}
+
+	size_t written = 0;
+
+	while (written < size) {
+		const ssize_t rc = write(of->fd, buf + written, size - written);
+
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return written ? (ssize_t) written : -1;
+		}
+		written += rc;
+	}
+
+	return written;
+}
+
+static int
+output_file_close(void *cookie)
+{
+	struct output_file *of = cookie;
+	int rc = 0;
+
+	if (of->fd >= 0) {
+		rc = close(of->fd);
+		list_remove(&of->lru);
+		--open_count;
+	}
+
+	free(of->path);
+	free(of);
+	return rc;
+}
+
+void
+output_pool_init(void)
+{
+	if (max_output_files)
+		return;
+
+	/* Leave half of the descriptors for everything else. */
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) || rlim.rlim_cur == RLIM_INFINITY)
+		max_output_files = INT_MAX;
+	else
+		max_output_files = MAX(MIN(rlim.rlim_cur, (rlim_t) INT_MAX) / 2, 1);
+}
+
+FILE *
+output_pool_fopen(const char *path, bool append)
+{
+	struct output_file *of = xzalloc(sizeof(*of));
+
+	of->path = xstrdup(path);
+	if (!output_file_open_fd(of, O_WRONLY | O_CREAT |
+				     (append ? O_APPEND : O_TRUNC)))
+		perror_msg_and_die("Can't fopen '%s'", path);
+
+	static const cookie_io_functions_t funcs = {
+		.write = output_file_write,
+		.close = output_file_close,
+	};
+	FILE *fp = fopencookie(of, "w", funcs);
+
+	if (!fp)
+		perror_msg_and_die("fopencookie");
+
+	return fp;
+}
+
+#endif /* HAVE_FOPENCOOKIE */
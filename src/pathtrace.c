@@ -8,28 +8,354 @@
  */
 
 #include "defs.h"
+#include <fnmatch.h>
 #include <limits.h>
 #include <poll.h>
+#include <sys/stat.h>
 
+#include "fd_cache.h"
+#include "hash_index.h"
+#include "largefile_wrappers.h"
 #include "number_set.h"
 #include "sen.h"
 #include "xstring.h"
 
 struct path_set global_path_set;
 
+struct path_glob {
+	char *pattern;
+	/* FNM_LEADING_DIR for "PATTERN/" that selects a subtree. */
+	int flags;
+};
+
+/*
+ * A node of the trie of path components.
+ *
+ * -P DIR/ marks the node of DIR as a subtree, so every path passing
+ * through the node matches.  A glob pattern is stored in the node
+ * of its longest leading directory without wildcards, so that only
+ * the patterns on the way of the path are checked.
+ */
+struct path_trie_node {
+	char *name;
+	size_t name_len;
+	/* Sorted by name. */
+	struct path_trie_node *children;
+	size_t num_children;
+	size_t children_size;
+	struct path_glob *globs;
+	size_t num_globs;
+	size_t globs_size;
+	bool subtree;
+};
+
+static bool
+has_wildcards(const char *str, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (str[i] == '*' || str[i] == '?' || str[i] == '[')
+			return true;
+	}
+	return false;
+}
+
+static bool
+is_glob(const char *path)
+{
+	return has_wildcards(path, strlen(path));
+}
+
+/*
+ * "DIR/" selects DIR and everything under it;
+ * "/" is still an ordinary path, though.
+ */
+static bool
+is_subtree(const char *path)
+{
+	const size_t len = strlen(path);
+
+	return len && path[len - 1] == '/' && path[strspn(path, "/")];
+}
+
+static int
+name_cmp(const struct path_trie_node *node, const char *name, size_t len)
+{
+	int rc = memcmp(node->name, name, MIN(node->name_len, len));
+
+	if (rc)
+		return rc;
+	return (node->name_len > len) - (node->name_len < len);
+}
+
+/*
+ * Returns the child of node with the given name, or NULL and the position
+ * to insert it at.
+ */
+static struct path_trie_node *
+find_child(const struct path_trie_node *node, const char *name, size_t len,
+	   size_t *pos)
+{
+	size_t lower = 0;
+	size_t upper = node->num_children;
+
+	while (lower < upper) {
+		const size_t mid = lower + (upper - lower) / 2;
+		const int rc = name_cmp(&node->children[mid], name, len);
+
+		if (!rc)
+			return &node->children[mid];
+		if (rc < 0)
+			lower = mid + 1;
+		else
+			upper = mid;
+	}
+
+	if (pos)
+		*pos = lower;
+	return NULL;
+}
+
+static struct path_trie_node *
+get_child(struct path_trie_node *node, const char *name, size_t len)
+{
+	size_t pos;
+	struct path_trie_node *child = find_child(node, name, len, &pos);
+
+	if (child)
+		return child;
+
+	if (node->num_children >= node->children_size)
+		node->children = xgrowarray(node->children,
+					    &node->children_size,
+					    sizeof(*node->children));
+	memmove(&node->children[pos + 1], &node->children[pos],
+		(node->num_children - pos) * sizeof(*node->children));
+	node->num_children++;
+
+	child = &node->children[pos];
+	*child = (struct path_trie_node) {
+		.name = xstrndup(name, len),
+		.name_len = len,
+	};
+	return child;
+}
+
+static void
+trie_store(const char *path, const bool glob, struct path_set *set)
+{
+	size_t path_len = strlen(path);
+
+	if (!set->trie)
+		set->trie = xzalloc(sizeof(*set->trie));
+
+	/* Strip the trailing slashes of "DIR/" and "PATTERN/". */
+	const bool subtree = is_subtree(path);
+	if (subtree) {
+		while (path[path_len - 1] == '/')
+			--path_len;
+	}
+
+	struct path_trie_node *node = set->trie;
+	const char *name = path;
+	for (;;) {
+		const char *slash = memchr(name, '/', path + path_len - name);
+		const size_t len = slash ? (size_t) (slash - name)
+					 : (size_t) (path + path_len - name);
+
+		if (glob && has_wildcards(name, len)) {
+			if (node->num_globs >= node->globs_size)
+				node->globs = xgrowarray(node->globs,
+							 &node->globs_size,
+							 sizeof(*node->globs));
+			node->globs[node->num_globs++] = (struct path_glob) {
+				.pattern = xstrndup(path, path_len),
+				.flags = subtree ? FNM_LEADING_DIR : 0,
+			};
+			return;
+		}
+
+		node = get_child(node, name, len);
+		if (!slash)
+			break;
+		name = slash + 1;
+	}
+
+	node->subtree = true;
+}
+
+static bool
+trie_match(const struct path_trie_node *node, const char *path)
+{
+	const char *name = path;
+
+	for (;;) {
+		for (size_t i = 0; i < node->num_globs; ++i) {
+			if (!fnmatch(node->globs[i].pattern, path,
+				     FNM_PATHNAME | node->globs[i].flags))
+				return true;
+		}
+
+		const char *slash = strchr(name, '/');
+		const size_t len = slash ? (size_t) (slash - name)
+					 : strlen(name);
+
+		node = find_child(node, name, len, NULL);
+		if (!node)
+			return false;
+		if (node->subtree)
+			return true;
+		if (!slash)
+			return false;
+		name = slash + 1;
+	}
+}
+
+struct path_key {
+	const struct path_set *set;
+	const char *path;
+};
+
+static bool
+path_match(size_t idx, const void *data)
+{
+	const struct path_key *key = data;
+
+	return !strcmp(key->set->paths_selected[idx], key->path);
+}
+
 /*
  * Return true if specified path matches one that we're tracing.
  */
 static bool
 pathmatch(const char *path, struct path_set *set)
 {
-	unsigned i;
+	if (!set->num_selected)
+		return false;
 
-	for (i = 0; i < set->num_selected; ++i) {
-		if (strcmp(path, set->paths_selected[i]) == 0)
-			return true;
+	const struct path_key key = { set, path };
+
+	return hash_index_find(set->index, hash_str(HASH_STR_INIT, path),
+			       &key, path_match) != HASH_INDEX_NONE ||
+		(set->trie && trie_match(set->trie, path));
+}
+
+struct path_file_id {
+	unsigned long long dev;
+	unsigned long long ino;
+};
+
+struct file_id_key {
+	const struct path_set *set;
+	struct path_file_id id;
+};
+
+static uint64_t
+file_id_hash(unsigned long long dev, unsigned long long ino)
+{
+	return ((uint64_t) dev * 0x9e3779b97f4a7c15ULL ^ ino) *
+		0x9e3779b97f4a7c15ULL;
+}
+
+static bool
+file_id_eq(size_t idx, const void *data)
+{
+	const struct file_id_key *key = data;
+	const struct path_file_id *id = &key->set->file_ids[idx];
+
+	return id->dev == key->id.dev && id->ino == key->id.ino;
+}
+
+static void
+file_id_store(struct path_set *set, unsigned long long dev,
+	      unsigned long long ino)
+{
+	if (!set->file_id_index)
+		set->file_id_index = xzalloc(sizeof(*set->file_id_index));
+
+	const struct file_id_key key = { set, { dev, ino } };
+	if (hash_index_get(set->file_id_index, file_id_hash(dev, ino), &key,
+			   file_id_eq, set->num_file_ids) < set->num_file_ids)
+		return;
+
+	if (set->num_file_ids >= set->file_ids_size)
+		set->file_ids = xgrowarray(set->file_ids, &set->file_ids_size,
+					   sizeof(*set->file_ids));
+	set->file_ids[set->num_file_ids++] = key.id;
+}
+
+static bool
+file_id_match(const struct path_set *set, unsigned long long dev,
+	      unsigned long long ino)
+{
+	if (!set->num_file_ids)
+		return false;
+
+	const struct file_id_key key = { set, { dev, ino } };
+
+	return hash_index_find(set->file_id_index, file_id_hash(dev, ino),
+			       &key, file_id_eq) != HASH_INDEX_NONE;
+}
+
+/*
+ * Return true if the absolute path as seen by the tracee refers
+ * to a file we're tracing.
+ */
+static bool
+path_file_id_match(struct tcb *tcp, const char *path, struct path_set *set)
+{
+	char root_path[sizeof("/proc/%u/root") + sizeof(int) * 3 + PATH_MAX];
+	strace_stat_t st;
+
+	if (path[0] != '/')
+		return false;
+
+	int proc_pid = get_proc_pid(tcp->pid);
+	if (!proc_pid)
+		return false;
+
+	xsprintf(root_path, "/proc/%u/root%s", proc_pid, path);
+	return !stat_file(root_path, &st) &&
+		file_id_match(set, st.st_dev, st.st_ino);
+}
+
+/*
+ * Get device and inode numbers of the file fd of a tracee refers to,
+ * using the fd cache if possible.
+ */
+static bool
+getfdfileid(struct tcb *tcp, int fd, unsigned long long *dev,
+	    unsigned long long *ino)
+{
+	struct fd_cache_entry *entry = fd_cache_get(tcp, fd);
+
+	if (entry && entry->file_id_cached) {
+		*dev = entry->dev;
+		*ino = entry->ino;
+		return true;
 	}
-	return false;
+
+	if (fd < 0)
+		return false;
+
+	int proc_pid = get_proc_pid(tcp->pid);
+	if (!proc_pid)
+		return false;
+
+	char linkpath[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int)*3];
+	strace_stat_t st;
+
+	xsprintf(linkpath, "/proc/%u/fd/%u", proc_pid, fd);
+	if (stat_file(linkpath, &st))
+		return false;
+
+	*dev = st.st_dev;
+	*ino = st.st_ino;
+	if (entry) {
+		entry->dev = *dev;
+		entry->ino = *ino;
+		entry->file_id_cached = true;
+	}
+	return true;
 }
 
 /*
@@ -42,7 +368,8 @@ upathmatch(struct tcb *const tcp, const kernel_ulong_t upath,
 	char path[PATH_MAX + 1];
 
 	return umovestr(tcp, upath, sizeof(path), path) > 0 &&
-		pathmatch(path, set);
+		(pathmatch(path, set) ||
+		 (set->num_file_ids && path_file_id_match(tcp, path, set)));
 }
 
 /*
@@ -51,6 +378,17 @@ upathmatch(struct tcb *const tcp, const kernel_ulong_t upath,
 static bool
 fdmatch(struct tcb *tcp, int fd, struct path_set *set)
 {
+	if (set->num_file_ids) {
+		unsigned long long dev, ino;
+
+		if (getfdfileid(tcp, fd, &dev, &ino) &&
+		    file_id_match(set, dev, ino))
+			return true;
+		/* Only patterns and missing files need the path. */
+		if (!set->trie && !set->unresolved)
+			return false;
+	}
+
 	char path[PATH_MAX + 1];
 	int n = getfdpath(tcp, fd, path, sizeof(path));
 
@@ -58,13 +396,18 @@ fdmatch(struct tcb *tcp, int fd, struct path_set *set)
 }
 
 /*
- * Add a path to the set we're tracing.
+ * Add a path to the set we're tracing, as a glob pattern if glob is true.
  * Specifying NULL will delete all paths.
  */
 static void
-storepath(const char *path, struct path_set *set)
+storepath(const char *path, const bool glob, struct path_set *set)
 {
-	if (pathmatch(path, set))
+	if (!set->index)
+		set->index = xzalloc(sizeof(*set->index));
+
+	const struct path_key key = { set, path };
+	if (hash_index_get(set->index, hash_str(HASH_STR_INIT, path), &key,
+			   path_match, set->num_selected) < set->num_selected)
 		return; /* already in table */
 
 	if (set->num_selected >= set->size)
@@ -73,6 +416,9 @@ storepath(const char *path, struct path_set *set)
 				   sizeof(set->paths_selected[0]));
 
 	set->paths_selected[set->num_selected++] = path;
+
+	if (glob || is_subtree(path))
+		trie_store(path, glob, set);
 }
 
 /*
@@ -102,6 +448,39 @@ getfdpath_pid(pid_t pid, int fd, char *buf, unsigned bufsize)
 	return n;
 }
 
+/*
+ * Get path associated with fd of a tracee, using the fd cache if possible.
+ */
+int
+getfdpath(struct tcb *tcp, int fd, char *buf, unsigned bufsize)
+{
+	struct fd_cache_entry *entry = fd_cache_get(tcp, fd);
+
+	if (!entry)
+		return getfdpath_pid(tcp->pid, fd, buf, bufsize);
+
+	char path[PATH_MAX + 1];
+	const char *str = entry->path;
+	unsigned int len = entry->path_len;
+
+	if (!str) {
+		int n = getfdpath_pid(tcp->pid, fd, path, sizeof(path));
+
+		if (n < 0)
+			return n;
+		/* Do not cache the result that might have been truncated. */
+		if ((unsigned int) n < sizeof(path) - 1)
+			fd_cache_set_path(entry, path, n);
+		str = path;
+		len = n;
+	}
+
+	len = MIN(len, bufsize - 1);
+	memcpy(buf, str, len);
+	buf[len] = '\0';
+	return len;
+}
+
 /*
  * Add a path to the set we're tracing.  Also add the canonicalized
  * version of the path.  Specifying NULL will delete all paths.
@@ -111,19 +490,49 @@ pathtrace_select_set(const char *path, struct path_set *set)
 {
 	char *rpath;
 
-	storepath(path, set);
+	storepath(path, is_glob(path), set);
+
+	/*
+	 * Glob patterns are matched as specified, unless there is a file
+	 * with this very name, which is selected as an ordinary path
+	 * in addition to the pattern, as it used to be.
+	 */
+	if (is_glob(path) && access(path, F_OK))
+		return;
+
+	if (trace_path_inode && !is_subtree(path)) {
+		strace_stat_t st;
+
+		if (stat_file(path, &st))
+			set->unresolved = true;
+		else
+			file_id_store(set, st.st_dev, st.st_ino);
+	}
 
 	rpath = realpath(path, NULL);
 
 	if (rpath == NULL)
 		return;
 
+	size_t len = strlen(path);
+	if (is_subtree(path)) {
+		while (path[len - 1] == '/')
+			--len;
+	}
+
 	/* if realpath and specified path are same, we're done */
-	if (strcmp(path, rpath) == 0) {
+	if (strlen(rpath) == len && strncmp(path, rpath, len) == 0) {
 		free(rpath);
 		return;
 	}
 
+	if (is_subtree(path) && strcmp(rpath, "/")) {
+		char *rdir = xasprintf("%s/", rpath);
+
+		free(rpath);
+		rpath = rdir;
+	}
+
 	if (!is_number_in_set(QUIET_PATH_RESOLVE, quiet_set)) {
 		char *path_quoted = xmalloc(strlen(path) * 4 + 4);
 		char *rpath_quoted = xmalloc(strlen(rpath) * 4 + 4);
@@ -139,7 +548,7 @@ pathtrace_select_set(const char *path, struct path_set *set)
 		free(path_quoted);
 		free(rpath_quoted);
 	}
-	storepath(rpath, set);
+	storepath(rpath, false, set);
 }
 
 static bool
@@ -0,0 +1,584 @@
+/*
+ * Capture of the data read and written by the syscalls selected
+ * with -e read and -e write options in raw form:
+ * --dump-dir=DIR appends the data of each descriptor to a file of its own
+ * accompanied by an index file, --pcap=FILE writes the data of TCP and UDP
+ * sockets to a pcap file as IP packets.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <linux/close_range.h>
+
+#include "number_set.h"
+#include "sen.h"
+#include "trie.h"
+#include "xstring.h"
+
+const char *dump_dir;
+const char *pcap_file;
+
+/* The amount of data fetched from the tracee at once. */
+#define CAPTURE_CHUNK_SIZE	32768
+
+/* pcap file format constants. */
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_VERSION_MAJOR	2
+#define PCAP_VERSION_MINOR	4
+#define PCAP_SNAPLEN		262144
+#define LINKTYPE_RAW		101
+
+#define IPV4_HDR_SIZE		20
+#define IPV6_HDR_SIZE		40
+#define TCP_HDR_SIZE		20
+#define UDP_HDR_SIZE		8
+/* The maximum payload of an IPv4 packet with TCP or UDP header. */
+#define IP_MAX_PAYLOAD		(0xffff - IPV4_HDR_SIZE - TCP_HDR_SIZE)
+
+/*
+ * The capture files of a descriptor.  The files are closed when
+ * the descriptor is closed or replaced, the data of the next file opened
+ * with the same descriptor number is written to new files.
+ */
+struct capture_fd {
+	FILE *data_fp;
+	FILE *index_fp;
+	/* The size of the data file. */
+	uint64_t offset;
+	/* The number of files closed so far. */
+	unsigned int closed;
+};
+
+/**
+ * Key:   tgid << 32 | fd
+ * Value: struct capture_fd
+ */
+static struct trie *capture_fds;
+
+/**
+ * Key:   socket inode
+ * Value: struct tcp_stream
+ */
+static struct trie *tcp_streams;
+
+/* Sequence numbers of the data sent and received via a TCP socket. */
+struct tcp_stream {
+	uint32_t seq[2];
+};
+
+static FILE *pcap_fp;
+
+/*
+ * Neither -e read nor -e write option is specified, the data that is not
+ * captured is not dumped either.
+ */
+static bool capture_only;
+
+/* The data transfer being captured. */
+static struct {
+	struct tcb *tcp;
+	int fd;
+	bool sent;
+	/*
+	 * The capture files and the socket addresses are looked up
+	 * when the data of the transfer is dumped for the first time.
+	 */
+	bool resolved;
+	bool capturing;
+	struct capture_fd *cfd;
+	const struct inet_sock_addrs *inet;
+	struct tcp_stream *stream;
+	uint64_t start_offset;
+	uint64_t len;
+	/* UDP datagram collected by chunks. */
+	uint8_t *dgram;
+	size_t dgram_len;
+} rec;
+
+static FILE *
+capture_fopen(const char *const path)
+{
+#ifdef HAVE_FOPENCOOKIE
+	return output_pool_fopen(path, false);
+#else
+	const int fd = open_output_file(path, O_WRONLY | O_CREAT | O_TRUNC);
+	FILE *fp = fd < 0 ? NULL : fdopen(fd, "w");
+
+	if (!fp)
+		perror_msg_and_die("Can't fopen '%s'", path);
+	return fp;
+#endif
+}
+
+static void
+xfwrite(const void *const buf, const size_t len, FILE *const fp,
+	const char *const name)
+{
+	if (len && fwrite(buf, len, 1, fp) != 1)
+		perror_msg_and_die("%s: write", name);
+}
+
+static void
+pcap_write(const void *const buf, const size_t len)
+{
+	xfwrite(buf, len, pcap_fp, pcap_file);
+}
+
+void
+payload_capture_init(void)
+{
+	/* Capture the data of all descriptors unless specified. */
+	if (!read_set && !write_set) {
+		qualify_read("all");
+		qualify_write("all");
+		capture_only = true;
+	}
+
+	if (dump_dir) {
+		if (mkdir(dump_dir, 0777) && errno != EEXIST)
+			perror_msg_and_die("mkdir: %s", dump_dir);
+#ifdef HAVE_FOPENCOOKIE
+		output_pool_init();
+#endif
+		capture_fds = trie_create(64, sizeof(void *) == 8 ? 6 : 5,
+					  8, 8, 0);
+		if (!capture_fds)
+			error_msg_and_die("creating trie failed");
+	}
+
+	if (pcap_file) {
+		const int fd = open_output_file(pcap_file,
+						O_WRONLY | O_CREAT | O_TRUNC);
+		if (fd < 0 || !(pcap_fp = fdopen(fd, "w")))
+			perror_msg_and_die("Can't fopen '%s'", pcap_file);
+
+		tcp_streams = trie_create(sizeof(unsigned long) * 8,
+					  sizeof(void *) == 8 ? 6 : 5,
+					  8, 8, 0);
+		if (!tcp_streams)
+			error_msg_and_die("creating trie failed");
+
+		const struct {
+			uint32_t magic;
+			uint16_t version_major;
+			uint16_t version_minor;
+			int32_t thiszone;
+			uint32_t sigfigs;
+			uint32_t snaplen;
+			uint32_t network;
+		} hdr = {
+			.magic = PCAP_MAGIC,
+			.version_major = PCAP_VERSION_MAJOR,
+			.version_minor = PCAP_VERSION_MINOR,
+			.snaplen = PCAP_SNAPLEN,
+			.network = LINKTYPE_RAW,
+		};
+		pcap_write(&hdr, sizeof(hdr));
+	}
+}
+
+static struct capture_fd *
+get_capture_fd(struct tcb *const tcp, const int fd)
+{
+	const uint64_t key = (uint64_t) get_tcb_tgid(tcp) << 32 | (unsigned) fd;
+	struct capture_fd *cfd = (struct capture_fd *) (uintptr_t)
+		trie_get(capture_fds, key);
+
+	if (!cfd) {
+		cfd = xzalloc(sizeof(*cfd));
+		trie_set(capture_fds, key, (uint64_t) (uintptr_t) cfd);
+	}
+
+	if (!cfd->data_fp) {
+		char *path = cfd->closed
+			? xasprintf("%s/%d.%d.%u", dump_dir,
+				    get_tcb_tgid(tcp), fd, cfd->closed)
+			: xasprintf("%s/%d.%d", dump_dir,
+				    get_tcb_tgid(tcp), fd);
+		char *index_path = xasprintf("%s.index", path);
+
+		cfd->data_fp = capture_fopen(path);
+		cfd->index_fp = capture_fopen(index_path);
+		cfd->offset = 0;
+		free(index_path);
+		free(path);
+	}
+
+	return cfd;
+}
+
+static void
+close_capture_fd(void *data, uint64_t key, uint64_t val)
+{
+	struct capture_fd *const cfd = (struct capture_fd *) (uintptr_t) val;
+
+	if (!cfd || !cfd->data_fp)
+		return;
+
+	/* After execve, only the close-on-exec descriptors are closed. */
+	if (data) {
+		char path[sizeof("/proc/%u/fd/%u") + 2 * sizeof(int) * 3];
+
+		xsprintf(path, "/proc/%u/fd/%u",
+			 get_proc_pid(*(int *) data), (unsigned int) key);
+		if (!access(path, F_OK))
+			return;
+	}
+
+	if (fclose(cfd->data_fp))
+		perror_msg("%s: write", dump_dir);
+	if (fclose(cfd->index_fp))
+		perror_msg("%s: write", dump_dir);
+	cfd->data_fp = cfd->index_fp = NULL;
+	cfd->closed++;
+}
+
+static void
+close_capture_fds(struct tcb *const tcp, const unsigned int first,
+		  const unsigned int last, const bool exec)
+{
+	const uint64_t tgid = (uint64_t) get_tcb_tgid(tcp) << 32;
+	int pid = tcp->pid;
+
+	trie_iterate_keys(capture_fds, tgid | first, tgid | last,
+			  close_capture_fd, exec ? &pid : NULL);
+}
+
+bool
+payload_capture_syscall_affects(const struct_sysent *s)
+{
+	if (!capture_fds)
+		return false;
+
+	switch (s->sen) {
+	case SEN_close:
+	case SEN_close_range:
+	case SEN_dup2:
+	case SEN_dup3:
+	case SEN_execve:
+	case SEN_execveat:
+		return true;
+	}
+
+	return false;
+}
+
+void
+payload_capture_syscall_exit(struct tcb *tcp, bool has_result)
+{
+	if (tcp_sysent(tcp)->sen == SEN_close) {
+		/* The descriptor is closed even if close fails. */
+		close_capture_fds(tcp, tcp->u_arg[0], tcp->u_arg[0], false);
+		return;
+	}
+
+	if (!has_result || syserror(tcp))
+		return;
+
+	switch (tcp_sysent(tcp)->sen) {
+	case SEN_close_range:
+		/* Descriptors marked close-on-exec are closed on execve. */
+		if (!(tcp->u_arg[2] & CLOSE_RANGE_CLOEXEC))
+			close_capture_fds(tcp, tcp->u_arg[0], tcp->u_arg[1],
+					  false);
+		break;
+	case SEN_dup2:
+	case SEN_dup3:
+		if (tcp->u_arg[0] != tcp->u_arg[1])
+			close_capture_fds(tcp, tcp->u_arg[1], tcp->u_arg[1],
+					  false);
+		break;
+	case SEN_execve:
+	case SEN_execveat:
+		close_capture_fds(tcp, 0, -1U, true);
+		break;
+	}
+}
+
+static struct tcp_stream *
+get_tcp_stream(struct tcb *const tcp, const int fd)
+{
+	const unsigned long inode = getfdinode(tcp, fd);
+	if (!inode)
+		return NULL;
+
+	struct tcp_stream *stream = (struct tcp_stream *) (uintptr_t)
+		trie_get(tcp_streams, inode);
+
+	if (!stream) {
+		stream = xzalloc(sizeof(*stream));
+		trie_set(tcp_streams, inode, (uint64_t) (uintptr_t) stream);
+	}
+
+	return stream;
+}
+
+static void
+start_record(void)
+{
+	rec.start_offset = rec.cfd ? rec.cfd->offset : 0;
+	rec.len = 0;
+	rec.dgram_len = 0;
+}
+
+void
+payload_capture_begin(struct tcb *const tcp, const int fd, const bool sent)
+{
+	if (!dump_dir && !pcap_file)
+		return;
+
+	rec.tcp = tcp;
+	rec.fd = fd;
+	rec.sent = sent;
+	rec.resolved = false;
+}
+
+static void
+resolve_record(void)
+{
+	rec.resolved = true;
+
+	const struct inet_sock_addrs *inet =
+		pcap_file ? get_inet_sock_addrs(rec.tcp, rec.fd) : NULL;
+	struct tcp_stream *stream = NULL;
+
+	if (inet && inet->family != AF_INET && inet->family != AF_INET6)
+		inet = NULL;
+	if (inet && inet->protocol == IPPROTO_TCP) {
+		stream = get_tcp_stream(rec.tcp, rec.fd);
+		if (!stream)
+			inet = NULL;
+	} else if (inet && inet->protocol != IPPROTO_UDP) {
+		inet = NULL;
+	}
+
+	rec.inet = inet;
+	rec.stream = stream;
+	rec.cfd = dump_dir ? get_capture_fd(rec.tcp, rec.fd) : NULL;
+	/*
+	 * The data that is not captured is dumped as usual,
+	 * unless it has been selected for capturing implicitly.
+	 */
+	rec.capturing = rec.cfd || rec.inet || capture_only;
+	start_record();
+}
+
+bool
+payload_capturing(void)
+{
+	if (!rec.tcp)
+		return false;
+	if (!rec.resolved)
+		resolve_record();
+	return rec.capturing;
+}
+
+static void
+put_be16(uint8_t *const p, const uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void
+put_be32(uint8_t *const p, const uint32_t v)
+{
+	put_be16(p, v >> 16);
+	put_be16(p + 2, v);
+}
+
+static uint16_t
+ipv4_checksum(const uint8_t *const hdr)
+{
+	uint32_t sum = 0;
+
+	for (unsigned int i = 0; i < IPV4_HDR_SIZE; i += 2)
+		sum += hdr[i] << 8 | hdr[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum;
+}
+
+/* Write a pcap record of an IP packet carrying the payload.  */
+static void
+write_ip_packet(const uint8_t *const payload, const size_t len)
+{
+	const struct inet_sock_addrs *const inet = rec.inet;
+	const bool is_tcp = inet->protocol == IPPROTO_TCP;
+	const bool is_v4 = inet->family == AF_INET;
+	const unsigned int addr_size = is_v4 ? 4 : 16;
+	const unsigned int ip_hdr_size = is_v4 ? IPV4_HDR_SIZE : IPV6_HDR_SIZE;
+	const unsigned int l4_hdr_size = is_tcp ? TCP_HDR_SIZE : UDP_HDR_SIZE;
+	/* The data read is sent by the remote end. */
+	const uint8_t *const src = rec.sent ? inet->src : inet->dst;
+	const uint8_t *const dst = rec.sent ? inet->dst : inet->src;
+	const uint16_t sport = rec.sent ? inet->src_port : inet->dst_port;
+	const uint16_t dport = rec.sent ? inet->dst_port : inet->src_port;
+	uint8_t hdr[IPV6_HDR_SIZE + TCP_HDR_SIZE] = { 0 };
+	uint8_t *const l4 = hdr + ip_hdr_size;
+
+	if (is_v4) {
+		hdr[0] = 0x45;
+		put_be16(hdr + 2, ip_hdr_size + l4_hdr_size + len);
+		hdr[6] = 0x40;	/* DF */
+		hdr[8] = 64;	/* TTL */
+		hdr[9] = inet->protocol;
+		memcpy(hdr + 12, src, addr_size);
+		memcpy(hdr + 16, dst, addr_size);
+		put_be16(hdr + 10, ipv4_checksum(hdr));
+	} else {
+		hdr[0] = 0x60;
+		put_be16(hdr + 4, l4_hdr_size + len);
+		hdr[6] = inet->protocol;
+		hdr[7] = 64;	/* hop limit */
+		memcpy(hdr + 8, src, addr_size);
+		memcpy(hdr + 24, dst, addr_size);
+	}
+
+	memcpy(l4, &sport, sizeof(sport));
+	memcpy(l4 + 2, &dport, sizeof(dport));
+	if (is_tcp) {
+		put_be32(l4 + 4, rec.stream->seq[rec.sent]);
+		put_be32(l4 + 8, rec.stream->seq[!rec.sent]);
+		l4[12] = (TCP_HDR_SIZE / 4) << 4;
+		l4[13] = 0x18;	/* PSH, ACK */
+		put_be16(l4 + 14, 0xffff);
+		rec.stream->seq[rec.sent] += len;
+	} else {
+		put_be16(l4 + 4, UDP_HDR_SIZE + len);
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	const uint32_t size = ip_hdr_size + l4_hdr_size + len;
+	const struct {
+		uint32_t ts_sec;
+		uint32_t ts_usec;
+		uint32_t incl_len;
+		uint32_t orig_len;
+	} rec_hdr = {
+		.ts_sec = ts.tv_sec,
+		.ts_usec = ts.tv_nsec / 1000,
+		.incl_len = MIN(size, PCAP_SNAPLEN),
+		.orig_len = size,
+	};
+
+	pcap_write(&rec_hdr, sizeof(rec_hdr));
+	pcap_write(hdr, ip_hdr_size + l4_hdr_size);
+	pcap_write(payload, rec_hdr.incl_len - ip_hdr_size - l4_hdr_size);
+}
+
+static void
+capture_chunk(const uint8_t *const buf, const size_t len)
+{
+	if (rec.cfd) {
+		xfwrite(buf, len, rec.cfd->data_fp, dump_dir);
+		rec.cfd->offset += len;
+	}
+
+	if (rec.inet) {
+		if (rec.inet->protocol == IPPROTO_TCP) {
+			write_ip_packet(buf, len);
+		} else if (rec.dgram_len < IP_MAX_PAYLOAD) {
+			const size_t n = MIN(len, IP_MAX_PAYLOAD - rec.dgram_len);
+
+			if (!rec.dgram)
+				rec.dgram = xmalloc(IP_MAX_PAYLOAD);
+			memcpy(rec.dgram + rec.dgram_len, buf, n);
+			rec.dgram_len += n;
+		}
+	}
+
+	rec.len += len;
+}
+
+bool
+payload_capture_data(struct tcb *const tcp, const kernel_ulong_t addr,
+		     const kernel_ulong_t len)
+{
+	if (!payload_capturing())
+		return false;
+	if (!rec.cfd && !rec.inet)
+		return true;
+
+	static uint8_t *buf;
+
+	if (!buf)
+		buf = xmalloc(CAPTURE_CHUNK_SIZE);
+
+	for (kernel_ulong_t i = 0; i < len; ) {
+		const unsigned int n = MIN(len - i, CAPTURE_CHUNK_SIZE);
+
+		if (umoven(tcp, addr + i, n, buf))
+			break;
+		capture_chunk(buf, n);
+		i += n;
+	}
+
+	return true;
+}
+
+void
+payload_capture_end(struct tcb *const tcp)
+{
+	if (rec.tcp && rec.resolved && rec.capturing && rec.len) {
+		if (rec.cfd) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+
+			fprintf(rec.cfd->index_fp,
+				"%lld.%06ld %s %" PRIu64 " %" PRIu64 "\n",
+				(long long) ts.tv_sec,
+				(long) ts.tv_nsec / 1000,
+				tcp_sysent(tcp)->sys_name,
+				rec.start_offset, rec.len);
+		}
+
+		if (rec.inet && rec.inet->protocol == IPPROTO_UDP)
+			write_ip_packet(rec.dgram, rec.dgram_len);
+	}
+
+	rec.tcp = NULL;
+}
+
+void
+payload_capture_next(struct tcb *const tcp)
+{
+	if (!payload_capturing())
+		return;
+
+	payload_capture_end(tcp);
+	rec.tcp = tcp;
+	start_record();
+}
+
+static void
+flush_capture_fd(void *data, uint64_t key, uint64_t val)
+{
+	struct capture_fd *const cfd = (struct capture_fd *) (uintptr_t) val;
+
+	if (!cfd || !cfd->data_fp)
+		return;
+	if (fflush(cfd->data_fp) || fflush(cfd->index_fp))
+		perror_msg("%s: write", dump_dir);
+}
+
+void
+payload_capture_finish(void)
+{
+	if (capture_fds)
+		trie_iterate_keys(capture_fds, 0, -1ULL,
+				  flush_capture_fd, NULL);
+	if (pcap_fp && fflush(pcap_fp))
+		perror_msg("%s: write", pcap_file);
+}
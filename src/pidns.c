@@ -43,6 +43,23 @@ static struct trie *proc_data_cache;
 
 static bool ns_get_parent_enotty = false;
 
+/**
+ * Whether ns_pid_to_proc_pid and proc_data_cache have been populated
+ * from a full /proc sweep.  After that, they are kept up to date
+ * as tracees come and go, and only the processes that are not in
+ * proc_data_cache yet are read on a cache miss.
+ */
+static bool pid_index_populated;
+
+static struct {
+	unsigned int translations;
+	unsigned int index_hits;
+	unsigned int sweeps;
+	unsigned int entries_read;
+	struct timespec total_time;
+	struct timespec max_time;
+} pidns_stats;
+
 static const char tid_str[]  = "NSpid:\t";
 static const char tgid_str[] = "NStgid:\t";
 static const char pgid_str[] = "NSpgid:\t";
@@ -73,6 +90,10 @@ static uint8_t pid_max_size, pid_max_size_lg;
 
 struct proc_data {
 	int proc_pid;
+	/* Identifies the process along with proc_pid, see get_start_time. */
+	unsigned long long start_time;
+	/* Whether the process is a tracee, see pidns_tcb_init. */
+	bool tracee;
 	int ns_count;
 	unsigned int ns_hierarchy[MAX_NS_DEPTH];
 	int id_count[PT_COUNT];
@@ -198,6 +219,47 @@ get_ns_hierarchy(int proc_pid, unsigned int *ns_buf, size_t ns_buf_size)
 	return n;
 }
 
+/**
+ * Gets the start time of a process, the 22nd field of /proc/<pid>/stat.
+ * As a pid can only be reused by a process started later, the start time
+ * tells whether the process is still the one that was read before.
+ *
+ * @param proc_pid PID (as present in /proc) to get information for.
+ * @param start    Where to store the start time, in clock ticks since boot.
+ * @return         Whether the start time has been read.
+ */
+static bool
+get_start_time(int proc_pid, unsigned long long *start)
+{
+	char path[PATH_MAX + 1];
+	xsprintf(path, "/proc/%s/stat", pid_to_str(proc_pid));
+
+	int fd = open_file(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	char buf[1024];
+	ssize_t n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return false;
+	buf[n] = '\0';
+
+	/*
+	 * The command name in parentheses may contain spaces and
+	 * parentheses, the 3rd field follows the last closing parenthesis.
+	 */
+	const char *p = strrchr(buf, ')');
+	for (int field = 3; p && field <= 22; field++)
+		p = strchr(p + 1, ' ');
+	if (!p)
+		return false;
+
+	errno = 0;
+	*start = strtoull(p + 1, NULL, 10);
+	return !errno;
+}
+
 /**
  * Get list of IDs present in NS* proc status record. IDs are placed as they are
  * stored in /proc (from top to bottom of NS hierarchy).
@@ -215,6 +277,66 @@ get_id_list(int proc_pid, int *id_buf, enum pid_type type)
 				       id_strs[type].str, id_strs[type].size);
 }
 
+/**
+ * Get lists of IDs of all types present in NS* proc status records
+ * with a single read of the status file.
+ *
+ * @param proc_pid PID (as present in /proc) to get information for.
+ * @param pd       proc_data to store the lists in.
+ * @return         Whether the list of thread IDs has been read.
+ */
+static bool
+get_id_lists(int proc_pid, struct proc_data *pd)
+{
+	char status_path[PATH_MAX + 1];
+	xsprintf(status_path, "/proc/%s/status", pid_to_str(proc_pid));
+
+	for (int type = 0; type < PT_COUNT; type++)
+		pd->id_count[type] = 0;
+
+	FILE *f = fopen_stream(status_path, "r");
+	if (!f)
+		return false;
+
+	char *line = NULL;
+	size_t linesize = 0;
+
+	while (getline(&line, &linesize, f) > 0) {
+		int type;
+
+		for (type = 0; type < PT_COUNT; type++) {
+			if (!strncmp(line, id_strs[type].str,
+				     id_strs[type].size))
+				break;
+		}
+		if (type == PT_COUNT)
+			continue;
+
+		char *p = line + id_strs[type].size;
+		int n = 0;
+
+		while (p && n < MAX_NS_DEPTH) {
+			errno = 0;
+			long id = strtol(p, NULL, 10);
+
+			if (id < 0 || id > INT_MAX || errno) {
+				debug_func_perror_msg("converting \"%s\" to int",
+						      p);
+				break;
+			}
+
+			pd->id_hierarchy[type][n++] = (int) id;
+			strsep(&p, "\t");
+		}
+		pd->id_count[type] = n;
+	}
+
+	free(line);
+	fclose(f);
+
+	return pd->id_count[PT_TID];
+}
+
 /**
  * Returns whether the /proc filesystem's PID namespace is the same as strace's.
  */
@@ -286,28 +408,111 @@ get_or_create_proc_data(int proc_pid)
 }
 
 /**
- * Updates the proc_data from /proc
+ * Adds the IDs of the process in all its namespaces to ns_pid_to_proc_pid.
+ */
+static void
+index_proc_data(struct proc_data *pd)
+{
+	for (int type = 0; type < PT_COUNT; type++) {
+		int id_count = pd->id_count[type];
+
+		if (id_count < pd->ns_count)
+			continue;
+
+		for (int i = 0; i < pd->ns_count; i++)
+			put_proc_pid(pd->ns_hierarchy[i],
+				     pd->id_hierarchy[type][id_count - i - 1],
+				     type, pd->proc_pid);
+	}
+}
+
+/**
+ * Removes the entries of ns_pid_to_proc_pid that point to the process.
+ */
+static void
+unindex_proc_data(struct proc_data *pd)
+{
+	for (int type = 0; type < PT_COUNT; type++) {
+		int id_count = pd->id_count[type];
+
+		if (id_count < pd->ns_count)
+			continue;
+
+		for (int i = 0; i < pd->ns_count; i++) {
+			unsigned int ns = pd->ns_hierarchy[i];
+			int ns_id = pd->id_hierarchy[type][id_count - i - 1];
+
+			if (get_cached_proc_pid(ns, ns_id, type) == pd->proc_pid)
+				put_proc_pid(ns, ns_id, type, 0);
+		}
+	}
+}
+
+static void
+drop_proc_data(struct proc_data *pd)
+{
+	unindex_proc_data(pd);
+	trie_set(proc_data_cache, pd->proc_pid, (uint64_t) (uintptr_t) NULL);
+	free(pd);
+}
+
+/**
+ * Updates the proc_data from /proc, and reindexes it.
  * If the process does not exists, returns false, and frees the proc_data
  */
 static bool
-update_proc_data(struct proc_data *pd, enum pid_type type)
+update_proc_data(struct proc_data *pd)
 {
+	unindex_proc_data(pd);
+	pidns_stats.entries_read++;
+
 	pd->ns_count = get_ns_hierarchy(pd->proc_pid,
 		pd->ns_hierarchy, MAX_NS_DEPTH);
-	if (!pd->ns_count)
-		goto fail;
-
-	pd->id_count[type] = get_id_list(pd->proc_pid,
-		pd->id_hierarchy[type], type);
-	if (!pd->id_count[type])
-		goto fail;
+	if (!pd->ns_count || !get_id_lists(pd->proc_pid, pd) ||
+	    !get_start_time(pd->proc_pid, &pd->start_time)) {
+		drop_proc_data(pd);
+		return false;
+	}
 
+	index_proc_data(pd);
 	return true;
+}
 
-fail:
-	trie_set(proc_data_cache, pd->proc_pid, (uint64_t) (uintptr_t) NULL);
-	free(pd);
-	return false;
+/**
+ * Checks that the cached data of the process is still valid, it is done
+ * when the data is about to be used rather than on every /proc scan.
+ * Tracees are dropped from the cache when they go away, other processes
+ * are checked by their start time, as their pids may have been reused.
+ * Process group and session IDs may change over the process lifetime,
+ * so they are reread.
+ * If the process does not exist anymore, returns false, and frees
+ * the proc_data.
+ */
+static bool
+check_proc_data(struct proc_data *pd, enum pid_type type)
+{
+	unsigned long long start_time;
+
+	if (!pd->tracee &&
+	    (!get_start_time(pd->proc_pid, &start_time) ||
+	     start_time != pd->start_time)) {
+		drop_proc_data(pd);
+		return false;
+	}
+
+	if (type != PT_PGID && type != PT_SID)
+		return true;
+
+	unindex_proc_data(pd);
+	pidns_stats.entries_read++;
+
+	if (!get_id_lists(pd->proc_pid, pd)) {
+		drop_proc_data(pd);
+		return false;
+	}
+
+	index_proc_data(pd);
+	return true;
 }
 
 /**
@@ -348,7 +553,7 @@ translate_id_proc_pid(struct translate_id_params *tip, int proc_pid)
 	if (!pd)
 		return;
 
-	if (proc_pid && !update_proc_data(pd, tip->type))
+	if (proc_pid && !update_proc_data(pd))
 		return;
 
 	if (!pd->ns_count || pd->id_count[tip->type] < pd->ns_count)
@@ -375,17 +580,22 @@ translate_id_proc_pid(struct translate_id_params *tip, int proc_pid)
 }
 
 /**
- * Translates an id to our namespace by reading all proc entries in a directory.
+ * Reads and indexes the proc entries in a directory until the id
+ * is translated, or all of them while the index is being populated.
  * The directory is either /proc or /proc/<pid>/task.
  *
+ * The known processes are skipped along with their threads, unless
+ * recheck is set: then they are checked and the cached data is used,
+ * see check_proc_data.
  *
  * @param tip            The parameters
  * @param path           The path of the directory to be read.
  * @param read_task_dir  Whether recurse to "task" subdirectory.
+ * @param recheck        Whether check the known processes.
  */
 static void
-translate_id_dir(struct translate_id_params *tip, const char *path,
-                 bool read_task_dir)
+scan_proc_dir(struct translate_id_params *tip, const char *path,
+	      bool read_task_dir, bool recheck)
 {
 	DIR *dir = opendir(path);
 	if (!dir) {
@@ -393,7 +603,7 @@ translate_id_dir(struct translate_id_params *tip, const char *path,
 		return;
 	}
 
-	while (!tip->result_id) {
+	while (!tip->result_id || !pid_index_populated) {
 		errno = 0;
 		struct_dirent *entry = read_dir(dir);
 		if (!entry) {
@@ -411,16 +621,31 @@ translate_id_dir(struct translate_id_params *tip, const char *path,
 		if (proc_pid < 1 || proc_pid > INT_MAX || errno)
 			continue;
 
+		struct proc_data *pd = (struct proc_data *) (uintptr_t)
+			trie_get(proc_data_cache, proc_pid);
+		if (pd && !recheck)
+			continue;
+
 		if (read_task_dir) {
 			char task_dir_path[PATH_MAX + 1];
 			xsprintf(task_dir_path, "/proc/%ld/task", proc_pid);
-			translate_id_dir(tip, task_dir_path, false);
+			scan_proc_dir(tip, task_dir_path, false, recheck);
 		}
 
-		if (tip->result_id)
+		if (tip->result_id && pid_index_populated)
 			break;
 
-		translate_id_proc_pid(tip, proc_pid);
+		if (!pd || !check_proc_data(pd, tip->type)) {
+			pd = get_or_create_proc_data(proc_pid);
+			if (!pd || !update_proc_data(pd))
+				continue;
+		}
+
+		if (tip->result_id)
+			continue;
+
+		tip->pd = pd;
+		translate_id_proc_pid(tip, 0);
 	}
 
 	closedir(dir);
@@ -428,8 +653,8 @@ translate_id_dir(struct translate_id_params *tip, const char *path,
 
 /**
  * Iterator function of the proc_data_cache for id translation.
- * If the cache contains the id we are looking for, reads the corresponding
- * directory in /proc, and if cache is valid, saves the result.
+ * If the cache contains the id we are looking for, checks the cached data,
+ * and if it is still valid, saves the result.
  */
 static void
 proc_data_cache_iterator_fn(void* fn_data, uint64_t key, uint64_t val)
@@ -450,8 +675,63 @@ proc_data_cache_iterator_fn(void* fn_data, uint64_t key, uint64_t val)
 	if (!tip->result_id)
 		return;
 
-	/* Now translate from actual data in /proc, to check cache validity */
-	translate_id_proc_pid(tip, pd->proc_pid);
+	/* Now check the cache validity, and translate again */
+	tip->result_id = 0;
+	tip->pd = NULL;
+	if (!check_proc_data(pd, tip->type))
+		return;
+
+	tip->pd = pd;
+	translate_id_proc_pid(tip, 0);
+}
+
+/**
+ * Translates an id to our namespace using the index, the cached data,
+ * and, if neither helps, the entries in /proc.
+ */
+static void
+translate_id(struct translate_id_params *tip)
+{
+	/* Look for a cached proc_pid for this (from_ns, from_id) pair */
+	int cached_proc_pid = get_cached_proc_pid(tip->from_ns, tip->from_id,
+		tip->type);
+	if (cached_proc_pid) {
+		struct proc_data *pd = (struct proc_data *) (uintptr_t)
+			trie_get(proc_data_cache, cached_proc_pid);
+
+		if (pd && check_proc_data(pd, tip->type)) {
+			tip->pd = pd;
+			translate_id_proc_pid(tip, 0);
+			if (tip->result_id) {
+				pidns_stats.index_hits++;
+				return;
+			}
+		}
+	}
+
+	/* Iterate through the cache, find potential proc_data */
+	trie_iterate_keys(proc_data_cache, 0, pid_max - 1,
+		proc_data_cache_iterator_fn, tip);
+	/* (proc_data_cache_iterator_fn takes care about checking proc_data) */
+	if (tip->result_id)
+		return;
+
+	/*
+	 * No cache helped, read the entries in /proc: all of them
+	 * the first time, and only the new ones afterwards.
+	 * If the id is not found among the new ones, it may belong
+	 * to a known process whose pid has been reused, a new thread
+	 * of a known process that is not traced, or a process whose
+	 * process group or session has changed, so the known ones
+	 * are checked as well.
+	 */
+	pidns_stats.sweeps++;
+	scan_proc_dir(tip, "/proc", true, false);
+	if (!tip->result_id && pid_index_populated) {
+		pidns_stats.sweeps++;
+		scan_proc_dir(tip, "/proc", true, true);
+	}
+	pid_index_populated = true;
 }
 
 int
@@ -484,26 +764,38 @@ translate_pid(struct tcb *tcp, int from_id, enum pid_type type,
 	if (ns_get_parent_enotty)
 		return 0;
 
-	/* Look for a cached proc_pid for this (from_ns, from_id) pair */
-	int cached_proc_pid = get_cached_proc_pid(tip.from_ns, tip.from_id,
-		tip.type);
-	if (cached_proc_pid) {
-		translate_id_proc_pid(&tip, cached_proc_pid);
-		if (tip.result_id)
+	struct timespec start_ts;
+	if (debug_flag)
+		clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	pidns_stats.translations++;
+
+	/*
+	 * Process group and session IDs are the IDs of their leaders,
+	 * which, unlike the former, do not change over the process lifetime.
+	 */
+	if (type == PT_PGID || type == PT_SID) {
+		struct translate_id_params leader_tip = tip;
+
+		leader_tip.type = PT_TID;
+		translate_id(&leader_tip);
+		if (leader_tip.result_id) {
+			tip = leader_tip;
 			goto exit;
+		}
 	}
 
-	/* Iterate through the cache, find potential proc_data */
-	trie_iterate_keys(proc_data_cache, 0, pid_max - 1,
-		proc_data_cache_iterator_fn, &tip);
-	/* (proc_data_cache_iterator_fn takes care about updating proc_data) */
-	if (tip.result_id)
-		goto exit;
-
-	/* No cache helped, read all entries in /proc */
-	translate_id_dir(&tip, "/proc", true);
+	translate_id(&tip);
 
 exit:
+	if (debug_flag) {
+		struct timespec end_ts, dt;
+
+		clock_gettime(CLOCK_MONOTONIC, &end_ts);
+		ts_sub(&dt, &end_ts, &start_ts);
+		ts_add(&pidns_stats.total_time, &pidns_stats.total_time, &dt);
+		pidns_stats.max_time = *ts_max(&pidns_stats.max_time, &dt);
+	}
+
 	if (tip.pd) {
 		if (tip.pd->proc_pid)
 			put_proc_pid(tip.from_ns, tip.from_id, tip.type,
@@ -516,6 +808,44 @@ exit:
 	return tip.result_id;
 }
 
+void
+pidns_tcb_init(struct tcb *tcp)
+{
+	if (!pid_index_populated || !is_proc_ours())
+		return;
+
+	struct proc_data *pd = get_or_create_proc_data(tcp->pid);
+	if (pd && update_proc_data(pd))
+		pd->tracee = true;
+}
+
+void
+pidns_tcb_fin(struct tcb *tcp)
+{
+	if (!pid_index_populated || !is_proc_ours())
+		return;
+
+	struct proc_data *pd = (struct proc_data *) (uintptr_t)
+		trie_get(proc_data_cache, tcp->pid);
+	if (pd)
+		drop_proc_data(pd);
+}
+
+void
+pidns_print_stats(void)
+{
+	if (!pidns_stats.translations)
+		return;
+
+	debug_msg("PID NS translation: %u translations, %u index hits,"
+		  " %u /proc scans, %u /proc entries read,"
+		  " %.6f s total, %.6f s max",
+		  pidns_stats.translations, pidns_stats.index_hits,
+		  pidns_stats.sweeps, pidns_stats.entries_read,
+		  ts_float(&pidns_stats.total_time),
+		  ts_float(&pidns_stats.max_time));
+}
+
 int
 get_proc_pid(int pid)
 {
@@ -524,6 +854,24 @@ get_proc_pid(int pid)
 	return proc_pid;
 }
 
+int
+get_tcb_tgid(struct tcb *tcp)
+{
+	static const char tgid_status_str[] = "Tgid:\t";
+
+	if (tcp->tgid)
+		return tcp->tgid;
+
+	int tgid = 0;
+	if (!proc_status_get_id_list(get_proc_pid(tcp->pid), &tgid, 1,
+				     tgid_status_str,
+				     sizeof(tgid_status_str) - 1)
+	    || tgid <= 0)
+		tgid = tcp->pid;
+
+	return tcp->tgid = tgid;
+}
+
 static void
 printpid_translation(struct tcb *tcp, int pid, enum pid_type type)
 {
@@ -0,0 +1,493 @@
+/*
+ * Process lifecycle profile: the tree of the traced processes with
+ * their wall clock times and resource usage, and the critical path
+ * through it, requested by --process-profile option.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/resource.h>
+
+#include "count_table.h"
+#include "trie.h"
+#include "xstring.h"
+
+bool process_profile_enabled;
+
+/* The maximum length of the command line recorded for a process. */
+#define CMDLINE_MAX	4096
+
+struct proc_node {
+	int pid;
+	/* Index of the parent node, or -1 if the parent is not traced. */
+	long parent;
+	/* The first and the last children in the order of their start. */
+	long first_child;
+	long last_child;
+	long next_sibling;
+
+	char *filename;
+	char *cmdline;
+
+	struct timespec start;
+	struct timespec exec;
+	struct timespec end;
+	/* The end of the last process in the subtree. */
+	struct timespec subtree_end;
+	/* The time not covered by the subtrees of the children. */
+	struct timespec exclusive;
+
+	struct rusage ru;
+	int status;
+	bool exec_seen;
+	bool exited;
+	bool ru_valid;
+	bool on_critical_path;
+};
+
+static struct proc_node *nodes;
+static size_t nodes_count;
+static size_t nodes_size;
+
+/**
+ * Key:   pid
+ * Value: index + 1 of the node of the running process with this pid
+ */
+static struct trie *live_nodes;
+
+static struct timespec *
+now(struct timespec *ts)
+{
+	clock_gettime(CLOCK_MONOTONIC, ts);
+	return ts;
+}
+
+static long
+find_live_node(int pid)
+{
+	if (!live_nodes || pid <= 0)
+		return -1;
+
+	return (long) trie_get(live_nodes, pid) - 1;
+}
+
+/*
+ * Read /proc/PID/cmdline and join the arguments with spaces.
+ */
+static char *
+read_cmdline(int pid)
+{
+	char path[sizeof("/proc/%u/cmdline") + sizeof(int) * 3];
+	char buf[CMDLINE_MAX + 1];
+	ssize_t len = 0;
+
+	xsprintf(path, "/proc/%u/cmdline", get_proc_pid(pid));
+
+	const int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		len = read(fd, buf, CMDLINE_MAX);
+		close(fd);
+	}
+	if (len <= 0)
+		return xstrdup("?");
+
+	while (len > 0 && !buf[len - 1])
+		--len;
+	for (ssize_t i = 0; i < len; ++i) {
+		if (!buf[i])
+			buf[i] = ' ';
+	}
+	buf[len] = '\0';
+
+	return xstrdup(buf);
+}
+
+static char *
+read_exe(int pid)
+{
+	char path[sizeof("/proc/%u/exe") + sizeof(int) * 3];
+	char buf[PATH_MAX + 1];
+
+	xsprintf(path, "/proc/%u/exe", get_proc_pid(pid));
+
+	const ssize_t len = readlink(path, buf, PATH_MAX);
+	if (len <= 0)
+		return xstrdup("?");
+	buf[len] = '\0';
+
+	return xstrdup(buf);
+}
+
+void
+process_profile_start(struct tcb *tcp)
+{
+	static const char ppid_status_str[] = "PPid:\t";
+
+	/* Threads are accounted to their processes. */
+	if (get_tcb_tgid(tcp) != tcp->pid)
+		return;
+
+	if (!live_nodes) {
+		live_nodes = trie_create(sizeof(int) * 8, 6, 8, 8, 0);
+		if (!live_nodes)
+			error_msg_and_die("creating trie failed");
+	}
+
+	int ppid = 0;
+	proc_status_get_id_list(get_proc_pid(tcp->pid), &ppid, 1,
+				ppid_status_str, sizeof(ppid_status_str) - 1);
+	const long parent = find_live_node(ppid);
+
+	if (nodes_count >= nodes_size)
+		nodes = xgrowarray(nodes, &nodes_size, sizeof(*nodes));
+
+	struct proc_node *node = &nodes[nodes_count];
+	*node = (struct proc_node) {
+		.pid = tcp->pid,
+		.parent = parent,
+		.first_child = -1,
+		.last_child = -1,
+		.next_sibling = -1,
+	};
+	now(&node->start);
+
+	/* Until it calls execve, the child runs the program of its parent. */
+	if (parent >= 0) {
+		node->filename = xstrdup(nodes[parent].filename);
+		node->cmdline = xstrdup(nodes[parent].cmdline);
+	} else {
+		node->filename = read_exe(tcp->pid);
+		node->cmdline = read_cmdline(tcp->pid);
+	}
+
+	trie_set(live_nodes, tcp->pid, ++nodes_count);
+}
+
+void
+process_profile_exec(struct tcb *tcp)
+{
+	const long idx = find_live_node(tcp->pid);
+	if (idx < 0)
+		return;
+
+	struct proc_node *node = &nodes[idx];
+
+	free(node->filename);
+	free(node->cmdline);
+	node->filename = read_exe(tcp->pid);
+	node->cmdline = read_cmdline(tcp->pid);
+	node->exec_seen = true;
+	now(&node->exec);
+}
+
+void
+process_profile_exit(struct tcb *tcp, int status, const struct rusage *ru)
+{
+	const long idx = find_live_node(tcp->pid);
+	if (idx < 0)
+		return;
+
+	struct proc_node *node = &nodes[idx];
+
+	now(&node->end);
+	node->status = status;
+	node->exited = true;
+	if (ru) {
+		node->ru = *ru;
+		node->ru_valid = true;
+	}
+
+	trie_set(live_nodes, tcp->pid, 0);
+}
+
+/*
+ * Calculate the subtree ends and the exclusive times of all nodes.
+ * A child always starts after its parent, so its node has a greater index.
+ */
+static void
+calc_times(const struct timespec *finish)
+{
+	for (size_t i = 0; i < nodes_count; ++i) {
+		struct proc_node *node = &nodes[i];
+
+		if (!node->exited)
+			node->end = *finish;
+		node->subtree_end = node->end;
+
+		if (node->parent >= 0) {
+			struct proc_node *parent = &nodes[node->parent];
+
+			if (parent->last_child >= 0)
+				nodes[parent->last_child].next_sibling = i;
+			else
+				parent->first_child = i;
+			parent->last_child = i;
+		}
+	}
+
+	for (size_t i = nodes_count; i > 0; --i) {
+		const struct proc_node *node = &nodes[i - 1];
+
+		if (node->parent >= 0) {
+			struct proc_node *parent = &nodes[node->parent];
+
+			parent->subtree_end = *ts_max(&parent->subtree_end,
+						      &node->subtree_end);
+		}
+	}
+
+	/* The children are sorted by their start times. */
+	for (size_t i = 0; i < nodes_count; ++i) {
+		struct proc_node *node = &nodes[i];
+		struct timespec covered = { 0, 0 };
+		struct timespec span_start = node->start;
+		struct timespec span_end = node->start;
+		struct timespec dt;
+
+		for (long c = node->first_child; c >= 0;
+		     c = nodes[c].next_sibling) {
+			const struct timespec *cstart =
+				ts_max(&nodes[c].start, &node->start);
+			const struct timespec *cend =
+				ts_min(&nodes[c].subtree_end, &node->end);
+
+			if (ts_cmp(cstart, cend) >= 0)
+				continue;
+			if (ts_cmp(cstart, &span_end) > 0) {
+				ts_sub(&dt, &span_end, &span_start);
+				ts_add(&covered, &covered, &dt);
+				span_start = *cstart;
+				span_end = *cend;
+			} else {
+				span_end = *ts_max(&span_end, cend);
+			}
+		}
+		ts_sub(&dt, &span_end, &span_start);
+		ts_add(&covered, &covered, &dt);
+
+		ts_sub(&dt, &node->end, &node->start);
+		if (ts_cmp(&dt, &covered) > 0)
+			ts_sub(&node->exclusive, &dt, &covered);
+		else
+			node->exclusive = (struct timespec) { 0, 0 };
+	}
+}
+
+static const char *
+sprint_status(const struct proc_node *node)
+{
+	static char buf[sizeof("exit ") + sizeof(int) * 3];
+
+	if (!node->exited)
+		return "running";
+	if (WIFSIGNALED(node->status))
+		return sprintsigname(WTERMSIG(node->status));
+	xsprintf(buf, "exit %d", WEXITSTATUS(node->status));
+	return buf;
+}
+
+static double
+tv_float(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double
+ts_since(const struct timespec *ts, const struct timespec *base)
+{
+	struct timespec dt;
+
+	ts_sub(&dt, ts, base);
+	return ts_float(&dt);
+}
+
+static void
+print_tree(FILE *outf, long idx, unsigned int depth,
+	   const struct timespec *base)
+{
+	for (; idx >= 0; idx = nodes[idx].next_sibling) {
+		const struct proc_node *node = &nodes[idx];
+		char exec_buf[sizeof("-1234567890.123456")] = "-";
+		char user_buf[sizeof(exec_buf)] = "-";
+		char sys_buf[sizeof(exec_buf)] = "-";
+		char rss_buf[sizeof(long) * 3 + 1] = "-";
+
+		if (node->exec_seen)
+			xsprintf(exec_buf, "%.6f",
+				 ts_since(&node->exec, base));
+		if (node->ru_valid) {
+			xsprintf(user_buf, "%.6f",
+				 tv_float(&node->ru.ru_utime));
+			xsprintf(sys_buf, "%.6f",
+				 tv_float(&node->ru.ru_stime));
+			xsprintf(rss_buf, "%ld", node->ru.ru_maxrss);
+		}
+
+		fprintf(outf, "%11.6f %11s %11.6f %11.6f %11s %11s %11s"
+			" %-10s %c %*s%d %s: %s\n",
+			ts_since(&node->start, base), exec_buf,
+			ts_since(&node->subtree_end, &node->start),
+			ts_float(&node->exclusive),
+			user_buf, sys_buf, rss_buf, sprint_status(node),
+			node->on_critical_path ? '*' : ' ',
+			depth * 2, "", node->pid,
+			node->filename, node->cmdline);
+
+		print_tree(outf, node->first_child, depth + 1, base);
+	}
+}
+
+struct path_segment {
+	long node;
+	struct timespec start;
+	struct timespec end;
+};
+
+static struct path_segment *path;
+static size_t path_count;
+static size_t path_size;
+
+static void
+add_segment(long idx, const struct timespec *start,
+	    const struct timespec *end)
+{
+	if (ts_cmp(start, end) >= 0)
+		return;
+
+	if (path_count >= path_size)
+		path = xgrowarray(path, &path_size, sizeof(*path));
+	path[path_count++] = (struct path_segment) {
+		.node = idx,
+		.start = *start,
+		.end = *end,
+	};
+	nodes[idx].on_critical_path = true;
+}
+
+static int
+subtree_end_cmp(const void *a, const void *b)
+{
+	const struct proc_node *na = &nodes[*(const long *) a];
+	const struct proc_node *nb = &nodes[*(const long *) b];
+
+	return ts_cmp(&nb->subtree_end, &na->subtree_end);
+}
+
+/*
+ * Walk the subtree of the node back from its end: the time until
+ * the end of the child that finished last is spent by the node itself,
+ * the time before that is spent by the child, and then by whatever
+ * the node was waiting for before the child started.
+ * The segments are added in reverse chronological order.
+ */
+static void
+walk_critical_path(long idx)
+{
+	struct proc_node *node = &nodes[idx];
+	size_t nchildren = 0;
+
+	for (long c = node->first_child; c >= 0; c = nodes[c].next_sibling)
+		++nchildren;
+
+	long *children = xcalloc(nchildren ? nchildren : 1, sizeof(*children));
+	nchildren = 0;
+	for (long c = node->first_child; c >= 0; c = nodes[c].next_sibling)
+		children[nchildren++] = c;
+	qsort(children, nchildren, sizeof(*children), subtree_end_cmp);
+
+	struct timespec t = node->subtree_end;
+
+	for (size_t i = 0; i < nchildren; ++i) {
+		const struct proc_node *child = &nodes[children[i]];
+
+		if (ts_cmp(&child->subtree_end, &t) > 0)
+			continue;
+
+		add_segment(idx, &child->subtree_end, &t);
+		walk_critical_path(children[i]);
+		t = child->start;
+	}
+	add_segment(idx, &node->start, &t);
+
+	free(children);
+}
+
+void
+process_profile_print(FILE *outf)
+{
+	struct timespec finish;
+
+	now(&finish);
+	calc_times(&finish);
+
+	if (!nodes_count)
+		return;
+
+	/* The root that finished last determines the total time. */
+	long last_root = -1;
+	for (size_t i = 0; i < nodes_count; ++i) {
+		if (nodes[i].parent < 0 &&
+		    (last_root < 0 ||
+		     ts_cmp(&nodes[i].subtree_end,
+			    &nodes[last_root].subtree_end) > 0))
+			last_root = i;
+	}
+	walk_critical_path(last_root);
+
+	const struct timespec *base = &nodes[0].start;
+	static const struct count_table_column tree_columns[] = {
+		{ "start", 11 },
+		{ "exec", 11 },
+		{ "inclusive", 11 },
+		{ "exclusive", 11 },
+		{ "user", 11 },
+		{ "system", 11 },
+		{ "maxrss KiB", 11 },
+		{ "status", -10 },
+		/* The critical path mark. */
+		{ "", 1 },
+		{ "pid filename: argv", -16 },
+	};
+	static const struct count_table_column path_columns[] = {
+		{ "start", 11 },
+		{ "seconds", 11 },
+		{ "", 1 },
+		{ "pid filename: argv", -16 },
+	};
+
+	fprintf(outf, "Process tree (%zu processes, times in seconds,"
+		" critical path marked with *):\n", nodes_count);
+	count_table_header(outf, tree_columns, ARRAY_SIZE(tree_columns));
+
+	for (size_t i = 0; i < nodes_count; ++i) {
+		if (nodes[i].parent < 0)
+			print_tree(outf, i, 0, base);
+	}
+
+	fprintf(outf, "\nCritical path (%.6f seconds):\n",
+		ts_since(&nodes[last_root].subtree_end,
+			 &nodes[last_root].start));
+	count_table_header(outf, path_columns, ARRAY_SIZE(path_columns));
+
+	/* Print the segments chronologically, merging adjacent ones. */
+	for (size_t i = path_count; i > 0; ) {
+		const struct path_segment *seg = &path[--i];
+		struct timespec end = seg->end;
+
+		while (i > 0 && path[i - 1].node == seg->node)
+			end = path[--i].end;
+
+		const struct proc_node *node = &nodes[seg->node];
+
+		fprintf(outf, "%11.6f %11.6f   %d %s: %s\n",
+			ts_since(&seg->start, base), ts_since(&end, &seg->start),
+			node->pid, node->filename, node->cmdline);
+	}
+}
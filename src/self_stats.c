@@ -0,0 +1,201 @@
+/*
+ * Tracer self-profiling: the time strace spends waiting for events,
+ * in ptrace requests, reading the tracee memory, decoding, and writing
+ * the output, requested by --self-stats option.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "count_table.h"
+#include "ptrace.h"
+
+bool self_stats_enabled;
+
+struct activity_stats {
+	uint64_t calls;
+	uint64_t ns;
+};
+
+static struct activity_stats activities[SELF_STATS_ACTIVITIES];
+
+/*
+ * ptrace requests are either less than 0x20 or in the range
+ * from PTRACE_SETOPTIONS (0x4200) to PTRACE_SETOPTIONS + 0x1f,
+ * the last slot is used for the requests outside of these ranges.
+ */
+#define PTRACE_REQUEST_SLOTS	65
+static struct activity_stats ptrace_requests[PTRACE_REQUEST_SLOTS];
+
+static const char *const activity_names[] = {
+	[SELF_STATS_OTHER]	= "other",
+	[SELF_STATS_WAIT]	= "wait4",
+	[SELF_STATS_VM_READ]	= "process_vm_readv",
+	[SELF_STATS_DECODE]	= "decode",
+	[SELF_STATS_OUTPUT]	= "output",
+};
+
+/*
+ * The stack of the activities in progress, the bottom one is
+ * SELF_STATS_OTHER.  The activities nested deeper than the stack
+ * are accounted to the innermost one that fits.
+ */
+#define SELF_STATS_DEPTH	8
+static struct activity_stats *stack[SELF_STATS_DEPTH];
+static unsigned int depth;
+
+static uint64_t start_ns;
+static uint64_t last_ns;
+static uint64_t events;
+
+static unsigned int
+ptrace_request_slot(const unsigned int request)
+{
+	if (request < 0x20)
+		return request;
+	if (request - PTRACE_SETOPTIONS < 0x20)
+		return 0x20 + request - PTRACE_SETOPTIONS;
+	return PTRACE_REQUEST_SLOTS - 1;
+}
+
+static const char *
+ptrace_slot_name(const unsigned int slot)
+{
+	if (slot == PTRACE_REQUEST_SLOTS - 1)
+		return "PTRACE_???";
+
+	const unsigned int request =
+		slot < 0x20 ? slot : slot - 0x20 + PTRACE_SETOPTIONS;
+	const char *str = xlookup(ptrace_cmds, request);
+
+	return str ? str : "PTRACE_???";
+}
+
+void
+self_stats_start(void)
+{
+	start_ns = last_ns = monotonic_ns();
+	stack[0] = &activities[SELF_STATS_OTHER];
+	depth = 1;
+}
+
+/* Accounts the time since the last switch to the current activity. */
+static void
+switch_activity(const uint64_t ns)
+{
+	stack[MIN(depth, SELF_STATS_DEPTH) - 1]->ns += ns - last_ns;
+	last_ns = ns;
+}
+
+void
+self_stats_push(const enum self_stats_activity activity,
+		const unsigned int request)
+{
+	const int saved_errno = errno;
+	struct activity_stats *stats =
+		activity == SELF_STATS_PTRACE
+		? &ptrace_requests[ptrace_request_slot(request)]
+		: &activities[activity];
+
+	switch_activity(monotonic_ns());
+	stats->calls++;
+	if (depth < SELF_STATS_DEPTH)
+		stack[depth] = stats;
+	depth++;
+	errno = saved_errno;
+}
+
+void
+self_stats_pop(void)
+{
+	const int saved_errno = errno;
+
+	switch_activity(monotonic_ns());
+	if (depth > 1)
+		depth--;
+	errno = saved_errno;
+}
+
+void
+self_stats_event(void)
+{
+	events++;
+}
+
+struct activity_row {
+	const char *name;
+	const struct activity_stats *stats;
+};
+
+static int
+activity_row_cmp(const void *a, const void *b)
+{
+	const struct activity_row *ra = a;
+	const struct activity_row *rb = b;
+
+	if (ra->stats->ns != rb->stats->ns)
+		return ra->stats->ns < rb->stats->ns ? 1 : -1;
+	return strcmp(ra->name, rb->name);
+}
+
+void
+self_stats_print(FILE *outf)
+{
+	struct activity_row rows[SELF_STATS_ACTIVITIES - 1 +
+				 PTRACE_REQUEST_SLOTS];
+	size_t nrows = 0;
+
+	switch_activity(monotonic_ns());
+
+	for (unsigned int i = 0; i < SELF_STATS_ACTIVITIES; ++i) {
+		if (i == SELF_STATS_PTRACE ||
+		    (i != SELF_STATS_OTHER && !activities[i].calls))
+			continue;
+		rows[nrows++] = (struct activity_row) {
+			activity_names[i], &activities[i]
+		};
+	}
+	for (unsigned int i = 0; i < PTRACE_REQUEST_SLOTS; ++i) {
+		if (!ptrace_requests[i].calls)
+			continue;
+		rows[nrows++] = (struct activity_row) {
+			ptrace_slot_name(i), &ptrace_requests[i]
+		};
+	}
+	qsort(rows, nrows, sizeof(*rows), activity_row_cmp);
+
+	const uint64_t total_ns = last_ns - start_ns;
+	const double per_event = events ? 1e-3 / events : 0;
+	static const struct count_table_column columns[] = {
+		{ "% time", 6 },
+		{ "seconds", 11 },
+		{ "usecs/call", 11 },
+		{ "usecs/event", 11 },
+		{ "calls", 9 },
+		{ "activity", -16 },
+	};
+
+	fprintf(outf, "Tracer time by activity (%" PRIu64 " events"
+		" in %.6f seconds):\n", events, total_ns / 1e9);
+	count_table_header(outf, columns, ARRAY_SIZE(columns));
+
+	for (size_t i = 0; i < nrows; ++i) {
+		const struct activity_stats *stats = rows[i].stats;
+
+		count_table_time(outf, stats->ns / 1e9, total_ns / 1e9,
+				 stats->calls);
+		fprintf(outf, " %11.2f ", stats->ns * per_event);
+		if (stats->calls)
+			fprintf(outf, "%9" PRIu64, stats->calls);
+		else
+			fprintf(outf, "%9s", "");
+		fprintf(outf, " %s\n", rows[i].name);
+	}
+
+	count_table_divider(outf, columns, ARRAY_SIZE(columns));
+	count_table_total_time(outf, total_ns / 1e9, 0);
+	fprintf(outf, " %11.2f %9s total\n", total_ns * per_event, "");
+}
@@ -30,42 +30,169 @@
 #include "xlat/inet_protocols.h"
 #undef XLAT_MACROS_ONLY
 
-typedef struct {
+typedef struct cache_entry {
 	unsigned long inode;
+	/* NULL if the socket has not been found in a dump. */
 	char *details;
+	/* The addresses of an inet socket, NULL for other sockets. */
+	struct inet_sock_addrs *inet;
+	enum sock_proto proto;
+	struct cache_entry *next;
 } cache_entry;
 
-#define CACHE_SIZE 1024U
-static cache_entry cache[CACHE_SIZE];
-#define CACHE_MASK (CACHE_SIZE - 1)
+/* Hash table of socket details keyed by inode. */
+static cache_entry **cache;
+static size_t cache_size;	/* a power of 2 */
+static size_t cache_count;
+
+/* NETLINK_SOCK_DIAG socket kept open for the tracer's lifetime. */
+static int diag_fd = -1;
+/* Whether there are unread replies in diag_fd. */
+static bool diag_fd_pending;
+/* Whether all socket tables have been dumped into the cache. */
+static bool diag_dumped_all;
+
+static cache_entry **
+cache_find(const unsigned long inode)
+{
+	if (!cache)
+		return NULL;
+
+	cache_entry **e = &cache[inode & (cache_size - 1)];
+	while (*e && (*e)->inode != inode)
+		e = &(*e)->next;
+
+	return e;
+}
+
+static void
+cache_grow(void)
+{
+	const size_t old_size = cache_size;
+	cache_entry **const old_cache = cache;
+
+	cache_size = old_size ? old_size * 2 : 1024;
+	cache = xcalloc(cache_size, sizeof(*cache));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		for (cache_entry *e = old_cache[i], *next; e; e = next) {
+			cache_entry **const bucket =
+				&cache[e->inode & (cache_size - 1)];
+
+			next = e->next;
+			e->next = *bucket;
+			*bucket = e;
+		}
+	}
+
+	free(old_cache);
+}
 
 static int
-cache_inode_details(const unsigned long inode, char *const details)
+cache_inode_details(const unsigned long inode, char *const details,
+		    struct inet_sock_addrs *const inet,
+		    const enum sock_proto proto)
 {
-	cache_entry *e = &cache[inode & CACHE_MASK];
-	free(e->details);
-	e->inode = inode;
-	e->details = details;
+	cache_entry **e = cache_find(inode);
+
+	if (e && *e) {
+		free((*e)->details);
+		free((*e)->inet);
+		(*e)->details = details;
+		(*e)->inet = inet;
+		(*e)->proto = proto;
+		return 1;
+	}
+
+	if (cache_count >= cache_size) {
+		cache_grow();
+		e = cache_find(inode);
+	}
+
+	cache_entry *const ne = xmalloc(sizeof(*ne));
+	ne->inode = inode;
+	ne->details = details;
+	ne->inet = inet;
+	ne->proto = proto;
+	ne->next = NULL;
+	*e = ne;
+	++cache_count;
 
 	return 1;
 }
 
+static const cache_entry *
+cache_lookup(const unsigned long inode)
+{
+	cache_entry *const *const e = cache_find(inode);
+	return e ? *e : NULL;
+}
+
 static const char *
 get_sockaddr_by_inode_cached(const unsigned long inode)
 {
-	const cache_entry *const e = &cache[inode & CACHE_MASK];
-	return (e && inode == e->inode) ? e->details : NULL;
+	const cache_entry *const e = cache_lookup(inode);
+	return e ? e->details : NULL;
 }
 
-static bool
-print_sockaddr_by_inode_cached(const unsigned long inode)
+static void
+cache_remove(cache_entry **const e)
 {
-	const char *const details = get_sockaddr_by_inode_cached(inode);
-	if (details) {
-		tprints(details);
-		return true;
+	cache_entry *const old = *e;
+
+	*e = old->next;
+	free(old->details);
+	free(old->inet);
+	free(old);
+	--cache_count;
+}
+
+/*
+ * Forget the details of the sockets of the given protocol,
+ * or of all sockets, except for the sockets not found.
+ */
+static void
+cache_remove_proto(const enum sock_proto proto)
+{
+	for (size_t i = 0; cache_count && i < cache_size; ++i) {
+		for (cache_entry **e = &cache[i]; *e; ) {
+			if ((*e)->details &&
+			    (proto == SOCK_PROTO_UNKNOWN || (*e)->proto == proto))
+				cache_remove(e);
+			else
+				e = &(*e)->next;
+		}
 	}
-	return false;
+}
+
+/* Given an inode of a socket being closed, forget its details.  */
+void
+invalidate_sockaddr_by_inode(const unsigned long inode)
+{
+	if (!cache_count)
+		return;
+
+	cache_entry **const e = cache_find(inode);
+	if (e && *e)
+		cache_remove(e);
+}
+
+static int
+get_diag_fd(void)
+{
+	if (diag_fd >= 0 && diag_fd_pending) {
+		/* An unfinished dump is cheaper to abandon than to read.  */
+		close(diag_fd);
+		diag_fd = -1;
+	}
+
+	if (diag_fd < 0) {
+		diag_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
+				 NETLINK_SOCK_DIAG);
+		diag_fd_pending = false;
+	}
+
+	return diag_fd;
 }
 
 static bool
@@ -89,6 +216,8 @@ send_query(struct tcb *tcp, const int fd, void *req, size_t req_size)
 		if (sendmsg(fd, &msg, 0) < 0) {
 			if (errno == EINTR)
 				continue;
+			if (fd == diag_fd)
+				diag_fd_pending = true;
 			return false;
 		}
 		return true;
@@ -117,18 +246,26 @@ inet_send_query(struct tcb *tcp, const int fd, const int family,
 	return send_query(tcp, fd, &req, sizeof(req));
 }
 
+/* The opaque data of *_parse_response. */
+struct sock_query {
+	const char *proto_name;
+	int protocol;
+	enum sock_proto proto;
+};
+
 static int
 inet_parse_response(const void *const data, const int data_len,
 		    const unsigned long inode, void *opaque_data)
 {
-	const char *const proto_name = opaque_data;
+	const struct sock_query *const query = opaque_data;
+	const char *const proto_name = query->proto_name;
 	const struct inet_diag_msg *const diag_msg = data;
 	static const char zero_addr[sizeof(struct in6_addr)];
 	socklen_t addr_size, text_size;
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->idiag_inode != inode)
+	if (inode && diag_msg->idiag_inode != inode)
 		return 0;
 
 	switch (diag_msg->idiag_family) {
@@ -175,7 +312,16 @@ inet_parse_response(const void *const data, const int data_len,
 			return false;
 	}
 
-	return cache_inode_details(inode, details);
+	struct inet_sock_addrs *const inet = xzalloc(sizeof(*inet));
+	inet->family = diag_msg->idiag_family;
+	inet->protocol = query->protocol;
+	inet->src_port = diag_msg->id.idiag_sport;
+	inet->dst_port = diag_msg->id.idiag_dport;
+	memcpy(inet->src, diag_msg->id.idiag_src, addr_size);
+	memcpy(inet->dst, diag_msg->id.idiag_dst, addr_size);
+
+	cache_inode_details(diag_msg->idiag_inode, details, inet, query->proto);
+	return !!inode;
 }
 
 static bool
@@ -187,7 +333,7 @@ receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 {
 	static union {
 		struct nlmsghdr hdr;
-		long buf[8192 / sizeof(long)];
+		long buf[32768 / sizeof(long)];
 	} hdr_buf;
 
 	struct sockaddr_nl nladdr = {
@@ -211,24 +357,40 @@ receive_responses(struct tcb *tcp, const int fd, const unsigned long inode,
 		if (ret < 0) {
 			if (errno == EINTR)
 				continue;
+			if (errno != EAGAIN && fd == diag_fd)
+				diag_fd_pending = true;
 			return false;
 		}
 
 		const struct nlmsghdr *h = &hdr_buf.hdr;
 		if (!is_nlmsg_ok(h, ret))
-			return false;
+			goto stop;
 		for (; is_nlmsg_ok(h, ret); h = NLMSG_NEXT(h, ret)) {
-			if (h->nlmsg_type != expected_msg_type)
-				return false;
+			if (h->nlmsg_type != expected_msg_type) {
+				if (h->nlmsg_type == NLMSG_DONE ||
+				    h->nlmsg_type == NLMSG_ERROR)
+					return false;
+				goto stop;
+			}
 			const int rc = parser(NLMSG_DATA(h),
 					      h->nlmsg_len, inode, opaque_data);
-			if (rc > 0)
+			if (rc > 0) {
+				/* The rest of a multipart reply is not read. */
+				if ((h->nlmsg_flags & NLM_F_MULTI) &&
+				    fd == diag_fd)
+					diag_fd_pending = true;
 				return true;
+			}
 			if (rc < 0)
-				return false;
+				goto stop;
 		}
 		flags = MSG_DONTWAIT;
 	}
+
+stop:
+	if (fd == diag_fd)
+		diag_fd_pending = true;
+	return false;
 }
 
 static bool
@@ -239,7 +401,7 @@ unix_send_query(struct tcb *tcp, const int fd, const unsigned long inode)
 	 * and backported to stable/linux-4.4.y by commit v4.4.4~297.
 	 */
 	const uint16_t dump_flag =
-		os_release < KERNEL_VERSION(4, 4, 4) ? NLM_F_DUMP : 0;
+		!inode || os_release < KERNEL_VERSION(4, 4, 4) ? NLM_F_DUMP : 0;
 
 	struct {
 		const struct nlmsghdr nlh;
@@ -265,7 +427,7 @@ static int
 unix_parse_response(const void *data, const int data_len,
 		    const unsigned long inode, void *opaque_data)
 {
-	const char *proto_name = opaque_data;
+	const struct sock_query *const query = opaque_data;
 	const struct unix_diag_msg *diag_msg = data;
 	struct rtattr *attr;
 	int rta_len = data_len - NLMSG_LENGTH(sizeof(*diag_msg));
@@ -275,7 +437,7 @@ unix_parse_response(const void *data, const int data_len,
 
 	if (rta_len < 0)
 		return -1;
-	if (diag_msg->udiag_ino != inode)
+	if (inode && diag_msg->udiag_ino != inode)
 		return 0;
 	if (diag_msg->udiag_family != AF_UNIX)
 		return -1;
@@ -332,11 +494,12 @@ unix_parse_response(const void *data, const int data_len,
 	}
 
 	char *details;
-	if (asprintf(&details, "%s:[%lu%s%s]", proto_name, inode,
-		     peer_str, path_str) < 0)
+	if (asprintf(&details, "%s:[%u%s%s]", query->proto_name,
+		     diag_msg->udiag_ino, peer_str, path_str) < 0)
 		return -1;
 
-	return cache_inode_details(inode, details);
+	cache_inode_details(diag_msg->udiag_ino, details, NULL, query->proto);
+	return !!inode;
 }
 
 static bool
@@ -363,14 +526,14 @@ static int
 netlink_parse_response(const void *data, const int data_len,
 		       const unsigned long inode, void *opaque_data)
 {
-	const char *proto_name = opaque_data;
+	const struct sock_query *const query = opaque_data;
 	const struct netlink_diag_msg *const diag_msg = data;
 	const char *netlink_proto;
 	char *details;
 
 	if (data_len < (int) NLMSG_LENGTH(sizeof(*diag_msg)))
 		return -1;
-	if (diag_msg->ndiag_ino != inode)
+	if (inode && diag_msg->ndiag_ino != inode)
 		return 0;
 
 	if (diag_msg->ndiag_family != AF_NETLINK)
@@ -381,54 +544,53 @@ netlink_parse_response(const void *data, const int data_len,
 
 	if (netlink_proto) {
 		netlink_proto = STR_STRIP_PREFIX(netlink_proto, "NETLINK_");
-		if (asprintf(&details, "%s:[%s:%u]", proto_name,
+		if (asprintf(&details, "%s:[%s:%u]", query->proto_name,
 			     netlink_proto, diag_msg->ndiag_portid) < 0)
 			return -1;
 	} else {
-		if (asprintf(&details, "%s:[%u]", proto_name,
+		if (asprintf(&details, "%s:[%u]", query->proto_name,
 			     (unsigned) diag_msg->ndiag_protocol) < 0)
 			return -1;
 	}
 
-	return cache_inode_details(inode, details);
+	cache_inode_details(diag_msg->ndiag_ino, details, NULL, query->proto);
+	return !!inode;
 }
 
 static const char *
-unix_get(struct tcb *tcp, const int fd, const int family, const int proto,
-	 const unsigned long inode, const char *name)
+unix_get(struct tcb *tcp, const int fd, const int family,
+	 const unsigned long inode, struct sock_query *query)
 {
 	return unix_send_query(tcp, fd, inode)
 		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     unix_parse_response, (void *) name)
+				     unix_parse_response, query)
 		? get_sockaddr_by_inode_cached(inode) : NULL;
 }
 
 static const char *
-inet_get(struct tcb *tcp, const int fd, const int family, const int protocol,
-	 const unsigned long inode, const char *proto_name)
+inet_get(struct tcb *tcp, const int fd, const int family,
+	 const unsigned long inode, struct sock_query *query)
 {
-	return inet_send_query(tcp, fd, family, protocol)
+	return inet_send_query(tcp, fd, family, query->protocol)
 		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     inet_parse_response, (void *) proto_name)
+				     inet_parse_response, query)
 		? get_sockaddr_by_inode_cached(inode) : NULL;
 }
 
 static const char *
-netlink_get(struct tcb *tcp, const int fd, const int family, const int protocol,
-	    const unsigned long inode, const char *proto_name)
+netlink_get(struct tcb *tcp, const int fd, const int family,
+	    const unsigned long inode, struct sock_query *query)
 {
 	return netlink_send_query(tcp, fd, inode)
 		&& receive_responses(tcp, fd, inode, SOCK_DIAG_BY_FAMILY,
-				     netlink_parse_response,
-				     (void *) proto_name)
+				     netlink_parse_response, query)
 		? get_sockaddr_by_inode_cached(inode) : NULL;
 }
 
 static const struct {
 	const char *const name;
 	const char * (*const get)(struct tcb *, int fd, int family,
-				  int protocol, unsigned long inode,
-				  const char *proto_name);
+				  unsigned long inode, struct sock_query *);
 	int family;
 	int proto;
 } protocols[] = {
@@ -494,6 +656,42 @@ get_family_by_proto(enum sock_proto proto)
 	return AF_UNSPEC;
 }
 
+static const char *
+get_by_proto(struct tcb *tcp, const int fd, const enum sock_proto proto,
+	     const unsigned long inode)
+{
+	struct sock_query query = {
+		.proto_name = protocols[proto].name,
+		.protocol = protocols[proto].proto,
+		.proto = proto
+	};
+
+	return protocols[proto].get(tcp, fd, protocols[proto].family,
+				    inode, &query);
+}
+
+/*
+ * Dump the table of sockets of the given protocol, or of all protocols,
+ * into the cache, replacing the details cached for them before.
+ */
+static void
+dump_sockets(struct tcb *tcp, const enum sock_proto proto)
+{
+	cache_remove_proto(proto);
+
+	for (unsigned int i = (unsigned int) SOCK_PROTO_UNKNOWN + 1;
+	     i < ARRAY_SIZE(protocols); ++i) {
+		if (!protocols[i].get ||
+		    (proto != SOCK_PROTO_UNKNOWN && proto != i))
+			continue;
+
+		const int fd = get_diag_fd();
+		if (fd < 0)
+			break;
+		get_by_proto(tcp, fd, i, 0);
+	}
+}
+
 static const char *
 get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 			       const enum sock_proto proto)
@@ -502,46 +700,86 @@ get_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 	    (proto != SOCK_PROTO_UNKNOWN && !protocols[proto].get))
 		return NULL;
 
-	const int fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_SOCK_DIAG);
-	if (fd < 0)
-		return NULL;
 	const char *details = NULL;
 
-	if (proto != SOCK_PROTO_UNKNOWN) {
-		details = protocols[proto].get(tcp, fd, protocols[proto].family,
-					       protocols[proto].proto, inode,
-					       protocols[proto].name);
+	if (socket_diag_dump) {
+		/*
+		 * Dump all socket tables the first time,
+		 * and refresh the table of the socket protocol on a miss.
+		 */
+		dump_sockets(tcp, diag_dumped_all ? proto : SOCK_PROTO_UNKNOWN);
+		diag_dumped_all = true;
+		details = get_sockaddr_by_inode_cached(inode);
+		/*
+		 * A socket of a protocol the tables are not dumped for
+		 * is not going to be found, remember that until it is
+		 * closed instead of dumping all tables on every lookup.
+		 * A socket of a known protocol may be found later,
+		 * e.g. a netlink socket after bind.
+		 */
+		if (!details && proto == SOCK_PROTO_UNKNOWN &&
+		    !cache_lookup(inode))
+			cache_inode_details(inode, NULL, NULL, proto);
+	} else if (proto != SOCK_PROTO_UNKNOWN) {
+		const int fd = get_diag_fd();
+		if (fd < 0)
+			return NULL;
+		details = get_by_proto(tcp, fd, proto, inode);
 	} else {
 		unsigned int i;
 		for (i = (unsigned int) SOCK_PROTO_UNKNOWN + 1;
 		     i < ARRAY_SIZE(protocols); ++i) {
 			if (!protocols[i].get)
 				continue;
-			details = protocols[i].get(tcp, fd,
-						   protocols[proto].family,
-						   protocols[proto].proto,
-						   inode,
-						   protocols[proto].name);
+			const int fd = get_diag_fd();
+			if (fd < 0)
+				break;
+			details = get_by_proto(tcp, fd, i, inode);
 			if (details)
 				break;
 		}
 	}
 
-	close(fd);
 	return details;
 }
 
-static bool
-print_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
-				 const enum sock_proto proto)
+/* Given an inode number of a socket, return its protocol details.  */
+const char *
+get_sockaddr_by_inode(struct tcb *const tcp, const int fd,
+		      const unsigned long inode)
 {
-	const char *details = get_sockaddr_by_inode_uncached(tcp, inode, proto);
+	const cache_entry *const e = cache_lookup(inode);
+	return e ? e->details :
+		get_sockaddr_by_inode_uncached(tcp, inode, getfdproto(tcp, fd));
+}
+
+/* Given a descriptor of an inet socket, return the addresses of the socket.  */
+const struct inet_sock_addrs *
+get_inet_sock_addrs(struct tcb *const tcp, const int fd)
+{
+	const unsigned long inode = getfdinode(tcp, fd);
+
+	if (!inode || !get_sockaddr_by_inode(tcp, fd, inode))
+		return NULL;
+
+	const cache_entry *const e = cache_lookup(inode);
+	return e ? e->inet : NULL;
+}
+
+/* Given an inode number of a socket, print out its protocol details.  */
+bool
+print_sockaddr_by_inode(struct tcb *const tcp, const int fd,
+			const unsigned long inode)
+{
+	const char *const details = get_sockaddr_by_inode(tcp, fd, inode);
 
 	if (details) {
 		tprints(details);
 		return true;
 	}
 
+	const enum sock_proto proto = getfdproto(tcp, fd);
+
 	if ((unsigned int) proto < ARRAY_SIZE(protocols) &&
 	    protocols[proto].name) {
 		tprintf("%s:[%lu]", protocols[proto].name, inode);
@@ -551,26 +789,6 @@ print_sockaddr_by_inode_uncached(struct tcb *tcp, const unsigned long inode,
 	return false;
 }
 
-/* Given an inode number of a socket, return its protocol details.  */
-const char *
-get_sockaddr_by_inode(struct tcb *const tcp, const int fd,
-		      const unsigned long inode)
-{
-	const char *details = get_sockaddr_by_inode_cached(inode);
-	return details ? details :
-		get_sockaddr_by_inode_uncached(tcp, inode, getfdproto(tcp, fd));
-}
-
-/* Given an inode number of a socket, print out its protocol details.  */
-bool
-print_sockaddr_by_inode(struct tcb *const tcp, const int fd,
-			const unsigned long inode)
-{
-	return print_sockaddr_by_inode_cached(inode) ? true :
-		print_sockaddr_by_inode_uncached(tcp, inode,
-						 getfdproto(tcp, fd));
-}
-
 /*
  * Managing the cache for decoding communications of Netlink GENERIC protocol
  *
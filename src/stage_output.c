@@ -14,6 +14,7 @@
  */
 
 #include "defs.h"
+#include "number_set.h"
 
 struct staged_output_data {
 	char *memfptr;
@@ -21,6 +22,17 @@ struct staged_output_data {
 	FILE *real_outf;	/* Backup for real outf while staging */
 };
 
+/*
+ * Returns true if the output of syscalls has to be staged
+ * because the decision whether to print it is made on exiting.
+ */
+bool
+is_output_staged(void)
+{
+	return !is_complete_set(status_set, NUMBER_OF_STATUSES)
+	       || ts_nz(&latency_threshold);
+}
+
 FILE *
 strace_open_memstream(struct tcb *tcp)
 {
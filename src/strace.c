@@ -31,6 +31,7 @@
 #include "kill_save_errno.h"
 #include "filter_seccomp.h"
 #include "largefile_wrappers.h"
+#include "fd_cache.h"
 #include "mmap_cache.h"
 #include "number_set.h"
 #include "ptrace_syscall_info.h"
@@ -50,6 +51,31 @@ extern char *optarg;
 #ifdef ENABLE_STACKTRACE
 /* if this is true do the stack trace for every system call */
 bool stack_trace_enabled;
+bool stack_trace_deferred;
+bool stack_summary_enabled;
+static const char *stack_summary_file;
+static FILE *stack_summary_fp;
+static bool stack_summary_by_time;
+
+enum {
+	STACK_TRACE_SYMBOLIZE_IMMEDIATE,
+	STACK_TRACE_SYMBOLIZE_DEFERRED,
+	STACK_TRACE_SYMBOLIZE_INVALID,
+};
+static const struct xlat_data stack_trace_symbolize_str[] = {
+	{ STACK_TRACE_SYMBOLIZE_IMMEDIATE,	"immediate" },
+	{ STACK_TRACE_SYMBOLIZE_DEFERRED,	"deferred" },
+};
+
+enum {
+	STACK_SUMMARY_WEIGHT_CALLS,
+	STACK_SUMMARY_WEIGHT_TIME,
+	STACK_SUMMARY_WEIGHT_INVALID,
+};
+static const struct xlat_data stack_summary_weight_str[] = {
+	{ STACK_SUMMARY_WEIGHT_CALLS,	"calls" },
+	{ STACK_SUMMARY_WEIGHT_TIME,	"time" },
+};
 #endif
 
 #define my_tkill(tid, sig) syscall(__NR_tkill, (tid), (sig))
@@ -79,6 +105,7 @@ bool debug_flag;
 bool Tflag;
 int Tflag_scale = 1000;
 int Tflag_width = 6;
+bool entry_only;
 bool iflag;
 bool nflag;
 bool count_wallclock;
@@ -136,6 +163,13 @@ static int post_attach_sigstop = TCB_IGNORE_ONE_SIGSTOP;
 #define use_seize (post_attach_sigstop == 0)
 
 unsigned int pidns_translation;
+bool socket_diag_dump;
+bool trace_path_inode;
+bool io_summary_enabled;
+struct timespec latency_threshold;
+unsigned int flight_recorder_size;
+unsigned int max_output_files;
+bool trace_event_output;
 
 static bool detach_on_execve;
 
@@ -158,6 +192,9 @@ static const char *outfname;
 /* If -ff, points to stderr. Else, it's our common output log */
 static FILE *shared_log;
 static bool open_append;
+/* The output of --process-profile option. */
+static const char *process_profile_file;
+static FILE *process_profile_fp;
 
 struct tcb *printing_tcp;
 static struct tcb *current_tcp;
@@ -186,11 +223,14 @@ unsigned os_release; /* generated from uname()'s u.release */
 static void detach(struct tcb *tcp);
 static void cleanup(int sig);
 static void interrupt(int sig);
+static void flight_recorder_sighandler(int sig);
 
 #ifdef HAVE_SIG_ATOMIC_T
 static volatile sig_atomic_t interrupted, restart_failed;
+static volatile sig_atomic_t flight_recorder_dump_requested;
 #else
 static volatile int interrupted, restart_failed;
+static volatile int flight_recorder_dump_requested;
 #endif
 
 static sigset_t timer_set;
@@ -278,6 +318,7 @@ Usage: strace [-ACdffhi" K_OPT "qqrtttTvVwxxyyzZ] [-I N] [-b execve] [-e EXPR]..
    or: strace -c[dfwzZ] [-I N] [-b execve] [-e EXPR]... [-O OVERHEAD]\n\
               [-S SORTBY] [-P PATH]... [-p PID]... [-U COLUMNS] [--seccomp-bpf]\n\
               { -p PID | [-DDD] [-E VAR=VAL]... [-u USERNAME] PROG [ARGS] }\n\
+   or: strace --merge-logs PREFIX\n\
 \n\
 General:\n\
   -e EXPR        a qualifying expression: OPTION=[!]all or OPTION=[!]VAL1[,VAL2]...\n\
@@ -328,11 +369,16 @@ Filtering:\n\
                  print only system calls with the return statuses in SET\n\
      statuses:   successful, failed, unfinished, unavailable, detached\n\
   -P PATH, --trace-path=PATH\n\
-                 trace accesses to PATH\n\
+                 trace accesses to PATH, to anything under PATH if it ends\n\
+                 with '/', or to paths matching PATH if it is a glob pattern\n\
+  --trace-path-inode\n\
+                 match -P files by device and inode numbers as well\n\
   -z, --successful-only\n\
                  print only syscalls that returned without an error code\n\
   -Z, --failed-only\n\
                  print only syscalls that returned with an error code\n\
+  --latency-threshold=DURATION\n\
+                 print only syscalls that took longer than DURATION\n\
 \n\
 Output format:\n\
   -a COLUMN, --columns=COLUMN\n\
@@ -347,6 +393,12 @@ Output format:\n\
                  dump the data read from the file descriptors in SET\n\
   -e write=SET, --write=SET\n\
                  dump the data written to the file descriptors in SET\n\
+  --dump-dir=DIR\n\
+                 write the data dumped by -e read and -e write to files\n\
+                 in DIR, one per descriptor, instead of printing it\n\
+  --pcap=FILE\n\
+                 write the data dumped by -e read and -e write to TCP\n\
+                 and UDP sockets to FILE in pcap format\n\
   -e quiet=SET, --quiet=SET\n\
                  suppress various informational messages\n\
      messages:   attach, exit, path-resolution, personality, thread-execve\n\
@@ -365,6 +417,18 @@ Output format:\n\
 "\
   -k, --stack-traces\n\
                  obtain stack trace between each syscall\n\
+  --stack-trace-symbolize={immediate|deferred}\n\
+                 look up stack trace symbols while the tracee is stopped\n\
+                 (immediate), or after it is resumed (deferred)\n\
+  --stack-summary=FILE\n\
+                 write the number of calls of each syscall by stack to FILE\n\
+                 in the collapsed stack format\n\
+  --stack-summary-weight={calls|time}\n\
+                 write the number of calls (default) or the microseconds\n\
+                 spent in syscalls with --stack-summary\n\
+  --stack-unwinder=NAME\n\
+                 unwind stacks using the NAME backend: libdw (DWARF CFI\n\
+                 based), fp (frame pointer based), or libunwind\n\
 "
 #endif
 "\
@@ -376,6 +440,11 @@ Output format:\n\
                  open the file provided in the -o option in append mode\n\
   --output-separately\n\
                  output into separate files (by appending pid to file names)\n\
+  --max-output-files=N\n\
+                 keep at most N output files open with -ff or --dump-dir\n\
+  --output-format=FORMAT\n\
+                 write syscalls and signals in the FORMAT\n\
+     formats:    text (default), trace-event (JSON for Chrome and Perfetto)\n\
   -q, --quiet=attach,personality\n\
                  suppress messages about attaching, detaching, etc.\n\
   -qq, --quiet=attach,personality,exit\n\
@@ -400,6 +469,8 @@ Output format:\n\
   -T, --syscall-times[=PRECISION]\n\
                  print time spent in each syscall\n\
      precision:  one of s, ms, us, ns; default is microseconds\n\
+  --entry-only   print syscalls on entering, without waiting for them\n\
+                 to return; with --seccomp-bpf, skip syscall exit stops\n\
   -v, --no-abbrev\n\
                  verbose mode: print entities unabbreviated\n\
   -x, --strings-in-hex=non-ascii\n\
@@ -414,6 +485,9 @@ Output format:\n\
   -yy, --decode-fds=all\n\
                  print all available information associated with file\n\
                  descriptors in addition to paths\n\
+  --socket-diag-dump\n\
+                 obtain socket details by dumping all sockets at once\n\
+                 rather than querying them one by one\n\
 "
 #ifdef ENABLE_SECONTEXT
 "\
@@ -422,6 +496,12 @@ Output format:\n\
 "
 #endif
 "\
+  --flight-recorder=N\n\
+                 keep the last N lines of each tracee in memory, write them\n\
+                 on a fatal signal, a trigger syscall, or SIGUSR1\n\
+  -e trigger=SET[:error=ERRNO], --trigger=SET[:error=ERRNO]\n\
+                 write the lines kept by --flight-recorder when a syscall\n\
+                 from SET exits (with ERRNO)\n\
 \n\
 Statistics:\n\
   -c, --summary-only\n\
@@ -441,6 +521,21 @@ Statistics:\n\
                  (default time-percent,total-time,avg-time,calls,errors,name)\n\
   -w, --summary-wall-clock\n\
                  summarise syscall latency (default is system time)\n\
+  --io-summary   also summarise calls, bytes transferred, and time of I/O\n\
+                 syscalls for each file\n\
+  --futex-profile\n\
+                 summarise the time spent waiting on futexes and the number\n\
+                 of wakes for each futex address\n\
+  --process-profile=FILE\n\
+                 write the tree of the traced processes with their wall\n\
+                 clock times and resource usage, and its critical path\n\
+                 to FILE\n\
+  --self-stats   summarise the time strace spends waiting for events, in\n\
+                 ptrace requests, reading memory, decoding, and writing\n\
+                 the output\n\
+  --decoder-stats\n\
+                 summarise the calls, time, bytes fetched, and bytes printed\n\
+                 for each syscall decoder and ioctl and netlink subdecoder\n\
 \n\
 Tampering:\n\
   -e inject=SET[:error=ERRNO|:retval=VALUE][:signal=SIG][:syscall=SYSCALL]\n\
@@ -462,6 +557,9 @@ Tampering:\n\
 Miscellaneous:\n\
   -d, --debug    enable debug output to stderr\n\
   -h, --help     print help message\n\
+  --merge-logs PREFIX\n\
+                 merge PREFIX.PID files written with -ff -tt into a single\n\
+                 log sorted by timestamps on stdout\n\
   --seccomp-bpf  enable seccomp-bpf filtering\n\
   -V, --version  print version\n\
 "
@@ -534,9 +632,11 @@ ptrace_restart(const unsigned int op, struct tcb *const tcp, unsigned int sig)
 {
 	int err;
 
+	self_stats_begin(SELF_STATS_PTRACE, op);
 	errno = 0;
 	ptrace(op, tcp->pid, 0L, (unsigned long) sig);
 	err = errno;
+	self_stats_end();
 	if (!err || err == ESRCH)
 		return 0;
 
@@ -611,6 +711,16 @@ strace_fopen(const char *path)
 	return fp;
 }
 
+/* Open an output file with the privileges of the user, see swap_uid. */
+int
+open_output_file(const char *path, int flags)
+{
+	swap_uid();
+	const int fd = open_file(path, flags | O_CLOEXEC, 0666);
+	swap_uid();
+	return fd;
+}
+
 static int popen_pid;
 
 #ifndef _PATH_BSHELL
@@ -683,8 +793,10 @@ tvprintf(const char *const fmt, va_list args)
 		if (n < 0) {
 			/* very unlikely due to vfprintf buffering */
 			outf_perror(current_tcp);
-		} else
+		} else {
 			current_tcp->curcol += n;
+			decoder_stats_printed += n;
+		}
 	}
 }
 
@@ -707,7 +819,10 @@ tprints(const char *str)
 	if (current_tcp) {
 		int n = fputs_unlocked(str, current_tcp->outf);
 		if (n >= 0) {
-			current_tcp->curcol += strlen(str);
+			const size_t len = strlen(str);
+
+			current_tcp->curcol += len;
+			decoder_stats_printed += len;
 			return;
 		}
 		/* very unlikely due to fputs_unlocked buffering */
@@ -739,8 +854,10 @@ tprintf_comment(const char *fmt, ...)
 static void
 flush_tcp_output(const struct tcb *const tcp)
 {
+	self_stats_begin(SELF_STATS_OUTPUT, 0);
 	if (fflush(tcp->outf))
 		outf_perror(tcp);
+	self_stats_end();
 }
 
 void
@@ -749,6 +866,8 @@ line_ended(void)
 	if (current_tcp) {
 		current_tcp->curcol = 0;
 		flush_tcp_output(current_tcp);
+		if (flight_recorder_size)
+			flight_recorder_line_ended(current_tcp);
 	}
 	if (printing_tcp) {
 		printing_tcp->curcol = 0;
@@ -787,6 +906,8 @@ printleader(struct tcb *tcp)
 			 */
 			tprints(" <unfinished ...>\n");
 			printing_tcp->curcol = 0;
+			if (flight_recorder_size)
+				flight_recorder_line_ended(printing_tcp);
 		}
 	}
 
@@ -872,11 +993,19 @@ after_successful_attach(struct tcb *tcp, const unsigned int flags)
 	if (output_separately) {
 		char name[PATH_MAX];
 		xsprintf(name, "%s.%u", outfname, tcp->pid);
+#ifdef HAVE_FOPENCOOKIE
+		tcp->outf = output_pool_fopen(name, open_append);
+#else
 		tcp->outf = strace_fopen(name);
+#endif
 	}
+	if (flight_recorder_size)
+		flight_recorder_tcb_init(tcp);
+
+	pidns_tcb_init(tcp);
 
 #ifdef ENABLE_STACKTRACE
-	if (stack_trace_enabled)
+	if (stack_trace_enabled || stack_summary_enabled)
 		unwind_tcb_init(tcp);
 #endif
 }
@@ -927,6 +1056,8 @@ alloctcb(int pid)
 			nprocs++;
 			debug_msg("new tcb for pid %d, active tcbs:%d",
 				  tcp->pid, nprocs);
+			if (process_profile_enabled)
+				process_profile_start(tcp);
 			return tcp;
 		}
 	}
@@ -984,8 +1115,10 @@ droptcb(struct tcb *tcp)
 
 	free_tcb_priv_data(tcp);
 
+	pidns_tcb_fin(tcp);
+
 #ifdef ENABLE_STACKTRACE
-	if (stack_trace_enabled)
+	if (stack_trace_enabled || stack_summary_enabled)
 		unwind_tcb_fin(tcp);
 #endif
 
@@ -995,26 +1128,30 @@ droptcb(struct tcb *tcp)
 
 	if (tcp->mmap_cache)
 		tcp->mmap_cache->free_fn(tcp, __func__);
+	fd_cache_tcb_fin(tcp);
 
 	nprocs--;
 	debug_msg("dropped tcb for pid %d, %d remain", tcp->pid, nprocs);
 
 	if (tcp->outf) {
 		bool publish = true;
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+		if (is_output_staged()) {
 			publish = is_number_in_set(STATUS_DETACHED, status_set);
 			strace_close_memstream(tcp, publish);
 		}
 
-		if (output_separately) {
-			if (tcp->curcol != 0 && publish)
-				fprintf(tcp->outf, " <detached ...>\n");
+		if (tcp->curcol != 0 && publish &&
+		    (output_separately || printing_tcp == tcp)) {
+			fprintf(tcp->outf, " <detached ...>\n");
+			if (flight_recorder_size)
+				flight_recorder_line_ended(tcp);
+		}
+		flight_recorder_tcb_fin(tcp);
+
+		if (output_separately)
 			fclose(tcp->outf);
-		} else {
-			if (printing_tcp == tcp && tcp->curcol != 0 && publish)
-				fprintf(tcp->outf, " <detached ...>\n");
+		else
 			flush_tcp_output(tcp);
-		}
 	}
 
 	if (current_tcp == tcp)
@@ -2006,6 +2143,10 @@ init(int argc, char *argv[])
 	int tflag_short = 0;
 	bool columns_set = false;
 	bool sortby_set = false;
+	const char *merge_logs_prefix = NULL;
+#ifdef ENABLE_STACKTRACE
+	bool stack_unwinder_set = false;
+#endif
 
 	/*
 	 * We can initialise global_path_set only after tracing backend
@@ -2068,9 +2209,30 @@ init(int argc, char *argv[])
 		GETOPT_OUTPUT_SEPARATELY,
 		GETOPT_TS,
 		GETOPT_PIDNS_TRANSLATION,
+		GETOPT_SOCKET_DIAG_DUMP,
+		GETOPT_TRACE_PATH_INODE,
+		GETOPT_IO_SUMMARY,
+		GETOPT_LATENCY_THRESHOLD,
+		GETOPT_FLIGHT_RECORDER,
+		GETOPT_OUTPUT_FORMAT,
+		GETOPT_MERGE_LOGS,
+		GETOPT_MAX_OUTPUT_FILES,
+		GETOPT_DUMP_DIR,
+		GETOPT_PCAP,
+		GETOPT_PROCESS_PROFILE,
+		GETOPT_FUTEX_PROFILE,
+		GETOPT_ENTRY_ONLY,
+		GETOPT_SELF_STATS,
+		GETOPT_DECODER_STATS,
 #ifdef ENABLE_SECONTEXT
 		GETOPT_SECONTEXT,
 #endif
+#ifdef ENABLE_STACKTRACE
+		GETOPT_STACK_TRACE_SYMBOLIZE,
+		GETOPT_STACK_SUMMARY,
+		GETOPT_STACK_SUMMARY_WEIGHT,
+		GETOPT_STACK_UNWINDER,
+#endif
 
 		GETOPT_QUAL_TRACE,
 		GETOPT_QUAL_ABBREV,
@@ -2085,6 +2247,7 @@ init(int argc, char *argv[])
 		GETOPT_QUAL_KVM,
 		GETOPT_QUAL_QUIET,
 		GETOPT_QUAL_DECODE_FD,
+		GETOPT_QUAL_TRIGGER,
 	};
 	static const struct option longopts[] = {
 		{ "columns",		required_argument, 0, 'a' },
@@ -2104,11 +2267,30 @@ init(int argc, char *argv[])
 		{ "instruction-pointer", no_argument,      0, 'i' },
 		{ "interruptible",	required_argument, 0, 'I' },
 		{ "stack-traces",	no_argument,	   0, 'k' },
+#ifdef ENABLE_STACKTRACE
+		{ "stack-trace-symbolize", required_argument, 0,
+			GETOPT_STACK_TRACE_SYMBOLIZE },
+		{ "stack-summary",	required_argument, 0, GETOPT_STACK_SUMMARY },
+		{ "stack-summary-weight", required_argument, 0,
+			GETOPT_STACK_SUMMARY_WEIGHT },
+		{ "stack-unwinder",	required_argument, 0, GETOPT_STACK_UNWINDER },
+#endif
 		{ "syscall-number",	no_argument,	   0, 'n' },
 		{ "output",		required_argument, 0, 'o' },
+		{ "output-format",	required_argument, 0, GETOPT_OUTPUT_FORMAT },
+		{ "merge-logs",		required_argument, 0, GETOPT_MERGE_LOGS },
+		{ "max-output-files",	required_argument, 0, GETOPT_MAX_OUTPUT_FILES },
+		{ "dump-dir",		required_argument, 0, GETOPT_DUMP_DIR },
+		{ "pcap",		required_argument, 0, GETOPT_PCAP },
+		{ "process-profile",	required_argument, 0, GETOPT_PROCESS_PROFILE },
+		{ "futex-profile",	no_argument,	   0, GETOPT_FUTEX_PROFILE },
+		{ "entry-only",		no_argument,	   0, GETOPT_ENTRY_ONLY },
+		{ "self-stats",		no_argument,	   0, GETOPT_SELF_STATS },
+		{ "decoder-stats",	no_argument,	   0, GETOPT_DECODER_STATS },
 		{ "summary-syscall-overhead", required_argument, 0, 'O' },
 		{ "attach",		required_argument, 0, 'p' },
 		{ "trace-path",		required_argument, 0, 'P' },
+		{ "trace-path-inode",	no_argument,	   0, GETOPT_TRACE_PATH_INODE },
 		{ "relative-timestamps", optional_argument, 0, 'r' },
 		{ "string-limit",	required_argument, 0, 's' },
 		{ "summary-sort-by",	required_argument, 0, 'S' },
@@ -2120,12 +2302,16 @@ init(int argc, char *argv[])
 		{ "no-abbrev",		no_argument,	   0, 'v' },
 		{ "version",		no_argument,	   0, 'V' },
 		{ "summary-wall-clock", no_argument,	   0, 'w' },
+		{ "io-summary",		no_argument,	   0, GETOPT_IO_SUMMARY },
 		{ "strings-in-hex",	optional_argument, 0, GETOPT_HEX_STR },
 		{ "const-print-style",	required_argument, 0, 'X' },
 		{ "pidns-translation",	no_argument      , 0, GETOPT_PIDNS_TRANSLATION },
+		{ "socket-diag-dump",	no_argument,	   0, GETOPT_SOCKET_DIAG_DUMP },
 		{ "successful-only",	no_argument,	   0, 'z' },
 		{ "failed-only",	no_argument,	   0, 'Z' },
 		{ "failing-only",	no_argument,	   0, 'Z' },
+		{ "latency-threshold",	required_argument, 0, GETOPT_LATENCY_THRESHOLD },
+		{ "flight-recorder",	required_argument, 0, GETOPT_FLIGHT_RECORDER },
 		{ "seccomp-bpf",	no_argument,	   0, GETOPT_SECCOMP },
 #ifdef ENABLE_SECONTEXT
 		{ "secontext",		optional_argument, 0, GETOPT_SECONTEXT },
@@ -2146,6 +2332,7 @@ init(int argc, char *argv[])
 		{ "silent",	optional_argument, 0, GETOPT_QUAL_QUIET },
 		{ "silence",	optional_argument, 0, GETOPT_QUAL_QUIET },
 		{ "decode-fds",	optional_argument, 0, GETOPT_QUAL_DECODE_FD },
+		{ "trigger",	required_argument, 0, GETOPT_QUAL_TRIGGER },
 
 		{ 0, 0, 0, 0 }
 	};
@@ -2245,6 +2432,45 @@ init(int argc, char *argv[])
 					  "build of strace");
 #endif
 			break;
+#ifdef ENABLE_STACKTRACE
+		case GETOPT_STACK_TRACE_SYMBOLIZE:
+			switch (find_arg_val(optarg, stack_trace_symbolize_str,
+					     STACK_TRACE_SYMBOLIZE_INVALID,
+					     STACK_TRACE_SYMBOLIZE_INVALID)) {
+			case STACK_TRACE_SYMBOLIZE_IMMEDIATE:
+				stack_trace_deferred = false;
+				break;
+			case STACK_TRACE_SYMBOLIZE_DEFERRED:
+				stack_trace_deferred = true;
+				break;
+			default:
+				error_opt_arg(c, lopt, optarg);
+			}
+			break;
+		case GETOPT_STACK_SUMMARY:
+			stack_summary_enabled = true;
+			stack_summary_file = optarg;
+			break;
+		case GETOPT_STACK_SUMMARY_WEIGHT:
+			switch (find_arg_val(optarg, stack_summary_weight_str,
+					     STACK_SUMMARY_WEIGHT_INVALID,
+					     STACK_SUMMARY_WEIGHT_INVALID)) {
+			case STACK_SUMMARY_WEIGHT_CALLS:
+				stack_summary_by_time = false;
+				break;
+			case STACK_SUMMARY_WEIGHT_TIME:
+				stack_summary_by_time = true;
+				break;
+			default:
+				error_opt_arg(c, lopt, optarg);
+			}
+			break;
+		case GETOPT_STACK_UNWINDER:
+			if (!unwind_select_unwinder(optarg))
+				error_opt_arg(c, lopt, optarg);
+			stack_unwinder_set = true;
+			break;
+#endif
 		case 'n':
 			nflag = 1;
 			break;
@@ -2345,6 +2571,64 @@ init(int argc, char *argv[])
 		case GETOPT_PIDNS_TRANSLATION:
 			pidns_translation++;
 			break;
+		case GETOPT_SOCKET_DIAG_DUMP:
+			socket_diag_dump = true;
+			break;
+		case GETOPT_TRACE_PATH_INODE:
+			trace_path_inode = true;
+			break;
+		case GETOPT_IO_SUMMARY:
+			io_summary_enabled = true;
+			break;
+		case GETOPT_LATENCY_THRESHOLD:
+			if (parse_ts(optarg, &latency_threshold) < 0)
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_OUTPUT_FORMAT:
+			if (!strcmp(optarg, "trace-event"))
+				trace_event_output = true;
+			else if (!strcmp(optarg, "text"))
+				trace_event_output = false;
+			else
+				error_opt_arg(c, lopt, optarg);
+			break;
+		case GETOPT_MERGE_LOGS:
+			merge_logs_prefix = optarg;
+			break;
+		case GETOPT_MAX_OUTPUT_FILES:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_opt_arg(c, lopt, optarg);
+			max_output_files = i;
+			break;
+		case GETOPT_DUMP_DIR:
+			dump_dir = optarg;
+			break;
+		case GETOPT_PCAP:
+			pcap_file = optarg;
+			break;
+		case GETOPT_PROCESS_PROFILE:
+			process_profile_enabled = true;
+			process_profile_file = optarg;
+			break;
+		case GETOPT_FUTEX_PROFILE:
+			futex_profile_enabled = true;
+			break;
+		case GETOPT_ENTRY_ONLY:
+			entry_only = true;
+			break;
+		case GETOPT_SELF_STATS:
+			self_stats_enabled = true;
+			break;
+		case GETOPT_DECODER_STATS:
+			decoder_stats_enabled = true;
+			break;
+		case GETOPT_FLIGHT_RECORDER:
+			i = string_to_uint(optarg);
+			if (i <= 0)
+				error_opt_arg(c, lopt, optarg);
+			flight_recorder_size = i;
+			break;
 		case 'z':
 			clear_number_set_array(status_set, 1);
 			add_number_to_set(STATUS_SUCCESSFUL, status_set);
@@ -2408,6 +2692,9 @@ init(int argc, char *argv[])
 		case GETOPT_QUAL_DECODE_FD:
 			qualify_decode_fd(optarg ?: yflag_qual);
 			break;
+		case GETOPT_QUAL_TRIGGER:
+			qualify_trigger(optarg);
+			break;
 		default:
 			error_msg_and_help(NULL);
 			break;
@@ -2417,6 +2704,13 @@ init(int argc, char *argv[])
 	argv += optind;
 	argc -= optind;
 
+	if (merge_logs_prefix) {
+		if (argc || nprocs)
+			error_msg_and_help("--merge-logs cannot be used with"
+					   " PROG [ARGS] or -p PID");
+		exit(merge_logs(merge_logs_prefix));
+	}
+
 	if (argc < 0 || (!nprocs && !argc)) {
 		error_msg_and_help("must have PROG [ARGS] or -p PID");
 	}
@@ -2468,6 +2762,15 @@ init(int argc, char *argv[])
 		qualify_decode_fd(yflag_short == 1 ? yflag_qual : yyflag_qual);
 	}
 
+	if (trace_path_inode && !pathtrace_count)
+		error_msg("--trace-path-inode has no effect without"
+			  " -P/--trace-path");
+
+	if (socket_diag_dump &&
+	    !is_number_in_set(DECODE_FD_SOCKET, decode_fd_set))
+		error_msg("--socket-diag-dump has no effect without"
+			  " -yy/--decode-fds=socket");
+
 	if (seccomp_filtering && detach_on_execve) {
 		error_msg("--seccomp-bpf is not enabled because"
 			  " it is not compatible with -b");
@@ -2529,6 +2832,59 @@ init(int argc, char *argv[])
 			  " (-c/--summary-only or -C/--summary)");
 	}
 
+	if (io_summary_enabled && !cflag) {
+		error_msg("--io-summary has no effect without"
+			  " (-c/--summary-only or -C/--summary)");
+		io_summary_enabled = false;
+	}
+
+	if (trace_event_output && cflag)
+		error_msg_and_help("--output-format=trace-event and"
+				   " -c/--summary-only or -C/--summary"
+				   " are mutually exclusive");
+
+	if (entry_only) {
+		if (!text_output_enabled())
+			error_msg_and_help("--entry-only and"
+					   " (-c/--summary-only or"
+					   " --output-format=trace-event)"
+					   " are mutually exclusive");
+		if (Tflag)
+			error_msg_and_help("--entry-only and -T/--syscall-times"
+					   " are mutually exclusive");
+		if (is_output_staged())
+			error_msg_and_help("--entry-only and (-z, -Z, -e status,"
+					   " or --latency-threshold)"
+					   " are mutually exclusive");
+		/* The data is dumped on exiting. */
+		if (!number_set_array_is_empty(read_set, 0) ||
+		    !number_set_array_is_empty(write_set, 0) ||
+		    dump_dir || pcap_file)
+			error_msg_and_help("--entry-only and (-e read, -e write,"
+					   " --dump-dir, or --pcap)"
+					   " are mutually exclusive");
+	}
+
+	if (flight_recorder_size && !text_output_enabled()) {
+		error_msg("--flight-recorder has no effect with"
+			  " -c/--summary-only or --output-format=trace-event");
+		flight_recorder_size = 0;
+	}
+
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_deferred && !stack_trace_enabled) {
+		error_msg("--stack-trace-symbolize has no effect without"
+			  " -k/--stack-traces");
+		stack_trace_deferred = false;
+	}
+	if (stack_summary_by_time && !stack_summary_enabled)
+		error_msg("--stack-summary-weight has no effect without"
+			  " --stack-summary");
+	if (stack_unwinder_set && !stack_trace_enabled && !stack_summary_enabled)
+		error_msg("--stack-unwinder has no effect without"
+			  " -k/--stack-traces or --stack-summary");
+#endif
+
 	if (cflag == CFLAG_ONLY_STATS) {
 		if (iflag)
 			error_msg("-i/--instruction-pointer has no effect "
@@ -2556,6 +2912,9 @@ init(int argc, char *argv[])
 			error_msg("--secontext has no effect with "
 				  "-c/--summary-only");
 #endif
+		if (decoder_stats_enabled)
+			error_msg("--decoder-stats has no effect with "
+				  "-c/--summary-only");
 	}
 
 	if (!outfname) {
@@ -2568,8 +2927,12 @@ init(int argc, char *argv[])
 	}
 
 #ifndef HAVE_OPEN_MEMSTREAM
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
-		error_msg_and_help("open_memstream is required to use -z, -Z, or -e status");
+	if (is_output_staged())
+		error_msg_and_help("open_memstream is required to use -z, -Z,"
+				   " -e status, or --latency-threshold");
+	if (flight_recorder_size)
+		error_msg_and_help("open_memstream is required to use"
+				   " --flight-recorder");
 #endif
 
 	if (zflags > 1)
@@ -2582,6 +2945,11 @@ init(int argc, char *argv[])
 		pathtrace_select(pathtrace_paths[cnt]);
 	free(pathtrace_paths);
 
+	if (tracing_paths || !number_set_array_is_empty(decode_fd_set, 0) ||
+	    io_summary_enabled)
+		fd_cache_enable();
+	io_uring_ring_init();
+
 	acolumn_spaces = xmalloc(acolumn + 1);
 	memset(acolumn_spaces, ' ', acolumn);
 	acolumn_spaces[acolumn] = '\0';
@@ -2589,9 +2957,15 @@ init(int argc, char *argv[])
 	set_sighandler(SIGCHLD, SIG_DFL, &params_for_tracee.child_sa);
 
 #ifdef ENABLE_STACKTRACE
-	if (stack_trace_enabled)
+	if (stack_trace_enabled || stack_summary_enabled)
 		unwind_init();
+	if (stack_summary_enabled)
+		stack_summary_fp = strace_fopen(stack_summary_file);
 #endif
+	if (process_profile_enabled)
+		process_profile_fp = strace_fopen(process_profile_file);
+	if (self_stats_enabled)
+		self_stats_start();
 
 	/* See if they want to run as another user. */
 	if (username != NULL) {
@@ -2663,10 +3037,30 @@ init(int argc, char *argv[])
 		output_separately = false;
 	}
 
+	if (output_separately) {
+#ifdef HAVE_FOPENCOOKIE
+		output_pool_init();
+#endif
+	} else if (max_output_files && !dump_dir) {
+		error_msg("--max-output-files has no effect without "
+			  "-ff/--output-separately or --dump-dir");
+	}
+
+	if (dump_dir || pcap_file)
+		payload_capture_init();
+
 	if (!outfname || outfname[0] == '|' || outfname[0] == '!') {
 		setvbuf(shared_log, NULL, _IOLBF, 0);
 	}
 
+	if (trace_event_output) {
+		if (output_separately)
+			error_msg_and_help("--output-format=trace-event and "
+					   "-ff/--output-separately "
+					   "are mutually exclusive");
+		trace_event_init(shared_log);
+	}
+
 	/*
 	 * argv[0]	-pPID	-oFILE	Default interactive setting
 	 * yes		*	0	INTR_WHILE_WAIT
@@ -2736,6 +3130,9 @@ init(int argc, char *argv[])
 		set_sighandler(SIGTERM, interactive ? interrupt : SIG_IGN, NULL);
 	}
 
+	if (flight_recorder_size)
+		set_sighandler(SIGUSR1, flight_recorder_sighandler, NULL);
+
 	sigemptyset(&timer_set);
 	sigaddset(&timer_set, SIGALRM);
 	sigprocmask(SIG_BLOCK, &timer_set, NULL);
@@ -2806,6 +3203,12 @@ interrupt(int sig)
 	interrupted = sig;
 }
 
+static void
+flight_recorder_sighandler(int sig)
+{
+	flight_recorder_dump_requested = 1;
+}
+
 static void
 print_debug_info(const int pid, int status)
 {
@@ -2938,6 +3341,12 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 		execve_thread->staged_output_data = tcp->staged_output_data;
 		tcp->staged_output_data = staged_output_data;
 	}
+	if (flight_recorder_size) {
+		struct flight_recorder *fr = execve_thread->flight_recorder;
+
+		execve_thread->flight_recorder = tcp->flight_recorder;
+		tcp->flight_recorder = fr;
+	}
 
 	/* And their column positions */
 	execve_thread->curcol = tcp->curcol;
@@ -2947,7 +3356,7 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 	/* Switch to the thread, reusing leader's outfile and pid */
 	tcp = execve_thread;
 	tcp->pid = pid;
-	if (cflag != CFLAG_ONLY_STATS) {
+	if (text_output_enabled()) {
 		if (!is_number_in_set(QUIET_THREAD_EXECVE, quiet_set)) {
 			printleader(tcp);
 			tprintf("+++ superseded by execve in pid %lu +++\n",
@@ -2958,7 +3367,7 @@ maybe_switch_tcbs(struct tcb *tcp, const int pid)
 		 * Need to reopen memstream for thread
 		 * as we closed it in droptcb.
 		 */
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
+		if (is_output_staged())
 			strace_open_memstream(tcp);
 		tcp->flags |= TCB_REPRINT;
 	}
@@ -2985,7 +3394,12 @@ print_signalled(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
-	if (cflag != CFLAG_ONLY_STATS
+	if (trace_event_output
+	    && is_number_in_set(WTERMSIG(status), signal_set))
+		trace_event_instant(tcp, sprintsigname(WTERMSIG(status)),
+				    "killed");
+
+	if (text_output_enabled()
 	    && is_number_in_set(WTERMSIG(status), signal_set)) {
 		printleader(tcp);
 		tprintf("+++ killed by %s %s+++\n",
@@ -2993,6 +3407,9 @@ print_signalled(struct tcb *tcp, const int pid, int status)
 			WCOREDUMP(status) ? "(core dumped) " : "");
 		line_ended();
 	}
+
+	if (flight_recorder_size)
+		flight_recorder_dump();
 }
 
 static void
@@ -3003,7 +3420,7 @@ print_exited(struct tcb *tcp, const int pid, int status)
 		strace_child = 0;
 	}
 
-	if (cflag != CFLAG_ONLY_STATS &&
+	if (text_output_enabled() &&
 	    !is_number_in_set(QUIET_EXIT, quiet_set)) {
 		printleader(tcp);
 		tprintf("+++ exited with %d +++\n", WEXITSTATUS(status));
@@ -3014,7 +3431,13 @@ print_exited(struct tcb *tcp, const int pid, int status)
 static void
 print_stopped(struct tcb *tcp, const siginfo_t *si, const unsigned int sig)
 {
-	if (cflag != CFLAG_ONLY_STATS
+	if (trace_event_output
+	    && !hide_log(tcp)
+	    && is_number_in_set(sig, signal_set))
+		trace_event_instant(tcp, sprintsigname(sig),
+				    si ? "signal" : "stop");
+
+	if (text_output_enabled()
 	    && !hide_log(tcp)
 	    && is_number_in_set(sig, signal_set)) {
 		printleader(tcp);
@@ -3063,7 +3486,7 @@ static void
 print_event_exit(struct tcb *tcp)
 {
 	if (entering(tcp) || filtered(tcp) || hide_log(tcp)
-	    || cflag == CFLAG_ONLY_STATS) {
+	    || (tcp->flags & TCB_ENTRY_ONLY) || !text_output_enabled()) {
 		return;
 	}
 
@@ -3090,7 +3513,7 @@ print_event_exit(struct tcb *tcp)
 	tprints(") ");
 	tabto();
 	tprints("= ?\n");
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+	if (is_output_staged()) {
 		bool publish = is_number_in_set(STATUS_UNFINISHED, status_set);
 		strace_close_memstream(tcp, publish);
 	}
@@ -3135,12 +3558,23 @@ tcb_wait_tab_check_size(const size_t size)
 	}
 }
 
+static void
+check_flight_recorder_dump(void)
+{
+	if (flight_recorder_dump_requested) {
+		flight_recorder_dump_requested = 0;
+		flight_recorder_dump();
+	}
+}
+
 static const struct tcb_wait_data *
 next_event(void)
 {
 	if (interrupted)
 		return NULL;
 
+	check_flight_recorder_dump();
+
 	invalidate_umove_cache();
 
 	struct tcb *tcp = NULL;
@@ -3206,8 +3640,16 @@ next_event(void)
 	 */
 	int status;
 	struct rusage ru;
-	int pid = wait4(-1, &status, __WALL, (cflag ? &ru : NULL));
+	/*
+	 * A dump requested after the check above would be delayed
+	 * until the next event otherwise, which may never come.
+	 */
+	check_flight_recorder_dump();
+	self_stats_begin(SELF_STATS_WAIT, 0);
+	int pid = wait4(-1, &status, __WALL,
+			(cflag || process_profile_enabled ? &ru : NULL));
 	int wait_errno = errno;
+	self_stats_end();
 
 	/*
 	 * The window of opportunity to handle expirations
@@ -3275,6 +3717,10 @@ next_event(void)
 			tcp->stime.tv_nsec = ru.ru_stime.tv_usec * 1000;
 		}
 
+		if (process_profile_enabled &&
+		    (WIFEXITED(status) || WIFSIGNALED(status)))
+			process_profile_exit(tcp, status, &ru);
+
 		tcb_wait_tab_check_size(wait_tab_pos);
 
 		/* Initialise a new wait data structure.  */
@@ -3322,8 +3768,11 @@ next_event(void)
 					 * errno == EINVAL too?
 					 * We can get ESRCH instead, you know...
 					 */
+					self_stats_begin(SELF_STATS_PTRACE,
+							 PTRACE_GETSIGINFO);
 					bool stopped = ptrace(PTRACE_GETSIGINFO,
 						pid, 0, &wd->si) < 0;
+					self_stats_end();
 
 					wd->te = stopped ? TE_GROUP_STOP
 							 : TE_SIGNAL_DELIVERY_STOP;
@@ -3351,9 +3800,12 @@ next_event(void)
 					 * errno == EINVAL here, too?
 					 * We can get ESRCH instead, you know...
 					 */
+				self_stats_begin(SELF_STATS_PTRACE,
+						 PTRACE_GETEVENTMSG);
 				if (ptrace(PTRACE_GETEVENTMSG, pid, NULL,
 				    &wd->msg) < 0)
 					wd->msg = 0;
+				self_stats_end();
 
 				wd->te = TE_STOP_BEFORE_EXECVE;
 				break;
@@ -3388,8 +3840,11 @@ next_event(void)
 			break;
 
 next_event_wait_next:
-		pid = wait4(-1, &status, __WALL | WNOHANG, (cflag ? &ru : NULL));
+		self_stats_begin(SELF_STATS_WAIT, 0);
+		pid = wait4(-1, &status, __WALL | WNOHANG,
+			    (cflag || process_profile_enabled ? &ru : NULL));
 		wait_errno = errno;
+		self_stats_end();
 		wait_nohang = true;
 	}
 
@@ -3421,27 +3876,49 @@ next_event_exit:
 }
 
 static int
-trace_syscall(struct tcb *tcp, unsigned int *sig)
+trace_syscall_entering(struct tcb *tcp, unsigned int *sig)
 {
-	if (entering(tcp)) {
-		int res = syscall_entering_decode(tcp);
-		switch (res) {
-		case 0:
-			return 0;
-		case 1:
-			res = syscall_entering_trace(tcp, sig);
-		}
-		syscall_entering_finish(tcp, res);
-		return res;
-	} else {
-		struct timespec ts = {};
-		int res = syscall_exiting_decode(tcp, &ts);
-		if (res != 0) {
-			res = syscall_exiting_trace(tcp, &ts, res);
-		}
+	int res = syscall_entering_decode(tcp);
+	switch (res) {
+	case 0:
+		return 0;
+	case 1:
+		res = syscall_entering_trace(tcp, sig);
+	}
+	syscall_entering_finish(tcp, res);
+	if ((tcp->flags & TCB_ENTRY_ONLY) && has_seccomp_filter(tcp) &&
+	    !syscall_exit_needed(tcp)) {
+		/*
+		 * Nothing is left to do on exiting, so complete
+		 * the syscall now and let the tracee be restarted
+		 * with PTRACE_CONT past its syscall-exit-stop.
+		 */
 		syscall_exiting_finish(tcp);
-		return res;
 	}
+	return res;
+}
+
+static int
+trace_syscall_exiting(struct tcb *tcp)
+{
+	struct timespec ts = {};
+	int res = syscall_exiting_decode(tcp, &ts);
+	if (res != 0) {
+		res = syscall_exiting_trace(tcp, &ts, res);
+	}
+	syscall_exiting_finish(tcp);
+	return res;
+}
+
+static int
+trace_syscall(struct tcb *tcp, unsigned int *sig)
+{
+	self_stats_begin(SELF_STATS_DECODE, 0);
+	const int res = entering(tcp) ? trace_syscall_entering(tcp, sig)
+				      : trace_syscall_exiting(tcp);
+	self_stats_end();
+
+	return res;
 }
 
 /* Returns true iff the main trace loop has to continue. */
@@ -3457,6 +3934,11 @@ dispatch_event(const struct tcb_wait_data *wd)
 	 */
 	int status = wd ? wd->status : 0;
 
+	if (wd && self_stats_enabled)
+		self_stats_event();
+	if (wd)
+		fd_cache_event();
+
 	if (current_tcp && has_seccomp_filter(current_tcp))
 		restart_op = seccomp_filter_restart_operator(current_tcp);
 	else
@@ -3604,6 +4086,12 @@ dispatch_event(const struct tcb_wait_data *wd)
 			}
 		}
 
+		if (trace_event_output && !hide_log(current_tcp))
+			trace_event_instant(current_tcp, "exec", "exec");
+
+		if (process_profile_enabled)
+			process_profile_exec(current_tcp);
+
 		if (detach_on_execve) {
 			if (current_tcp->flags & TCB_SKIP_DETACH_ON_FIRST_EXEC) {
 				current_tcp->flags &= ~TCB_SKIP_DETACH_ON_FIRST_EXEC;
@@ -3631,6 +4119,11 @@ dispatch_event(const struct tcb_wait_data *wd)
 
 		current_tcp->delayed_wait_data = copy_trace_wait_data(wd);
 
+#ifdef ENABLE_STACKTRACE
+		if (stack_trace_deferred)
+			unwind_tcb_flush(current_tcp);
+#endif
+
 		return true;
 	}
 
@@ -3639,6 +4132,13 @@ dispatch_event(const struct tcb_wait_data *wd)
 		exit_code = 1;
 		return false;
 	}
+
+#ifdef ENABLE_STACKTRACE
+	/* Symbolize the stack trace captured during this stop, if deferred. */
+	if (stack_trace_deferred)
+		unwind_tcb_flush(current_tcp);
+#endif
+
 	return true;
 }
 
@@ -3729,8 +4229,34 @@ terminate(void)
 	int sig = interrupted;
 
 	cleanup(sig);
+	if (debug_flag)
+		pidns_print_stats();
 	if (cflag)
 		call_summary(shared_log);
+	if (io_summary_enabled)
+		io_summary(shared_log);
+	if (cflag)
+		io_uring_summary(shared_log);
+	if (futex_profile_enabled)
+		futex_profile(shared_log);
+	if (decoder_stats_enabled)
+		decoder_stats_print(shared_log);
+	if (trace_event_output)
+		trace_event_finish();
+	if (dump_dir || pcap_file)
+		payload_capture_finish();
+	if (process_profile_fp) {
+		process_profile_print(process_profile_fp);
+		fclose(process_profile_fp);
+	}
+#ifdef ENABLE_STACKTRACE
+	if (stack_summary_fp) {
+		unwind_summary_print(stack_summary_fp, stack_summary_by_time);
+		fclose(stack_summary_fp);
+	}
+#endif
+	if (self_stats_enabled)
+		self_stats_print(shared_log);
 	fflush(NULL);
 	if (shared_log != stderr)
 		fclose(shared_log);
@@ -15,6 +15,7 @@
 #include "defs.h"
 #include "get_personality.h"
 #include "mmap_notify.h"
+#include "fd_cache.h"
 #include "native_defs.h"
 #include "ptrace.h"
 #include "ptrace_syscall_info.h"
@@ -285,7 +286,7 @@ update_personality(struct tcb *tcp, unsigned int personality)
 	}
 
 # if defined(ENABLE_STACKTRACE) && !defined(USE_LIBUNWIND)
-	if (stack_trace_enabled) {
+	if (stack_trace_enabled || stack_summary_enabled) {
 		unwind_tcb_fin(tcp);
 		unwind_tcb_init(tcp);
 	}
@@ -373,6 +374,7 @@ dumpio(struct tcb *tcp)
 		return;
 
 	if (is_number_in_set(fd, write_set)) {
+		payload_capture_begin(tcp, fd, true);
 		switch (tcp_sysent(tcp)->sen) {
 		case SEN_write:
 		case SEN_pwrite:
@@ -395,12 +397,14 @@ dumpio(struct tcb *tcp)
 			dumpiov_in_mmsghdr(tcp, tcp->u_arg[1]);
 			break;
 		}
+		payload_capture_end(tcp);
 	}
 
 	if (syserror(tcp))
 		return;
 
 	if (is_number_in_set(fd, read_set)) {
+		payload_capture_begin(tcp, fd, false);
 		switch (tcp_sysent(tcp)->sen) {
 		case SEN_read:
 		case SEN_pread:
@@ -409,22 +413,23 @@ dumpio(struct tcb *tcp)
 		case SEN_mq_timedreceive_time32:
 		case SEN_mq_timedreceive_time64:
 			dumpstr(tcp, tcp->u_arg[1], tcp->u_rval);
-			return;
+			break;
 		case SEN_readv:
 		case SEN_preadv:
 		case SEN_preadv2:
 			dumpiov_upto(tcp, tcp->u_arg[2], tcp->u_arg[1],
 				     tcp->u_rval);
-			return;
+			break;
 		case SEN_recvmsg:
 			dumpiov_in_msghdr(tcp, tcp->u_arg[1], tcp->u_rval);
-			return;
+			break;
 		case SEN_recvmmsg:
 		case SEN_recvmmsg_time32:
 		case SEN_recvmmsg_time64:
 			dumpiov_in_mmsghdr(tcp, tcp->u_arg[1]);
-			return;
+			break;
 		}
+		payload_capture_end(tcp);
 	}
 }
 
@@ -633,6 +638,31 @@ syscall_entering_decode(struct tcb *tcp)
 	return 1;
 }
 
+/*
+ * Ends the line of the syscall on entering with --entry-only option,
+ * the return value is not going to be printed.
+ */
+static void
+print_syscall_entry_only(struct tcb *tcp, int res)
+{
+	if (!raw(tcp) && !(res & RVAL_DECODED)) {
+		/* The decoder would print the rest on exiting. */
+		tprint_more_data_follows();
+	}
+	tprint_arg_end();
+	tprints(" ");
+	tabto();
+	tprints("= ?\n");
+	line_ended();
+
+#ifdef ENABLE_STACKTRACE
+	if (stack_trace_enabled)
+		unwind_tcb_print(tcp);
+#endif
+
+	tcp->flags |= TCB_ENTRY_ONLY;
+}
+
 int
 syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 {
@@ -669,7 +699,15 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	if (inject(tcp))
 		tamper_with_syscall_entering(tcp, sig);
 
-	if (cflag == CFLAG_ONLY_STATS) {
+#ifdef ENABLE_STACKTRACE
+	if (stack_summary_enabled &&
+	    !check_exec_syscall(tcp) &&
+	    tcp_sysent(tcp)->sys_flags & STACKTRACE_CAPTURE_ON_ENTER) {
+		unwind_tcb_summary_capture(tcp);
+	}
+#endif
+
+	if (!text_output_enabled()) {
 		return 0;
 	}
 
@@ -681,16 +719,79 @@ syscall_entering_trace(struct tcb *tcp, unsigned int *sig)
 	}
 #endif
 
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES))
+	if (is_output_staged())
 		strace_open_memstream(tcp);
 
 	printleader(tcp);
 	tprints_arg_begin(tcp_sysent(tcp)->sys_name);
+	decoder_stats_begin(NULL, tcp_sysent(tcp)->sys_name, true);
 	int res = raw(tcp) ? printargs(tcp) : tcp_sysent(tcp)->sys_func(tcp);
+	decoder_stats_end();
+	if (entry_only)
+		print_syscall_entry_only(tcp, res);
+	self_stats_begin(SELF_STATS_OUTPUT, 0);
 	fflush(tcp->outf);
+	self_stats_end();
 	return res;
 }
 
+static bool
+syscall_times_needed(void)
+{
+	return Tflag || cflag || stack_summary_enabled ||
+	       ts_nz(&latency_threshold) || trace_event_output ||
+	       futex_profile_enabled;
+}
+
+/*
+ * The state tracked from the syscalls of tracees, updated on the exit
+ * of every syscall that affects it, including filtered out syscalls.
+ * The second argument of exit specifies whether tcp->u_rval
+ * and tcp->u_error have been fetched.
+ */
+static const struct {
+	bool (*affects)(const struct_sysent *);
+	void (*exit)(struct tcb *, bool has_result);
+} exit_notifiers[] = {
+	{ mmap_notify_syscall_affects, mmap_notify_report },
+	{ fd_cache_syscall_affects, fd_cache_syscall_exit },
+	{ io_uring_syscall_affects, io_uring_syscall_exit },
+	{ payload_capture_syscall_affects, payload_capture_syscall_exit },
+};
+
+static bool
+exit_notify_needed(const struct_sysent *s)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(exit_notifiers); ++i) {
+		if (exit_notifiers[i].affects(s))
+			return true;
+	}
+
+	return false;
+}
+
+static void
+exit_notify(struct tcb *tcp, const bool has_result)
+{
+	const struct_sysent *s = tcp_sysent(tcp);
+
+	for (size_t i = 0; i < ARRAY_SIZE(exit_notifiers); ++i) {
+		if (exit_notifiers[i].affects(s))
+			exit_notifiers[i].exit(tcp, has_result);
+	}
+}
+
+/*
+ * Returns true if the syscall exit has to be handled
+ * even if the syscall has been printed on entering.
+ */
+bool
+syscall_exit_needed(struct tcb *tcp)
+{
+	return syscall_times_needed() || inject(tcp) ||
+	       check_exec_syscall(tcp) || exit_notify_needed(tcp_sysent(tcp));
+}
+
 void
 syscall_entering_finish(struct tcb *tcp, int res)
 {
@@ -698,7 +799,7 @@ syscall_entering_finish(struct tcb *tcp, int res)
 	tcp->sys_func_rval = res;
 
 	/* Measure the entrance time as late as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if (syscall_times_needed() && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, &tcp->etime);
 
 	/* Start tracking system time */
@@ -731,14 +832,14 @@ int
 syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 {
 	/* Measure the exit time as early as possible to avoid errors. */
-	if ((Tflag || cflag) && !filtered(tcp))
+	if (syscall_times_needed() && !filtered(tcp))
 		clock_gettime(CLOCK_MONOTONIC, pts);
 
-	if (tcp_sysent(tcp)->sys_flags & MEMORY_MAPPING_CHANGE)
-		mmap_notify_report(tcp);
-
-	if (filtered(tcp))
+	if (filtered(tcp)) {
+		if (exit_notify_needed(tcp_sysent(tcp)))
+			exit_notify(tcp, get_syscall_result(tcp) > 0);
 		return 0;
+	}
 
 	if (check_exec_syscall(tcp)) {
 		/* The check failed, hide the log.  */
@@ -749,7 +850,11 @@ syscall_exiting_decode(struct tcb *tcp, struct timespec *pts)
 	update_personality(tcp, tcp->currpers);
 #endif
 
-	return get_syscall_result(tcp);
+	int res = get_syscall_result(tcp);
+
+	exit_notify(tcp, res > 0);
+
+	return res;
 }
 
 void
@@ -793,12 +898,22 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	    inject_poke_exit(tcp))
 		tamper_with_syscall_exiting(tcp);
 
-	if (cflag) {
+#ifdef ENABLE_STACKTRACE
+	if (stack_summary_enabled)
+		unwind_tcb_summary_add(tcp, ts);
+#endif
+
+	if (cflag)
 		count_syscall(tcp, ts);
-		if (cflag == CFLAG_ONLY_STATS) {
-			return 0;
-		}
-	}
+
+	if (trace_event_output)
+		trace_event_syscall(tcp, ts, res);
+
+	if (futex_profile_enabled)
+		count_futex_syscall(tcp, ts);
+
+	if (!text_output_enabled() || (tcp->flags & TCB_ENTRY_ONLY))
+		return 0;
 
 	print_syscall_resume(tcp);
 	printing_tcp = tcp;
@@ -810,7 +925,7 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 		tprints(" ");
 		tabto();
 		tprints("= ? <unavailable>\n");
-		if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+		if (is_output_staged()) {
 			bool publish = is_number_in_set(STATUS_UNAVAILABLE,
 							status_set);
 			strace_close_memstream(tcp, publish);
@@ -824,17 +939,27 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	if (raw(tcp)) {
 		/* sys_res = printargs(tcp); - but it's nop on sysexit */
 	} else {
-		if (tcp->sys_func_rval & RVAL_DECODED)
+		if (tcp->sys_func_rval & RVAL_DECODED) {
 			sys_res = tcp->sys_func_rval;
-		else
+		} else {
+			decoder_stats_begin(NULL, tcp_sysent(tcp)->sys_name,
+					    false);
 			sys_res = tcp_sysent(tcp)->sys_func(tcp);
+			decoder_stats_end();
+		}
 	}
 
-	if (!is_complete_set(status_set, NUMBER_OF_STATUSES)) {
+	if (is_output_staged()) {
 		bool publish = syserror(tcp)
 			       && is_number_in_set(STATUS_FAILED, status_set);
 		publish |= !syserror(tcp)
 			   && is_number_in_set(STATUS_SUCCESSFUL, status_set);
+		if (publish && ts_nz(&latency_threshold)) {
+			struct timespec latency;
+
+			ts_sub(&latency, ts, &tcp->etime);
+			publish = ts_cmp(&latency, &latency_threshold) > 0;
+		}
 		strace_close_memstream(tcp, publish);
 		if (!publish) {
 			line_ended();
@@ -1001,12 +1126,19 @@ syscall_exiting_trace(struct tcb *tcp, struct timespec *ts, int res)
 	}
 	tprints("\n");
 	dumpio(tcp);
+	print_io_uring_events(tcp);
 	line_ended();
 
 #ifdef ENABLE_STACKTRACE
 	if (stack_trace_enabled)
 		unwind_tcb_print(tcp);
 #endif
+
+	if (flight_recorder_size && is_flight_recorder_trigger(tcp)) {
+		/* Record the stack trace printed after the line ended. */
+		flight_recorder_line_ended(tcp);
+		flight_recorder_dump();
+	}
 	return 0;
 }
 
@@ -1014,7 +1146,8 @@ void
 syscall_exiting_finish(struct tcb *tcp)
 {
 	tcp->flags &= ~(TCB_INSYSCALL | TCB_TAMPERED | TCB_INJECT_DELAY_EXIT |
-			TCB_INJECT_POKE_EXIT | TCB_TAMPERED_DELAYED | TCB_TAMPERED_POKED);
+			TCB_INJECT_POKE_EXIT | TCB_TAMPERED_DELAYED | TCB_TAMPERED_POKED |
+			TCB_ENTRY_ONLY);
 	tcp->sys_func_rval = 0;
 	free_tcb_priv_data(tcp);
 
@@ -1091,20 +1224,25 @@ ptrace_syscall_info_is_valid(void)
 static long
 ptrace_getregset(pid_t pid)
 {
+	long rc;
+
+	self_stats_begin(SELF_STATS_PTRACE, PTRACE_GETREGSET);
 # ifdef ARCH_IOVEC_FOR_GETREGSET
 	/* variable iovec */
 	ARCH_IOVEC_FOR_GETREGSET.iov_len = sizeof(ARCH_REGS_FOR_GETREGSET);
-	return ptrace(PTRACE_GETREGSET, pid, NT_PRSTATUS,
-		      &ARCH_IOVEC_FOR_GETREGSET);
+	rc = ptrace(PTRACE_GETREGSET, pid, NT_PRSTATUS,
+		    &ARCH_IOVEC_FOR_GETREGSET);
 # else
 	/* constant iovec */
 	static struct iovec io = {
 		.iov_base = &ARCH_REGS_FOR_GETREGSET,
 		.iov_len = sizeof(ARCH_REGS_FOR_GETREGSET)
 	};
-	return ptrace(PTRACE_GETREGSET, pid, NT_PRSTATUS, &io);
-
+	rc = ptrace(PTRACE_GETREGSET, pid, NT_PRSTATUS, &io);
 # endif
+	self_stats_end();
+
+	return rc;
 }
 
 # if ARCH_MIGHT_USE_SET_REGS
@@ -1133,12 +1271,18 @@ ptrace_setregset(pid_t pid)
 static long
 ptrace_getregs(pid_t pid)
 {
+	long rc;
+
+	self_stats_begin(SELF_STATS_PTRACE, PTRACE_GETREGS);
 # if defined SPARC || defined SPARC64
 	/* SPARC systems have the meaning of data and addr reversed */
-	return ptrace(PTRACE_GETREGS, pid, (void *) &ARCH_REGS_FOR_GETREGS, 0);
+	rc = ptrace(PTRACE_GETREGS, pid, (void *) &ARCH_REGS_FOR_GETREGS, 0);
 # else
-	return ptrace(PTRACE_GETREGS, pid, NULL, &ARCH_REGS_FOR_GETREGS);
+	rc = ptrace(PTRACE_GETREGS, pid, NULL, &ARCH_REGS_FOR_GETREGS);
 # endif
+	self_stats_end();
+
+	return rc;
 }
 
 # if ARCH_MIGHT_USE_SET_REGS
@@ -1267,8 +1411,11 @@ strace_get_syscall_info(struct tcb *tcp)
 	 */
 	if (ptrace_sci.op == 0xff) {
 		const size_t size = sizeof(ptrace_sci);
-		if (ptrace(PTRACE_GET_SYSCALL_INFO, tcp->pid,
-			   (void *) size, &ptrace_sci) < 0) {
+		self_stats_begin(SELF_STATS_PTRACE, PTRACE_GET_SYSCALL_INFO);
+		const long rc = ptrace(PTRACE_GET_SYSCALL_INFO, tcp->pid,
+				       (void *) size, &ptrace_sci);
+		self_stats_end();
+		if (rc < 0) {
 			get_regs_error = -2;
 			return false;
 		}
@@ -1352,6 +1499,19 @@ get_stack_pointer(struct tcb *tcp, kernel_ulong_t *sp)
 #endif
 }
 
+bool
+get_frame_pointer(struct tcb *tcp, kernel_ulong_t *fp)
+{
+#if defined ARCH_FP_REG
+	if (get_regs(tcp) < 0)
+		return false;
+	*fp = (kernel_ulong_t) ARCH_FP_REG;
+	return true;
+#else
+	return false;
+#endif
+}
+
 static int
 get_syscall_regs(struct tcb *tcp)
 {
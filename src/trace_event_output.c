@@ -0,0 +1,98 @@
+/*
+ * Output of syscalls and signals as events of the Trace Event Format
+ * understood by Chrome trace viewer and Perfetto.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+
+/* The output is written in large chunks rather than line by line. */
+#define TRACE_EVENT_BUFSIZE	(1024 * 1024)
+
+static FILE *trace_event_fp;
+static bool trace_event_written;
+
+void
+trace_event_init(FILE *fp)
+{
+	trace_event_fp = fp;
+	if (fp != stderr)
+		setvbuf(fp, NULL, _IOFBF, TRACE_EVENT_BUFSIZE);
+	/*
+	 * Events are separated by commas, and the closing bracket is written
+	 * on exit, the viewers accept the array without it if strace dies.
+	 */
+	fputs("[\n", fp);
+}
+
+void
+trace_event_finish(void)
+{
+	fputs("\n]\n", trace_event_fp);
+}
+
+/* Timestamps are in microseconds. */
+static void
+print_us(const char *name, const struct timespec *ts)
+{
+	fprintf(trace_event_fp, ",\"%s\":%lld.%03ld", name,
+		(long long) ts->tv_sec * 1000000 + ts->tv_nsec / 1000,
+		(long) ts->tv_nsec % 1000);
+}
+
+static void
+print_event_begin(struct tcb *tcp, const char *name, const char *cat,
+		  const char ph, const struct timespec *ts)
+{
+	fprintf(trace_event_fp,
+		"%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\""
+		",\"pid\":%d,\"tid\":%d",
+		trace_event_written ? ",\n" : "", name, cat, ph,
+		get_tcb_tgid(tcp), tcp->pid);
+	print_us("ts", ts);
+	trace_event_written = true;
+}
+
+/*
+ * The res argument is the result of fetching the syscall exit state,
+ * the return value is not known unless it is 1.
+ */
+void
+trace_event_syscall(struct tcb *tcp, const struct timespec *ts, const int res)
+{
+	struct timespec dur;
+
+	ts_sub(&dur, ts, &tcp->etime);
+
+	print_event_begin(tcp, tcp_sysent(tcp)->sys_name, "syscall", 'X',
+			  &tcp->etime);
+	print_us("dur", &dur);
+
+	if (res != 1) {
+		fputs(",\"args\":{\"unavailable\":true}}", trace_event_fp);
+	} else if (!syserror(tcp)) {
+		fprintf(trace_event_fp, ",\"args\":{\"retval\":%" PRI_kld "}}",
+			tcp->u_rval);
+	} else if (tcp->u_error < nerrnos && errnoent[tcp->u_error]) {
+		fprintf(trace_event_fp, ",\"args\":{\"error\":\"%s\"}}",
+			errnoent[tcp->u_error]);
+	} else {
+		fprintf(trace_event_fp, ",\"args\":{\"error\":%lu}}",
+			tcp->u_error);
+	}
+}
+
+void
+trace_event_instant(struct tcb *tcp, const char *name, const char *cat)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	print_event_begin(tcp, name, cat, 'i', &ts);
+	fputs(",\"s\":\"t\"}", trace_event_fp);
+}
@@ -74,8 +74,12 @@ process_read_mem(const pid_t pid, void *const laddr,
 		.iov_len = len
 	};
 
+	self_stats_begin(SELF_STATS_VM_READ, 0);
 	const ssize_t rc = process_vm_readv(pid, &local, 1, &remote, 1, 0);
-	if (rc < 0 && errno == ENOSYS)
+	self_stats_end();
+	if (rc > 0)
+		decoder_stats_fetched += rc;
+	else if (rc < 0 && errno == ENOSYS)
 		process_vm_readv_not_supported = true;
 
 	return rc;
@@ -246,11 +250,13 @@ umoven_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 	while (len) {
 		addr &= -sizeof(long);		/* aligned address */
 
+		self_stats_begin(SELF_STATS_PTRACE, PTRACE_PEEKDATA);
 		errno = 0;
 		union {
 			long val;
 			char x[sizeof(long)];
 		} u = { .val = ptrace(PTRACE_PEEKDATA, pid, addr, 0) };
+		self_stats_end();
 
 		switch (errno) {
 			case 0:
@@ -274,6 +280,7 @@ umoven_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 				return -1;
 		}
 
+		decoder_stats_fetched += sizeof(long);
 		unsigned int m = MIN(sizeof(long) - residue, len);
 		memcpy(laddr, &u.x[residue], m);
 		residue = 0;
@@ -328,6 +335,18 @@ umoven(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 	}
 }
 
+unsigned int
+umoven_partial(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
+	       void *const our_addr)
+{
+	if (tracee_addr_is_invalid(addr) || process_vm_readv_not_supported)
+		return 0;
+
+	const ssize_t r = vm_read_mem(tcp->pid, our_addr, addr, len);
+
+	return r > 0 ? r : 0;
+}
+
 /*
  * Like umoven_peekdata but make the additional effort of looking
  * for a terminating zero byte.
@@ -343,11 +362,13 @@ umovestr_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 	while (len) {
 		addr &= -sizeof(long);		/* aligned address */
 
+		self_stats_begin(SELF_STATS_PTRACE, PTRACE_PEEKDATA);
 		errno = 0;
 		union {
 			unsigned long val;
 			char x[sizeof(long)];
 		} u = { .val = ptrace(PTRACE_PEEKDATA, pid, addr, 0) };
+		self_stats_end();
 
 		switch (errno) {
 			case 0:
@@ -371,6 +392,7 @@ umovestr_peekdata(const int pid, kernel_ulong_t addr, unsigned int len,
 				return -1;
 		}
 
+		decoder_stats_fetched += sizeof(long);
 		unsigned int m = MIN(sizeof(long) - residue, len);
 		memcpy(laddr, &u.x[residue], m);
 		while (residue < sizeof(long))
@@ -465,6 +487,144 @@ umovestr(struct tcb *const tcp, kernel_ulong_t addr, unsigned int len,
 	return 0;
 }
 
+/* The maximum number of pages read by umovestr_vec at once. */
+#define UMOVESTR_VEC_PAGES	64
+
+/*
+ * Read the pages listed in `remote' to the consecutive pages of `laddr',
+ * set read[i] if the i-th page has been read.
+ */
+static bool
+read_pages_vec(const pid_t pid, char *const laddr,
+	       struct iovec *const remote, const unsigned int n,
+	       bool *const read)
+{
+	const size_t page_size = get_pagesize();
+	struct iovec local[UMOVESTR_VEC_PAGES];
+
+	for (unsigned int i = 0; i < n; ++i) {
+		local[i].iov_base = laddr + i * page_size;
+		local[i].iov_len = page_size;
+		read[i] = false;
+	}
+
+	/*
+	 * process_vm_readv does not split iovec elements,
+	 * so a partial read ends right before the first page
+	 * that cannot be read; skip it and continue.
+	 */
+	for (unsigned int done = 0; done < n; ++done) {
+		self_stats_begin(SELF_STATS_VM_READ, 0);
+		ssize_t rc = process_vm_readv(pid, local + done, n - done,
+					      remote + done, n - done, 0);
+		self_stats_end();
+		if (rc < 0) {
+			if (errno == EFAULT)
+				continue;
+			if (errno == ENOSYS)
+				process_vm_readv_not_supported = true;
+			return false;
+		}
+
+		decoder_stats_fetched += rc;
+		for (; done < n && (size_t) rc >= page_size; ++done) {
+			read[done] = true;
+			rc -= page_size;
+		}
+	}
+
+	return true;
+}
+
+/* Return the address of the tracee page `addr' belongs to, NULL if none. */
+static void *
+tracee_page_of(const kernel_ulong_t addr)
+{
+	const unsigned long taddr = addr;
+
+	if (!taddr || tracee_addr_is_invalid(addr))
+		return NULL;
+#if SIZEOF_LONG < SIZEOF_KERNEL_LONG_T
+	if (addr != (kernel_ulong_t) taddr)
+		return NULL;
+#endif
+
+	return (void *) (taddr & ~(get_pagesize() - 1));
+}
+
+void
+umovestr_vec(struct tcb *const tcp, const kernel_ulong_t *const addrs,
+	     const unsigned int count, const unsigned int size,
+	     char *const laddr, unsigned int *const lens)
+{
+	memset(lens, 0, count * sizeof(*lens));
+
+	if (process_vm_readv_not_supported || !size)
+		return;
+
+	const size_t page_size = get_pagesize();
+	const size_t page_mask = page_size - 1;
+	static char *buf;
+	struct iovec remote[UMOVESTR_VEC_PAGES];
+	bool read[UMOVESTR_VEC_PAGES];
+
+	if (!buf)
+		buf = xallocarray(UMOVESTR_VEC_PAGES, page_size);
+
+	/*
+	 * The strings are usually packed together, so the pages they
+	 * start in are read as a whole, with a single process_vm_readv
+	 * call for up to UMOVESTR_VEC_PAGES distinct pages.
+	 */
+	for (unsigned int first = 0; first < count; ) {
+		unsigned int n = 0;
+		unsigned int i;
+
+		for (i = first; i < count; ++i) {
+			void *const page = tracee_page_of(addrs[i]);
+			unsigned int j;
+
+			if (!page)
+				continue;
+
+			for (j = n; j > 0; --j)
+				if (remote[j - 1].iov_base == page)
+					break;
+			if (j)
+				continue;
+			if (n == ARRAY_SIZE(remote))
+				break;
+
+			remote[n].iov_base = page;
+			remote[n].iov_len = page_size;
+			++n;
+		}
+
+		if (n && !read_pages_vec(tcp->pid, buf, remote, n, read))
+			return;
+
+		for (; first < i; ++first) {
+			void *const page = tracee_page_of(addrs[first]);
+			unsigned int j;
+
+			if (!page)
+				continue;
+			for (j = 0; j < n; ++j)
+				if (remote[j].iov_base == page)
+					break;
+			if (j == n || !read[j])
+				continue;
+
+			const size_t offset = addrs[first] & page_mask;
+			const size_t len = MIN(size, page_size - offset);
+
+			memcpy(laddr + (size_t) first * size,
+			       buf + j * page_size + offset, len);
+			lens[first] = len;
+		}
+	}
+}
+
 static unsigned int
 upoken_pokedata(const int pid, kernel_ulong_t addr, unsigned int len,
 		void *our_addr)
@@ -0,0 +1,272 @@
+/*
+ * Frame pointer based stack unwinder.
+ *
+ * The stack is walked by following the chain of saved frame pointers,
+ * which is much cheaper than DWARF CFI based unwinding, but works
+ * only for code built with -fno-omit-frame-pointer.  The frames are
+ * symbolized by the libdw unwinder.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#include "defs.h"
+#include "unwind.h"
+#include "mmap_cache.h"
+
+#if defined X86_64 || defined X32 || defined I386
+# define HAVE_FP_UNWINDING 1
+#endif
+
+#define FP_MAX_DEPTH		256
+/* The part of the stack above the stack pointer fetched at once. */
+#define FP_STACK_WINDOW_SIZE	16384
+/*
+ * Stacks of threads other than the main one are anonymous mappings
+ * which are not in the mmap cache, so for them the walk is bounded
+ * by this distance from the stack pointer instead.
+ */
+#define FP_MAX_STACK_SIZE	(64 * 1024 * 1024)
+
+static void
+init(void)
+{
+	mmap_cache_enable();
+	unwinder_libdw.init();
+}
+
+static void *
+tcb_init(struct tcb *tcp)
+{
+	return unwinder_libdw.tcb_init(tcp);
+}
+
+static void
+tcb_fin(struct tcb *tcp)
+{
+	unwinder_libdw.tcb_fin(tcp);
+}
+
+static const char *
+symbolize(void *module, unsigned long pc,
+	  unwind_function_offset_t *function_offset)
+{
+	return unwinder_libdw.symbolize(module, pc, function_offset);
+}
+
+#ifdef HAVE_FP_UNWINDING
+
+static struct {
+	kernel_ulong_t addr;
+	size_t len;
+	unsigned char data[FP_STACK_WINDOW_SIZE];
+} stack_window;
+
+/* Stack slots are 4 bytes long on i386 and 8 bytes long on x86_64 and x32. */
+static unsigned int
+slot_size(void)
+{
+	return current_klongsize;
+}
+
+static bool
+read_slot(struct tcb *tcp, kernel_ulong_t addr, kernel_ulong_t *val)
+{
+	const unsigned int size = slot_size();
+	unsigned char buf[sizeof(uint64_t)];
+	const void *src = buf;
+
+	if (addr >= stack_window.addr &&
+	    addr - stack_window.addr + size <= stack_window.len)
+		src = stack_window.data + (addr - stack_window.addr);
+	else if (umoven(tcp, addr, size, buf))
+		return false;
+
+	if (size == sizeof(uint32_t)) {
+		uint32_t v;
+		memcpy(&v, src, sizeof(v));
+		*val = v;
+	} else {
+		uint64_t v;
+		memcpy(&v, src, sizeof(v));
+		*val = v;
+	}
+
+	return true;
+}
+
+static bool
+is_executable(struct tcb *tcp, kernel_ulong_t addr)
+{
+	const struct mmap_cache_entry_t *entry = mmap_cache_search(tcp, addr);
+
+	return entry && (entry->protections & MMAP_CACHE_PROT_EXECUTABLE);
+}
+
+/*
+ * Check that the instruction preceding addr is a call instruction:
+ * either a direct call (e8 rel32), or an indirect one (ff /2)
+ * of 2, 3, 6, or 7 bytes long.
+ */
+static bool
+follows_call(struct tcb *tcp, kernel_ulong_t addr)
+{
+	unsigned char code[7];
+
+	if (addr < sizeof(code) ||
+	    !is_executable(tcp, addr - sizeof(code)) ||
+	    umoven(tcp, addr - sizeof(code), sizeof(code), code))
+		return false;
+
+	if (code[2] == 0xe8)
+		return true;
+
+	static const unsigned int ff_lengths[] = { 2, 3, 6, 7 };
+	for (size_t i = 0; i < ARRAY_SIZE(ff_lengths); ++i) {
+		const unsigned char *insn = code + sizeof(code) - ff_lengths[i];
+
+		if (insn[0] == 0xff && ((insn[1] >> 3) & 7) == 2)
+			return true;
+	}
+
+	return false;
+}
+
+static size_t
+collect_pcs(struct tcb *tcp, unsigned long *pcs, const char **error)
+{
+	kernel_ulong_t ip, sp, fp;
+
+	if (!get_instruction_pointer(tcp, &ip) ||
+	    !get_stack_pointer(tcp, &sp) ||
+	    !get_frame_pointer(tcp, &fp)) {
+		*error = "failed to fetch registers";
+		return 0;
+	}
+
+	if (mmap_cache_rebuild_if_invalid(tcp, __func__)
+	    == MMAP_CACHE_REBUILD_NOCACHE) {
+		*error = "failed to fetch memory mappings";
+		return 0;
+	}
+
+	const struct mmap_cache_entry_t *stack_map =
+		mmap_cache_search(tcp, sp);
+	const kernel_ulong_t stack_end = stack_map ? stack_map->end_addr
+		: sp + MIN(FP_MAX_STACK_SIZE, (kernel_ulong_t) -1 - sp);
+
+	/* Fetch the innermost part of the stack with a single read. */
+	stack_window.addr = sp;
+	stack_window.len = MIN(stack_end - sp, sizeof(stack_window.data));
+	if (umoven(tcp, sp, stack_window.len, stack_window.data)) {
+		/*
+		 * The end of an anonymous stack mapping is not known,
+		 * the rest of its page is readable anyway.
+		 */
+		const unsigned long page_size = get_pagesize();
+
+		stack_window.len = MIN(stack_window.len,
+				       page_size - sp % page_size);
+		if (umoven(tcp, sp, stack_window.len, stack_window.data))
+			stack_window.len = 0;
+	}
+
+	const unsigned int size = slot_size();
+	size_t depth = 0;
+	kernel_ulong_t ret;
+
+	pcs[depth++] = ip;
+
+	/*
+	 * The innermost function, e.g. a syscall wrapper, often does not
+	 * set up a frame, so its return address is on the top of the stack
+	 * rather than next to the saved frame pointer.
+	 */
+	if (read_slot(tcp, sp, &ret) && is_executable(tcp, ret) &&
+	    follows_call(tcp, ret))
+		pcs[depth++] = ret - 1;
+
+	while (depth < FP_MAX_DEPTH) {
+		kernel_ulong_t next_fp;
+
+		if (fp < sp || fp % size || fp + 2 * size > stack_end)
+			break;
+		if (!read_slot(tcp, fp, &next_fp) ||
+		    !read_slot(tcp, fp + size, &ret) ||
+		    !is_executable(tcp, ret))
+			break;
+
+		/* Skip the frame already reported from the top of the stack. */
+		if (depth != 2 || pcs[1] != ret - 1)
+			pcs[depth++] = ret - 1;
+
+		if (next_fp <= fp)
+			break;
+		fp = next_fp;
+	}
+
+	return depth;
+}
+
+static void
+walk(struct tcb *tcp,
+     unwind_call_action_fn call_action,
+     unwind_frame_action_fn frame_action,
+     unwind_error_action_fn error_action,
+     void *data)
+{
+	unsigned long pcs[FP_MAX_DEPTH];
+	const char *error = NULL;
+	size_t depth = collect_pcs(tcp, pcs, &error);
+
+	unwinder_libdw.tcb_report_pcs(tcp, pcs, depth,
+				      call_action, frame_action,
+				      error_action, data);
+	if (error)
+		error_action(data, error, 0);
+}
+
+#else /* !HAVE_FP_UNWINDING */
+
+static void
+walk(struct tcb *tcp,
+     unwind_call_action_fn call_action,
+     unwind_frame_action_fn frame_action,
+     unwind_error_action_fn error_action,
+     void *data)
+{
+	error_action(data, "frame pointer unwinding is not supported"
+			   " on this architecture", 0);
+}
+
+#endif /* HAVE_FP_UNWINDING */
+
+static void
+tcb_walk(struct tcb *tcp,
+	 unwind_call_action_fn call_action,
+	 unwind_error_action_fn error_action,
+	 void *data)
+{
+	walk(tcp, call_action, NULL, error_action, data);
+}
+
+static void
+tcb_walk_frames(struct tcb *tcp,
+		unwind_frame_action_fn frame_action,
+		unwind_error_action_fn error_action,
+		void *data)
+{
+	walk(tcp, NULL, frame_action, error_action, data);
+}
+
+const struct unwind_unwinder_t unwinder_fp = {
+	.name = "fp",
+	.init = init,
+	.tcb_init = tcb_init,
+	.tcb_fin = tcb_fin,
+	.tcb_walk = tcb_walk,
+	.tcb_walk_frames = tcb_walk_frames,
+	.symbolize = symbolize,
+};
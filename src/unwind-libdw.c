@@ -18,6 +18,7 @@
 #include "unwind.h"
 #include "mmap_notify.h"
 #include "static_assert.h"
+#include "trie.h"
 #include <elfutils/libdwfl.h>
 
 #define STRACE_UW_CACHE_SIZE 2048
@@ -40,30 +41,84 @@ struct cache_entry {
 	unsigned long long last_use;
 };
 
+/*
+ * The context is shared by all threads of a process:
+ * they have the same memory mappings and hence the same
+ * Dwfl modules and symbol cache.
+ */
 struct ctx {
 	Dwfl *dwfl;
+	unsigned long long mapping_generation;
 	unsigned long long last_proc_updating;
+	unsigned int refcount;
+	int tgid;
+#if SUPPORTED_PERSONALITIES > 1
+	unsigned int currpers;
+#endif
 	struct cache_entry cache[STRACE_UW_CACHE_SIZE];
 };
 
-static unsigned long long mapping_generation = 1;
 static unsigned long long uwcache_clock;
 
+/* Module identities handed out by tcb_walk_frames, never freed. */
+static struct unwind_module_id **module_ids;
+static size_t module_ids_count;
+static size_t module_ids_size;
+
+/**
+ * Key:   thread group ID (as present in /proc)
+ * Value: struct ctx
+ */
+static struct trie *tgid_ctxs;
+
 static void
-update_mapping_generation(struct tcb *tcp, void *unused)
+update_mapping_generation(struct tcb *tcp,
+			  const struct mmap_notify_event *ev, void *unused)
 {
-	mapping_generation++;
+	struct ctx *ctx = tcp->unwind_ctx;
+	if (!ctx)
+		return;
+
+	/* These do not change what is mapped where. */
+	if (ev->op == MMAP_NOTIFY_PROTECT || ev->op == MMAP_NOTIFY_BRK)
+		return;
+
+	ctx->mapping_generation++;
 }
 
 static void
 init(void)
 {
 	mmap_notify_register_client(update_mapping_generation, NULL);
+
+	tgid_ctxs = trie_create(sizeof(int) * 8, sizeof(void *) == 8 ? 6 : 5,
+				4, 4, 0);
+	if (!tgid_ctxs)
+		error_msg_and_die("creating trie failed");
 }
 
 static void *
 tcb_init(struct tcb *tcp)
 {
+	const int tgid = get_tcb_tgid(tcp);
+	struct ctx *ctx = (struct ctx *) (uintptr_t) trie_get(tgid_ctxs, tgid);
+
+#if SUPPORTED_PERSONALITIES > 1
+	/*
+	 * After an execve that changed the personality the old context
+	 * is left to the threads still referring to it.
+	 */
+	if (ctx && ctx->currpers != tcp->currpers) {
+		trie_set(tgid_ctxs, tgid, 0);
+		ctx = NULL;
+	}
+#endif
+
+	if (ctx) {
+		ctx->refcount++;
+		return ctx;
+	}
+
 	static const Dwfl_Callbacks proc_callbacks = {
 		.find_elf = dwfl_linux_proc_find_elf,
 		.find_debuginfo = dwfl_standard_find_debuginfo
@@ -75,7 +130,7 @@ tcb_init(struct tcb *tcp)
 		return NULL;
 	}
 
-	int r = dwfl_linux_proc_attach(dwfl, tcp->pid, true);
+	int r = dwfl_linux_proc_attach(dwfl, tgid, true);
 	if (r) {
 		const char *msg = NULL;
 
@@ -85,15 +140,22 @@ tcb_init(struct tcb *tcp)
 			msg = strerror(r);
 
 		error_msg("dwfl_linux_proc_attach returned an error"
-			  " for process %d: %s", tcp->pid, msg);
+			  " for process %d: %s", tgid, msg);
 		dwfl_end(dwfl);
 		return NULL;
 	}
 
-	struct ctx *ctx = xmalloc(sizeof(*ctx));
+	ctx = xmalloc(sizeof(*ctx));
 	ctx->dwfl = dwfl;
-	ctx->last_proc_updating = mapping_generation - 1;
+	ctx->mapping_generation = 1;
+	ctx->last_proc_updating = 0;
+	ctx->refcount = 1;
+	ctx->tgid = tgid;
+#if SUPPORTED_PERSONALITIES > 1
+	ctx->currpers = tcp->currpers;
+#endif
 	memset(ctx->cache, 0, sizeof(ctx->cache));
+	trie_set(tgid_ctxs, tgid, (uint64_t) (uintptr_t) ctx);
 	return ctx;
 }
 
@@ -101,7 +163,9 @@ static void
 tcb_fin(struct tcb *tcp)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
-	if (ctx) {
+	if (ctx && !--ctx->refcount) {
+		if (trie_get(tgid_ctxs, ctx->tgid) == (uint64_t) (uintptr_t) ctx)
+			trie_set(tgid_ctxs, ctx->tgid, 0);
 		dwfl_end(ctx->dwfl);
 		free(ctx);
 	}
@@ -114,25 +178,26 @@ flush_cache_maybe(struct tcb *tcp)
 	if (!ctx)
 		return;
 
-	if (ctx->last_proc_updating == mapping_generation)
+	if (ctx->last_proc_updating == ctx->mapping_generation)
 		return;
 
-	int r = dwfl_linux_proc_report(ctx->dwfl, tcp->pid);
+	int r = dwfl_linux_proc_report(ctx->dwfl, ctx->tgid);
 
 	if (r < 0)
 		error_msg("dwfl_linux_proc_report returned an error"
-			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
+			  " for pid %d: %s", ctx->tgid, dwfl_errmsg(-1));
 	else if (r > 0)
 		error_msg("dwfl_linux_proc_report returned an error"
-			  " for pid %d", tcp->pid);
+			  " for pid %d", ctx->tgid);
 	else if (dwfl_report_end(ctx->dwfl, NULL, NULL) != 0)
 		error_msg("dwfl_report_end returned an error"
-			  " for pid %d: %s", tcp->pid, dwfl_errmsg(-1));
+			  " for pid %d: %s", ctx->tgid, dwfl_errmsg(-1));
 
-	ctx->last_proc_updating = mapping_generation;
+	ctx->last_proc_updating = ctx->mapping_generation;
 }
 
 struct frame_user_data {
+	unwind_frame_action_fn frame_action;
 	unwind_call_action_fn call_action;
 	unwind_error_action_fn error_action;
 	void *data;
@@ -148,12 +213,12 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	struct cache_entry *lru = ctx->cache + idx;
 	for (unsigned int i = 0; i < STRACE_UW_CACHE_ASSOC; ++i) {
 		struct cache_entry *ce = ctx->cache + (idx + i);
-		if (ce->generation == mapping_generation && ce->pc == pc) {
+		if (ce->generation == ctx->mapping_generation && ce->pc == pc) {
 			ce->last_use = uwcache_clock++;
 			*res = ce;
 			return true;
 		}
-		if (ce->generation != mapping_generation) {
+		if (ce->generation != ctx->mapping_generation) {
 			unused = ce;
 			continue;
 		}
@@ -165,29 +230,92 @@ find_bucket(struct ctx *ctx, Dwarf_Addr pc, struct cache_entry **res) {
 	return false;
 }
 
-static int
-frame_callback(Dwfl_Frame *state, void *arg)
+static const struct unwind_module_id *
+intern_module_id(const char *binary_filename, const char *build_id)
 {
-	struct frame_user_data *user_data = arg;
-	Dwarf_Addr pc;
-	bool isactivation;
+	for (size_t i = 0; i < module_ids_count; ++i) {
+		const struct unwind_module_id *id = module_ids[i];
+
+		if (!strcmp(id->binary_filename, binary_filename) &&
+		    (id->build_id && build_id
+		     ? !strcmp(id->build_id, build_id)
+		     : id->build_id == build_id))
+			return id;
+	}
 
-	if (!dwfl_frame_pc(state, &pc, &isactivation)) {
-		/* Propagate the error to the caller.  */
-		return -1;
+	if (module_ids_count >= module_ids_size)
+		module_ids = xgrowarray(module_ids, &module_ids_size,
+					sizeof(*module_ids));
+
+	struct unwind_module_id *id = xmalloc(sizeof(*id));
+	id->binary_filename = xstrdup(binary_filename);
+	id->build_id = build_id ? xstrdup(build_id) : NULL;
+	module_ids[module_ids_count++] = id;
+
+	return id;
+}
+
+/*
+ * The identity is looked up once per module and kept
+ * in the module's user data.
+ */
+static const struct unwind_module_id *
+get_module_id(Dwfl_Module *mod)
+{
+	void **userdata = NULL;
+	const char *modname = dwfl_module_info(mod, &userdata, NULL, NULL,
+					       NULL, NULL, NULL, NULL);
+
+	if (userdata && *userdata)
+		return *userdata;
+
+	const unsigned char *bits;
+	GElf_Addr vaddr;
+	int len = dwfl_module_build_id(mod, &bits, &vaddr);
+	char *build_id = NULL;
+
+	if (len > 0) {
+		build_id = xmalloc(len * 2 + 1);
+		for (int i = 0; i < len; ++i)
+			sprintf(build_id + i * 2, "%02x", bits[i]);
 	}
 
-	if (!isactivation)
-		pc--;
+	const struct unwind_module_id *id =
+		intern_module_id(modname ?: "", build_id);
+	free(build_id);
+
+	if (userdata)
+		*userdata = (void *) id;
+
+	return id;
+}
 
+static void
+report_frame(struct frame_user_data *user_data, Dwarf_Addr pc)
+{
+	Dwfl_Module *mod = dwfl_addrmodule(user_data->ctx->dwfl, pc);
+
+	if (mod == NULL)
+		return;
+
+	Dwarf_Addr true_offset = pc;
+	dwfl_module_relocate_address(mod, &true_offset);
+	user_data->frame_action(user_data->data, get_module_id(mod), mod,
+				pc, true_offset);
+}
+
+static void
+report_pc(struct frame_user_data *user_data, Dwarf_Addr pc)
+{
 	struct cache_entry *ce;
-	if (find_bucket(user_data->ctx, pc, &ce)) {
+	if (user_data->frame_action) {
+		report_frame(user_data, pc);
+	} else if (find_bucket(user_data->ctx, pc, &ce)) {
 		user_data->call_action(user_data->data,
 				       ce->modname, ce->symname,
 			               ce->off, ce->true_offset);
 	} else {
-		Dwfl *dwfl = dwfl_thread_dwfl(dwfl_frame_thread(state));
-		Dwfl_Module *mod = dwfl_addrmodule(dwfl, pc);
+		Dwfl_Module *mod = dwfl_addrmodule(user_data->ctx->dwfl, pc);
 		GElf_Off off = 0;
 
 		if (mod != NULL) {
@@ -204,7 +332,7 @@ frame_callback(Dwfl_Frame *state, void *arg)
 			user_data->call_action(user_data->data, modname, symname,
 					       off, true_offset);
 
-			ce->generation = mapping_generation;
+			ce->generation = user_data->ctx->mapping_generation;
 			ce->pc = pc;
 			ce->modname = modname;
 			ce->symname = symname;
@@ -213,6 +341,24 @@ frame_callback(Dwfl_Frame *state, void *arg)
 			ce->last_use = uwcache_clock++;
 		}
 	}
+}
+
+static int
+frame_callback(Dwfl_Frame *state, void *arg)
+{
+	struct frame_user_data *user_data = arg;
+	Dwarf_Addr pc;
+	bool isactivation;
+
+	if (!dwfl_frame_pc(state, &pc, &isactivation)) {
+		/* Propagate the error to the caller.  */
+		return -1;
+	}
+
+	if (!isactivation)
+		pc--;
+
+	report_pc(user_data, pc);
 
 	/* Max number of frames to print reached? */
 	if (user_data->stack_depth-- == 0)
@@ -221,38 +367,102 @@ frame_callback(Dwfl_Frame *state, void *arg)
 	return DWARF_CB_OK;
 }
 
+static void
+walk(struct tcb *tcp, struct frame_user_data *user_data)
+{
+	struct ctx *ctx = tcp->unwind_ctx;
+	if (!ctx)
+		return;
+
+	user_data->stack_depth = 256;
+	user_data->ctx = ctx;
+
+	flush_cache_maybe(tcp);
+
+	int r = dwfl_getthread_frames(ctx->dwfl, tcp->pid, frame_callback,
+				      user_data);
+	if (r)
+		user_data->error_action(user_data->data,
+					r < 0 ? dwfl_errmsg(-1)
+					      : "too many stack frames",
+					0);
+}
+
 static void
 tcb_walk(struct tcb *tcp,
 	 unwind_call_action_fn call_action,
 	 unwind_error_action_fn error_action,
 	 void *data)
+{
+	struct frame_user_data user_data = {
+		.call_action = call_action,
+		.error_action = error_action,
+		.data = data,
+	};
+
+	walk(tcp, &user_data);
+}
+
+static void
+tcb_walk_frames(struct tcb *tcp,
+		unwind_frame_action_fn frame_action,
+		unwind_error_action_fn error_action,
+		void *data)
+{
+	struct frame_user_data user_data = {
+		.frame_action = frame_action,
+		.error_action = error_action,
+		.data = data,
+	};
+
+	walk(tcp, &user_data);
+}
+
+static void
+tcb_report_pcs(struct tcb *tcp, const unsigned long *pcs, size_t count,
+	       unwind_call_action_fn call_action,
+	       unwind_frame_action_fn frame_action,
+	       unwind_error_action_fn error_action,
+	       void *data)
 {
 	struct ctx *ctx = tcp->unwind_ctx;
 	if (!ctx)
 		return;
 
 	struct frame_user_data user_data = {
+		.frame_action = frame_action,
 		.call_action = call_action,
 		.error_action = error_action,
 		.data = data,
-		.stack_depth = 256,
 		.ctx = ctx,
 	};
 
 	flush_cache_maybe(tcp);
 
-	int r = dwfl_getthread_frames(ctx->dwfl, tcp->pid, frame_callback,
-				      &user_data);
-	if (r)
-		error_action(data,
-			     r < 0 ? dwfl_errmsg(-1) : "too many stack frames",
-			     0);
+	for (size_t i = 0; i < count; ++i)
+		report_pc(&user_data, pcs[i]);
+}
+
+static const char *
+symbolize(void *module, unsigned long pc,
+	  unwind_function_offset_t *function_offset)
+{
+	GElf_Off off = 0;
+	GElf_Sym sym;
+	const char *symname = dwfl_module_addrinfo(module, pc, &off, &sym,
+						   NULL, NULL, NULL);
+
+	*function_offset = off;
+	return symname;
 }
 
-const struct unwind_unwinder_t unwinder = {
+const struct unwind_unwinder_t unwinder_libdw = {
 	.name = "libdw",
 	.init = init,
 	.tcb_init = tcb_init,
 	.tcb_fin = tcb_fin,
 	.tcb_walk = tcb_walk,
+	.tcb_walk_frames = tcb_walk_frames,
+	.symbolize = symbolize,
+	.tcb_report_pcs = tcb_report_pcs,
 };
@@ -161,7 +161,7 @@ tcb_walk(struct tcb *tcp,
 	}
 }
 
-const struct unwind_unwinder_t unwinder = {
+const struct unwind_unwinder_t unwinder_libunwind = {
 	.name = "libunwind",
 	.init = init,
 	.tcb_init = tcb_init,
@@ -6,6 +6,7 @@
  */
 
 #include "defs.h"
+#include "hash_index.h"
 #include "unwind.h"
 
 #ifdef USE_DEMANGLE
@@ -25,22 +26,114 @@
 struct call_t {
 	struct call_t *next;
 	char *output_line;
+
+	/* Raw frame, symbolized when output_line is NULL. */
+	const struct unwind_module_id *module_id;
+	void *module;
+	unsigned long pc;
+	unsigned long true_offset;
+};
+
+struct summary_frame {
+	const struct unwind_module_id *module_id;
+	unsigned long true_offset;
+	const char *symbol_name;	/* NULL if there is no symbol */
 };
 
 struct unwind_queue_t {
 	struct call_t *tail;
 	struct call_t *head;
+	/* The entries are to be printed by unwind_tcb_flush. */
+	bool print_pending;
+
+	/* The stack captured for the stack summary. */
+	struct summary_frame *summary_frames;
+	size_t summary_depth;
+	size_t summary_frames_size;
+	bool summary_captured;
+};
+
+/*
+ * Symbols looked up in deferred mode, keyed by binary identity
+ * and offset, so they survive remapping and are shared by processes.
+ */
+struct symbol_cache_entry {
+	const struct unwind_module_id *module_id;
+	unsigned long true_offset;
+	char *symbol_name;	/* NULL if there is no symbol */
+	unwind_function_offset_t function_offset;
 };
 
+static struct symbol_cache_entry *symbol_cache;
+static size_t symbol_cache_size;	/* a power of 2 */
+static size_t symbol_cache_count;
+
+/*
+ * Calls and time spent in syscalls aggregated by syscall and stack,
+ * in the order of appearance.
+ */
+struct summary_stack {
+	const char *syscall_name;
+	struct summary_frame *frames;
+	size_t depth;
+	uint64_t calls;
+	struct timespec time;
+};
+
+static struct summary_stack *summary_stacks;
+static size_t summary_stacks_count;
+static size_t summary_stacks_size;
+static struct hash_index summary_index;
+
+static const struct unwind_unwinder_t *const unwinders[] = {
+#ifdef USE_LIBDW
+	&unwinder_libdw,
+	&unwinder_fp,
+#endif
+#ifdef USE_LIBUNWIND
+	&unwinder_libunwind,
+#endif
+};
+
+static const struct unwind_unwinder_t *unwinder;
+
 static void queue_print(struct unwind_queue_t *queue);
 
 static const char asprintf_error_str[] = "???";
 
+bool
+unwind_select_unwinder(const char *name)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(unwinders); ++i) {
+		if (!strcmp(unwinders[i]->name, name)) {
+			unwinder = unwinders[i];
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void
 unwind_init(void)
 {
-	if (unwinder.init)
-		unwinder.init();
+	if (!unwinder)
+		unwinder = unwinders[0];
+
+	if (stack_summary_enabled &&
+	    !(unwinder->tcb_walk_frames && unwinder->symbolize))
+		error_msg_and_die("Stack summary is not supported"
+				  " by %s unwinder", unwinder->name);
+
+	if (stack_trace_deferred &&
+	    !(unwinder->tcb_walk_frames && unwinder->symbolize)) {
+		error_msg("Deferred symbolization is not supported"
+			  " by %s unwinder", unwinder->name);
+		stack_trace_deferred = false;
+	}
+
+	if (unwinder->init)
+		unwinder->init();
 }
 
 void
@@ -49,11 +142,9 @@ unwind_tcb_init(struct tcb *tcp)
 	if (tcp->unwind_queue)
 		return;
 
-	tcp->unwind_queue = xmalloc(sizeof(*tcp->unwind_queue));
-	tcp->unwind_queue->head = NULL;
-	tcp->unwind_queue->tail = NULL;
+	tcp->unwind_queue = xzalloc(sizeof(*tcp->unwind_queue));
 
-	tcp->unwind_ctx = unwinder.tcb_init(tcp);
+	tcp->unwind_ctx = unwinder->tcb_init(tcp);
 }
 
 void
@@ -63,10 +154,11 @@ unwind_tcb_fin(struct tcb *tcp)
 		return;
 
 	queue_print(tcp->unwind_queue);
+	free(tcp->unwind_queue->summary_frames);
 	free(tcp->unwind_queue);
 	tcp->unwind_queue = NULL;
 
-	unwinder.tcb_fin(tcp);
+	unwinder->tcb_fin(tcp);
 	tcp->unwind_ctx = NULL;
 }
 
@@ -184,9 +276,127 @@ sprint_call_or_error(const char *binary_filename,
 	return output_line;
 }
 
+/*
+ * symbol cache for deferred symbolization
+ */
+static size_t
+symbol_cache_hash(const struct unwind_module_id *module_id,
+		  unsigned long true_offset)
+{
+	uint64_t h = (uintptr_t) module_id ^ ((uint64_t) true_offset << 7);
+
+	h *= 0x9e3779b97f4a7c15ULL;
+	return h >> 32;
+}
+
+static struct symbol_cache_entry *
+symbol_cache_find(const struct unwind_module_id *module_id,
+		  unsigned long true_offset)
+{
+	const size_t mask = symbol_cache_size - 1;
+
+	for (size_t i = symbol_cache_hash(module_id, true_offset) & mask;;
+	     i = (i + 1) & mask) {
+		struct symbol_cache_entry *ce = &symbol_cache[i];
+
+		if (!ce->module_id || (ce->module_id == module_id &&
+				       ce->true_offset == true_offset))
+			return ce;
+	}
+}
+
+static void
+symbol_cache_grow(void)
+{
+	struct symbol_cache_entry *old_cache = symbol_cache;
+	const size_t old_size = symbol_cache_size;
+
+	symbol_cache_size = old_size ? old_size * 2 : 256;
+	symbol_cache = xcalloc(symbol_cache_size, sizeof(*symbol_cache));
+
+	for (size_t i = 0; i < old_size; ++i) {
+		if (old_cache[i].module_id)
+			*symbol_cache_find(old_cache[i].module_id,
+					   old_cache[i].true_offset) =
+				old_cache[i];
+	}
+
+	free(old_cache);
+}
+
+static const struct symbol_cache_entry *
+symbolize_call(const struct call_t *call)
+{
+	if ((symbol_cache_count + 1) * 2 > symbol_cache_size)
+		symbol_cache_grow();
+
+	struct symbol_cache_entry *ce =
+		symbol_cache_find(call->module_id, call->true_offset);
+	if (ce->module_id)
+		return ce;
+
+	unwind_function_offset_t function_offset = 0;
+	const char *symbol_name =
+		unwinder->symbolize(call->module, call->pc, &function_offset);
+
+	ce->module_id = call->module_id;
+	ce->true_offset = call->true_offset;
+	ce->symbol_name = NULL;
+	ce->function_offset = function_offset;
+	if (symbol_name && symbol_name[0] != '\0') {
+#ifdef USE_DEMANGLE
+		ce->symbol_name = cplus_demangle(symbol_name,
+						 DMGL_AUTO | DMGL_PARAMS);
+		if (!ce->symbol_name)
+#endif
+			ce->symbol_name = xstrdup(symbol_name);
+	}
+	symbol_cache_count++;
+
+	return ce;
+}
+
+static char *
+sprint_frame(const struct call_t *call)
+{
+	const struct symbol_cache_entry *ce = symbolize_call(call);
+	const char *binary_filename = call->module_id->binary_filename;
+	unwind_function_offset_t function_offset = ce->function_offset;
+	unsigned long true_offset = call->true_offset;
+	char *output_line = NULL;
+	int n;
+
+	if (ce->symbol_name)
+		n = asprintf(&output_line,
+			     STACK_ENTRY_SYMBOL_FMT(ce->symbol_name));
+	else
+		n = asprintf(&output_line, STACK_ENTRY_NOSYMBOL_FMT);
+
+	if (n < 0) {
+		perror_func_msg("asprintf");
+		output_line = (char *) asprintf_error_str;
+	}
+
+	return output_line;
+}
+
 /*
  * queue manipulators
  */
+static void
+queue_append(struct unwind_queue_t *queue, struct call_t *call)
+{
+	call->next = NULL;
+
+	if (!queue->head) {
+		queue->head = call;
+		queue->tail = call;
+	} else {
+		queue->tail->next = call;
+		queue->tail = call;
+	}
+}
+
 static void
 queue_put(struct unwind_queue_t *queue,
 	  const char *binary_filename,
@@ -197,21 +407,13 @@ queue_put(struct unwind_queue_t *queue,
 {
 	struct call_t *call;
 
-	call = xmalloc(sizeof(*call));
+	call = xzalloc(sizeof(*call));
 	call->output_line = sprint_call_or_error(binary_filename,
 						 symbol_name,
 						 function_offset,
 						 true_offset,
 						 error);
-	call->next = NULL;
-
-	if (!queue->head) {
-		queue->head = call;
-		queue->tail = call;
-	} else {
-		queue->tail->next = call;
-		queue->tail = call;
-	}
+	queue_append(queue, call);
 }
 
 static void
@@ -237,11 +439,40 @@ queue_put_error(void *queue,
 	queue_put(queue, NULL, NULL, 0, ip, error);
 }
 
+static void
+queue_put_frame(void *queue,
+		const struct unwind_module_id *module_id,
+		void *module,
+		unsigned long pc,
+		unsigned long true_offset)
+{
+	struct call_t *call;
+
+	call = xmalloc(sizeof(*call));
+	call->output_line = NULL;
+	call->module_id = module_id;
+	call->module = module;
+	call->pc = pc;
+	call->true_offset = true_offset;
+	queue_append(queue, call);
+}
+
+static void
+queue_resolve(struct unwind_queue_t *queue)
+{
+	for (struct call_t *call = queue->head; call; call = call->next) {
+		if (!call->output_line)
+			call->output_line = sprint_frame(call);
+	}
+}
+
 static void
 queue_print(struct unwind_queue_t *queue)
 {
 	struct call_t *call, *tmp;
 
+	queue_resolve(queue);
+	queue->print_pending = false;
 	queue->tail = NULL;
 	call = queue->head;
 	queue->head = NULL;
@@ -261,6 +492,198 @@ queue_print(struct unwind_queue_t *queue)
 	}
 }
 
+/*
+ * stack summary
+ */
+static void
+summary_put_frame(void *data,
+		  const struct unwind_module_id *module_id,
+		  void *module,
+		  unsigned long pc,
+		  unsigned long true_offset)
+{
+	struct unwind_queue_t *queue = data;
+	const struct call_t call = {
+		.module_id = module_id,
+		.module = module,
+		.pc = pc,
+		.true_offset = true_offset,
+	};
+
+	if (queue->summary_depth >= queue->summary_frames_size)
+		queue->summary_frames =
+			xgrowarray(queue->summary_frames,
+				   &queue->summary_frames_size,
+				   sizeof(*queue->summary_frames));
+
+	queue->summary_frames[queue->summary_depth++] =
+		(struct summary_frame) {
+			.module_id = module_id,
+			.true_offset = true_offset,
+			.symbol_name = symbolize_call(&call)->symbol_name,
+		};
+}
+
+static void
+summary_put_error(void *data, const char *error, unsigned long true_offset)
+{
+	/* The frames walked so far are accounted anyway. */
+}
+
+/* The key of summary_index. */
+struct summary_key {
+	const char *syscall_name;
+	const struct summary_frame *frames;
+	size_t depth;
+};
+
+static uint64_t
+summary_hash(const struct summary_key *key)
+{
+	uint64_t h = (uintptr_t) key->syscall_name;
+
+	for (size_t i = 0; i < key->depth; ++i) {
+		h ^= (uintptr_t) key->frames[i].module_id;
+		h *= 0x9e3779b97f4a7c15ULL;
+		h ^= key->frames[i].true_offset;
+		h *= 0x9e3779b97f4a7c15ULL;
+	}
+
+	return h;
+}
+
+static bool
+summary_stack_match(size_t idx, const void *data)
+{
+	const struct summary_stack *stack = &summary_stacks[idx];
+	const struct summary_key *key = data;
+
+	if (stack->syscall_name != key->syscall_name ||
+	    stack->depth != key->depth)
+		return false;
+
+	for (size_t i = 0; i < key->depth; ++i) {
+		if (stack->frames[i].module_id != key->frames[i].module_id ||
+		    stack->frames[i].true_offset != key->frames[i].true_offset)
+			return false;
+	}
+
+	return true;
+}
+
+static struct summary_stack *
+summary_get_stack(const char *syscall_name, const struct summary_frame *frames,
+		  size_t depth)
+{
+	const struct summary_key key = { syscall_name, frames, depth };
+	const size_t idx = hash_index_get(&summary_index, summary_hash(&key),
+					  &key, summary_stack_match,
+					  summary_stacks_count);
+	if (idx < summary_stacks_count)
+		return &summary_stacks[idx];
+
+	if (summary_stacks_count >= summary_stacks_size)
+		summary_stacks = xgrowarray(summary_stacks,
+					    &summary_stacks_size,
+					    sizeof(*summary_stacks));
+
+	struct summary_stack *stack = &summary_stacks[summary_stacks_count++];
+	*stack = (struct summary_stack) {
+		.syscall_name = syscall_name,
+		.frames = depth ? xarraydup(frames, depth, sizeof(*frames))
+				: NULL,
+		.depth = depth,
+	};
+
+	return stack;
+}
+
+/*
+ * Capture the stack for the stack summary on entering syscalls
+ * that replace or destroy it.
+ */
+void
+unwind_tcb_summary_capture(struct tcb *tcp)
+{
+	struct unwind_queue_t *queue = tcp->unwind_queue;
+
+	queue->summary_depth = 0;
+	unwinder->tcb_walk_frames(tcp, summary_put_frame, summary_put_error,
+				  queue);
+	queue->summary_captured = true;
+}
+
+/* Account the syscall that has just finished at ts in the stack summary. */
+void
+unwind_tcb_summary_add(struct tcb *tcp, const struct timespec *ts)
+{
+	struct unwind_queue_t *queue = tcp->unwind_queue;
+
+	if (!queue->summary_captured) {
+		/*
+		 * The stack of a syscall that replaces it cannot be obtained
+		 * on exiting, such a call is accounted without a stack.
+		 */
+		if (tcp_sysent(tcp)->sys_flags & STACKTRACE_CAPTURE_ON_ENTER)
+			queue->summary_depth = 0;
+		else
+			unwind_tcb_summary_capture(tcp);
+	}
+	queue->summary_captured = false;
+
+	struct summary_stack *stack =
+		summary_get_stack(tcp_sysent(tcp)->sys_name,
+				  queue->summary_frames, queue->summary_depth);
+
+	static const struct timespec zero_ts;
+	struct timespec dt;
+	ts_sub(&dt, ts, &tcp->etime);
+
+	stack->calls++;
+	ts_add(&stack->time, &stack->time, ts_max(&dt, &zero_ts));
+}
+
+static void
+summary_print_name(FILE *fp, const char *name)
+{
+	/* Semicolons separate frames in the collapsed stack format. */
+	for (; *name; ++name)
+		fputc(*name == ';' ? ':' : *name, fp);
+}
+
+/*
+ * Print the stack summary in the collapsed stack format:
+ * the frames from the outermost one and the syscall name separated
+ * by semicolons, followed by the number of calls or microseconds spent.
+ */
+void
+unwind_summary_print(FILE *fp, bool by_time)
+{
+	for (size_t i = 0; i < summary_stacks_count; ++i) {
+		const struct summary_stack *stack = &summary_stacks[i];
+
+		for (size_t j = stack->depth; j > 0; --j) {
+			const struct summary_frame *frame =
+				&stack->frames[j - 1];
+
+			if (frame->symbol_name) {
+				summary_print_name(fp, frame->symbol_name);
+			} else {
+				fputc('[', fp);
+				summary_print_name(fp,
+					frame->module_id->binary_filename);
+				fputc(']', fp);
+			}
+			fputc(';', fp);
+		}
+
+		fprintf(fp, "%s %" PRIu64 "\n", stack->syscall_name,
+			by_time ? (uint64_t) stack->time.tv_sec * 1000000
+				  + stack->time.tv_nsec / 1000
+				: stack->calls);
+	}
+}
+
 /*
  * printing stack
  */
@@ -273,12 +696,76 @@ unwind_tcb_print(struct tcb *tcp)
 		return;
 	}
 #endif
+	unwind_tcb_flush(tcp);
+
 	if (tcp->unwind_queue->head) {
 		debug_func_msg("head: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
 		queue_print(tcp->unwind_queue);
+	} else if (stack_trace_deferred) {
+		unwinder->tcb_walk_frames(tcp, queue_put_frame, queue_put_error,
+					  tcp->unwind_queue);
+		tcp->unwind_queue->print_pending = true;
 	} else
-		unwinder.tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
+		unwinder->tcb_walk(tcp, print_call_cb, print_error_cb, NULL);
+}
+
+struct sprint_buf {
+	char *str;
+	size_t len;
+};
+
+static void
+sprint_buf_append(struct sprint_buf *buf, char *line)
+{
+	const size_t len = strlen(line);
+
+	buf->str = xreallocarray(buf->str, buf->len + len + 1, 1);
+	memcpy(buf->str + buf->len, line, len + 1);
+	buf->len += len;
+
+	if (line != asprintf_error_str)
+		free(line);
+}
+
+static void
+sprint_call_cb(void *data,
+	       const char *binary_filename,
+	       const char *symbol_name,
+	       unwind_function_offset_t function_offset,
+	       unsigned long true_offset)
+{
+	sprint_buf_append(data, sprint_call_or_error(binary_filename,
+						     symbol_name,
+						     function_offset,
+						     true_offset, NULL));
+}
+
+static void
+sprint_error_cb(void *data,
+		const char *error,
+		unsigned long true_offset)
+{
+	sprint_buf_append(data, sprint_call_or_error(NULL, NULL, 0,
+						     true_offset, error));
+}
+
+/*
+ * Format the current stack of the tracee the same way -k option
+ * prints it.
+ */
+char *
+unwind_tcb_sprint(struct tcb *tcp)
+{
+	struct sprint_buf buf = { NULL, 0 };
+
+#if defined(USE_LIBUNWIND) && (SUPPORTED_PERSONALITIES > 1)
+	if (tcp->currpers != DEFAULT_PERSONALITY)
+		return NULL;
+#endif
+	unwinder->tcb_walk(tcp, sprint_call_cb, sprint_error_cb, &buf);
+
+	return buf.str;
 }
 
 /*
@@ -293,12 +780,38 @@ unwind_tcb_capture(struct tcb *tcp)
 		return;
 	}
 #endif
+	unwind_tcb_flush(tcp);
+
 	if (tcp->unwind_queue->head)
 		error_msg_and_die("bug: unprinted entries in queue");
 	else {
 		debug_func_msg("walk: tcp=%p, queue=%p",
 			       tcp, tcp->unwind_queue->head);
-		unwinder.tcb_walk(tcp, queue_put_call, queue_put_error,
-				  tcp->unwind_queue);
+		if (stack_trace_deferred)
+			unwinder->tcb_walk_frames(tcp, queue_put_frame,
+						  queue_put_error,
+						  tcp->unwind_queue);
+		else
+			unwinder->tcb_walk(tcp, queue_put_call, queue_put_error,
+					   tcp->unwind_queue);
 	}
 }
+
+/*
+ * Symbolize the frames captured in deferred mode, and print them
+ * if they were captured for printing.  This is called once the tracee
+ * has been restarted, so the symbol lookup does not prolong the stop.
+ */
+void
+unwind_tcb_flush(struct tcb *tcp)
+{
+	struct unwind_queue_t *queue = tcp->unwind_queue;
+
+	if (!queue || !queue->head)
+		return;
+
+	if (queue->print_pending)
+		queue_print(queue);
+	else
+		queue_resolve(queue);
+}
@@ -28,13 +28,36 @@ typedef void (*unwind_error_action_fn)(void *data,
 				       const char *error,
 				       unsigned long true_offset);
 
+/*
+ * Identity of a binary, the same for all processes mapping it:
+ * owned by the unwinder and never freed.
+ */
+struct unwind_module_id {
+	const char *binary_filename;
+	const char *build_id;	/* hex string, NULL if unknown */
+};
+
+/*
+ * Type used in raw stacktrace walker: the module handle is opaque
+ * and may be passed to symbolize() until the stack is walked again
+ * with the same context, or the context is destroyed.
+ */
+typedef void (*unwind_frame_action_fn)(void *data,
+				       const struct unwind_module_id *id,
+				       void *module,
+				       unsigned long pc,
+				       unsigned long true_offset);
+
 struct unwind_unwinder_t {
 	const char *name;
 
 	/* Initialize the unwinder. */
 	void   (*init)(void);
 
-	/* Make/destroy the context data attached to tcb. */
+	/*
+	 * Make/destroy the context data attached to tcb.
+	 * The context may be shared by threads of the same process.
+	 */
 	void * (*tcb_init)(struct tcb *);
 	void   (*tcb_fin)(struct tcb *);
 
@@ -43,8 +66,44 @@ struct unwind_unwinder_t {
 			   unwind_call_action_fn,
 			   unwind_error_action_fn,
 			   void *);
+
+	/*
+	 * Walk the stack without looking up symbols,
+	 * optional (required for deferred symbolization).
+	 */
+	void   (*tcb_walk_frames)(struct tcb *,
+				  unwind_frame_action_fn,
+				  unwind_error_action_fn,
+				  void *);
+
+	/*
+	 * Look up the symbol covering pc in the module reported by
+	 * tcb_walk_frames, optional.
+	 */
+	const char * (*symbolize)(void *module, unsigned long pc,
+				  unwind_function_offset_t *);
+
+	/*
+	 * Report the frames at the given addresses, the innermost first,
+	 * to either call_action or frame_action (optional).
+	 * This lets unwinders that only collect the addresses
+	 * share symbolization with a full-featured one.
+	 */
+	void   (*tcb_report_pcs)(struct tcb *,
+				 const unsigned long *pcs,
+				 size_t count,
+				 unwind_call_action_fn,
+				 unwind_frame_action_fn,
+				 unwind_error_action_fn,
+				 void *);
 };
 
-extern const struct unwind_unwinder_t unwinder;
+# ifdef USE_LIBDW
+extern const struct unwind_unwinder_t unwinder_libdw;
+extern const struct unwind_unwinder_t unwinder_fp;
+# endif
+# ifdef USE_LIBUNWIND
+extern const struct unwind_unwinder_t unwinder_libunwind;
+# endif
 
 #endif /* !STRACE_UNWIND_H */
@@ -20,8 +20,10 @@ upeek(struct tcb *tcp, unsigned long off, kernel_ulong_t *res)
 {
 	long val;
 
+	self_stats_begin(SELF_STATS_PTRACE, PTRACE_PEEKUSER);
 	errno = 0;
 	val = ptrace(PTRACE_PEEKUSER, (pid_t) tcp->pid, (void *) off, 0);
+	self_stats_end();
 	if (val == -1 && errno) {
 		if (errno != ESRCH)
 			perror_func_msg("PTRACE_PEEKUSER pid:%d @0x%lx)",
@@ -23,6 +23,7 @@
 #endif
 #include <sys/uio.h>
 
+#include "fd_cache.h"
 #include "largefile_wrappers.h"
 #include "number_set.h"
 #include "print_utils.h"
@@ -155,6 +156,20 @@ ts_max(const struct timespec *a, const struct timespec *b)
 	return ts_cmp(a, b) > 0 ? a : b;
 }
 
+/*
+ * Returns CLOCK_MONOTONIC in nanoseconds.  It is read through vDSO
+ * at the cost of a few dozen nanoseconds, which is negligible compared
+ * to the syscalls measured by --self-stats and --decoder-stats.
+ */
+uint64_t
+monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 int
 parse_ts(const char *s, struct timespec *t)
 {
@@ -516,19 +531,32 @@ getfdproto(struct tcb *tcp, int fd)
 	if (fd < 0)
 		return SOCK_PROTO_UNKNOWN;
 
+	struct fd_cache_entry *entry = fd_cache_get(tcp, fd);
+	if (entry && entry->proto_cached)
+		return entry->proto;
+
+	enum sock_proto proto = SOCK_PROTO_UNKNOWN;
+
 	xsprintf(path, "/proc/%u/fd/%u", get_proc_pid(tcp->pid), fd);
 	r = getxattr(path, "system.sockprotoname", buf, bufsize - 1);
-	if (r <= 0)
-		return SOCK_PROTO_UNKNOWN;
-	else {
+	if (r > 0) {
 		/*
 		 * This is a protection for the case when the kernel
 		 * side does not append a null byte to the buffer.
 		 */
 		buf[r] = '\0';
 
-		return get_proto_by_name(buf);
+		proto = get_proto_by_name(buf);
+	} else if (errno != ENODATA && errno != EOPNOTSUPP) {
+		/* The descriptor is not open, do not cache that. */
+		return proto;
 	}
+
+	if (entry) {
+		entry->proto = proto;
+		entry->proto_cached = true;
+	}
+	return proto;
 #else
 	return SOCK_PROTO_UNKNOWN;
 #endif
@@ -538,6 +566,11 @@ unsigned long
 getfdinode(struct tcb *tcp, int fd)
 {
 	char path[PATH_MAX + 1];
+	unsigned long inode = 0;
+
+	struct fd_cache_entry *entry = fd_cache_get(tcp, fd);
+	if (entry && entry->inode_cached)
+		return entry->inode;
 
 	if (getfdpath(tcp, fd, path, sizeof(path)) >= 0) {
 		const char *str = STR_STRIP_PREFIX(path, "socket:[");
@@ -545,11 +578,16 @@ getfdinode(struct tcb *tcp, int fd)
 		if (str != path) {
 			const size_t str_len = strlen(str);
 			if (str_len && str[str_len - 1] == ']')
-				return strtoul(str, NULL, 10);
+				inode = strtoul(str, NULL, 10);
 		}
 	}
 
-	return 0;
+	/* The path is cached only if the descriptor is open. */
+	if (entry && entry->path) {
+		entry->inode = inode;
+		entry->inode_cached = true;
+	}
+	return inode;
 }
 
 static bool
@@ -567,27 +605,43 @@ printsocket(struct tcb *tcp, int fd, const char *path)
 }
 
 static bool
-printdev(struct tcb *tcp, int fd, const char *path)
+printdev(struct fd_cache_entry *entry, const char *path)
 {
-	strace_stat_t st;
+	unsigned int mode;
+	unsigned long long rdev;
 
 	if (path[0] != '/')
 		return false;
 
-	if (stat_file(path, &st)) {
-		debug_func_perror_msg("stat(\"%s\")", path);
-		return false;
+	if (entry && entry->stat_cached) {
+		mode = entry->mode;
+		rdev = entry->rdev;
+	} else {
+		strace_stat_t st;
+
+		if (stat_file(path, &st)) {
+			debug_func_perror_msg("stat(\"%s\")", path);
+			return false;
+		}
+
+		mode = st.st_mode & S_IFMT;
+		rdev = st.st_rdev;
+		if (entry && entry->path) {
+			entry->mode = mode;
+			entry->rdev = rdev;
+			entry->stat_cached = true;
+		}
 	}
 
-	switch (st.st_mode & S_IFMT) {
+	switch (mode) {
 	case S_IFBLK:
 	case S_IFCHR:
 		print_quoted_string_ex(path, strlen(path),
 				       QUOTE_OMIT_LEADING_TRAILING_QUOTES,
 				       "<>");
 		tprintf("<%s %u:%u>",
-			S_ISBLK(st.st_mode)? "block" : "char",
-			major(st.st_rdev), minor(st.st_rdev));
+			S_ISBLK(mode)? "block" : "char",
+			major(rdev), minor(rdev));
 		return true;
 	}
 
@@ -649,15 +703,18 @@ void
 printfd_pid(struct tcb *tcp, pid_t pid, int fd)
 {
 	char path[PATH_MAX + 1];
+	/* The fd cache is available for descriptors of the tracee only. */
+	const bool own_fd = tcp && pid == tcp->pid;
 	if (pid > 0 && !number_set_array_is_empty(decode_fd_set, 0)
-	    && getfdpath_pid(pid, fd, path, sizeof(path)) >= 0) {
+	    && (own_fd ? getfdpath(tcp, fd, path, sizeof(path))
+		       : getfdpath_pid(pid, fd, path, sizeof(path))) >= 0) {
 		PRINT_VAL_D(fd);
 		tprints("<");
 		if (is_number_in_set(DECODE_FD_SOCKET, decode_fd_set) &&
 		    printsocket(tcp, fd, path))
 			goto printed;
 		if (is_number_in_set(DECODE_FD_DEV, decode_fd_set) &&
-		    printdev(tcp, fd, path))
+		    printdev(own_fd ? fd_cache_get(tcp, fd) : NULL, path))
 			goto printed;
 		if (is_number_in_set(DECODE_FD_PIDFD, decode_fd_set) &&
 		    printpidfd(pid, fd, path))
@@ -1048,6 +1105,57 @@ printpath(struct tcb *const tcp, const kernel_ulong_t addr)
 	return printpathn(tcp, addr, PATH_MAX - 1);
 }
 
+static char *printstr_str;
+static char *printstr_outstr;
+
+/* Allocate static buffers of printstr_ex if they are not allocated yet. */
+static void
+alloc_printstr_buffers(void)
+{
+	if (printstr_str)
+		return;
+
+	const unsigned int outstr_size =
+		4 * max_strlen + /* for quotes and NUL */ 3;
+	/*
+	 * We can assume that outstr_size / 4 == max_strlen
+	 * since we have a guarantee that max_strlen <= -1U / 4.
+	 */
+
+	printstr_str = xmalloc(max_strlen + 1);
+	printstr_outstr = xmalloc(outstr_size);
+}
+
+/*
+ * Print `size' bytes of the string fetched to printstr_str,
+ * `len' and `style' have the same meaning as in printstr_ex.
+ */
+static void
+print_fetched_str(unsigned int size, const kernel_ulong_t len,
+		  const unsigned int style)
+{
+	char *const str = printstr_str;
+	char *const outstr = printstr_outstr;
+	int ellipsis;
+
+	if (size > max_strlen)
+		size = max_strlen;
+	else
+		str[size] = '\xff';
+
+	/* If string_quote didn't see NUL and (it was supposed to be ASCIZ str
+	 * or we were requested to print more than -s NUM chars)...
+	 */
+	ellipsis = string_quote(str, outstr, size, style, NULL)
+		   && len
+		   && ((style & (QUOTE_0_TERMINATED | QUOTE_EXPECT_TRAILING_0))
+		       || len > max_strlen);
+
+	tprints(outstr);
+	if (ellipsis)
+		tprint_more_data_follows();
+}
+
 /*
  * Print string specified by address `addr' and length `len'.
  * If `user_style' has QUOTE_0_TERMINATED bit set, treat the string
@@ -1063,30 +1171,15 @@ int
 printstr_ex(struct tcb *const tcp, const kernel_ulong_t addr,
 	    const kernel_ulong_t len, const unsigned int user_style)
 {
-	static char *str;
-	static char *outstr;
-
 	unsigned int size;
 	unsigned int style = user_style;
 	int rc;
-	int ellipsis;
 
 	if (!addr) {
 		tprints("NULL");
 		return -1;
 	}
-	/* Allocate static buffers if they are not allocated yet. */
-	if (!str) {
-		const unsigned int outstr_size =
-			4 * max_strlen + /* for quotes and NUL */ 3;
-		/*
-		 * We can assume that outstr_size / 4 == max_strlen
-		 * since we have a guarantee that max_strlen <= -1U / 4.
-		 */
-
-		str = xmalloc(max_strlen + 1);
-		outstr = xmalloc(outstr_size);
-	}
+	alloc_printstr_buffers();
 
 	/* Fetch one byte more because string_quote may look one byte ahead. */
 	size = max_strlen + 1;
@@ -1094,33 +1187,41 @@ printstr_ex(struct tcb *const tcp, const kernel_ulong_t addr,
 	if (size > len)
 		size = len;
 	if (style & QUOTE_0_TERMINATED)
-		rc = umovestr(tcp, addr, size, str);
+		rc = umovestr(tcp, addr, size, printstr_str);
 	else
-		rc = umoven(tcp, addr, size, str);
+		rc = umoven(tcp, addr, size, printstr_str);
 
 	if (rc < 0) {
 		printaddr(addr);
 		return rc;
 	}
 
-	if (size > max_strlen)
-		size = max_strlen;
-	else
-		str[size] = '\xff';
+	print_fetched_str(size, len, style);
 
-	/* If string_quote didn't see NUL and (it was supposed to be ASCIZ str
-	 * or we were requested to print more than -s NUM chars)...
-	 */
-	ellipsis = string_quote(str, outstr, size, style, NULL)
-		   && len
-		   && ((style & (QUOTE_0_TERMINATED | QUOTE_EXPECT_TRAILING_0))
-		       || len > max_strlen);
+	return rc;
+}
 
-	tprints(outstr);
-	if (ellipsis)
-		tprint_more_data_follows();
+/*
+ * Print a NUL-terminated string the same way as printstr does,
+ * given the first `buf_len' bytes of it fetched from the tracee to `buf'.
+ *
+ * Returns false and prints nothing if `buf' contains neither
+ * the terminating NUL nor enough bytes to print the string.
+ */
+bool
+printstr_prefetched(const char *const buf, const unsigned int buf_len)
+{
+	/* One byte more is needed as in printstr_ex. */
+	const unsigned int size = max_strlen + 1;
 
-	return rc;
+	if (buf_len < size && !memchr(buf, '\0', buf_len))
+		return false;
+
+	alloc_printstr_buffers();
+	memcpy(printstr_str, buf, MIN(buf_len, size));
+	print_fetched_str(size, -1, QUOTE_0_TERMINATED);
+
+	return true;
 }
 
 bool
@@ -1216,7 +1317,9 @@ dumpiov_upto(struct tcb *const tcp, const int len, const kernel_ulong_t addr,
 			data_size -= iov_len;
 			/* include the buffer number to make it easy to
 			 * match up the trace with the source */
-			tprintf(" * %" PRI_klu " bytes in buffer %d\n", iov_len, i);
+			if (!payload_capturing())
+				tprintf(" * %" PRI_klu " bytes in buffer %d\n",
+					iov_len, i);
 			dumpstr(tcp, iov_iov_base(i), iov_len);
 		}
 	}
@@ -1261,6 +1364,9 @@ dumpstr(struct tcb *const tcp, const kernel_ulong_t addr,
 	static_assert(!(DUMPSTR_WIDTH_BYTES & DUMPSTR_BYTES_MASK),
 		      "DUMPSTR_WIDTH_BYTES is not power of 2");
 
+	if (payload_capture_data(tcp, addr, len))
+		return;
+
 	if (len > len + DUMPSTR_WIDTH_BYTES || addr + len < addr) {
 		debug_func_msg("len %" PRI_klu " at addr %#" PRI_klx
 			       " is too big, skipped", len, addr);
@@ -1378,6 +1484,20 @@ tfetch_mem64_ignore_syserror(struct tcb *const tcp, const uint64_t addr,
 	       !umoven(tcp, addr, len, our_addr);
 }
 
+bool
+tfetch_mem(struct tcb *const tcp, const kernel_ulong_t addr,
+	   const unsigned int len, void *const our_addr)
+{
+	return tfetch_mem64(tcp, addr, len, our_addr);
+}
+
+bool
+tfetch_mem_ignore_syserror(struct tcb *const tcp, const kernel_ulong_t addr,
+			   const unsigned int len, void *const our_addr)
+{
+	return tfetch_mem64_ignore_syserror(tcp, addr, len, our_addr);
+}
+
 int
 umoven_or_printaddr64(struct tcb *const tcp, const uint64_t addr,
 		      const unsigned int len, void *const our_addr)
@@ -1480,6 +1600,34 @@ print_fd_array_member(struct tcb *tcp, void *elem_buf, size_t elem_size,
 	return true;
 }
 
+/* The maximum size of array elements prefetched at once by print_array_ex. */
+#define PRINT_ARRAY_PREFETCH_SIZE	65536
+
+/*
+ * Fetch up to `len' bytes of array elements at `addr' with a single read,
+ * provided that tfetch_mem_func is one of the fetchers that would read
+ * them from the tracee memory as is.
+ *
+ * Returns the number of leading bytes fetched.
+ */
+static unsigned int
+prefetch_array(struct tcb *const tcp, const kernel_ulong_t addr,
+	       const unsigned int len, void *const buf,
+	       const tfetch_mem_fn tfetch_mem_func)
+{
+	if (tfetch_mem_func == tfetch_mem) {
+		if (!verbose(tcp) || (exiting(tcp) && syserror(tcp)))
+			return 0;
+	} else if (tfetch_mem_func == tfetch_mem_ignore_syserror) {
+		if (!verbose(tcp))
+			return 0;
+	} else {
+		return 0;
+	}
+
+	return umoven_partial(tcp, addr, len, buf);
+}
+
 /*
  * Iteratively fetch and print up to nmemb elements of elem_size size
  * from the array that starts at tracee's address start_addr.
@@ -1554,11 +1702,43 @@ print_array_ex(struct tcb *const tcp,
 	enum xlat_style xlat_style = flags & XLAT_STYLE_MASK;
 	bool truncated = false;
 
+	/*
+	 * The elements up to the abbreviation limit are prefetched
+	 * in batches; after a partial read, the rest of them are fetched
+	 * one by one, so that the inaccessible element is reported.
+	 */
+	const kernel_ulong_t fetch_end =
+		abbrev_end < end_addr ? abbrev_end + elem_size : end_addr;
+	const unsigned int batch_size =
+		PRINT_ARRAY_PREFETCH_SIZE / elem_size * elem_size;
+	bool prefetch = tfetch_mem_func && batch_size &&
+			fetch_end - start_addr > elem_size;
+	char *prefetch_buf = NULL;
+	kernel_ulong_t prefetch_start = start_addr;
+	kernel_ulong_t prefetch_end = start_addr;
+
 	for (cur = start_addr; cur < end_addr; cur += elem_size, idx++) {
 		if (cur != start_addr)
 			tprint_array_next();
 
-		if (tfetch_mem_func) {
+		if (prefetch && cur >= prefetch_end && cur < fetch_end) {
+			const unsigned int len = MIN(fetch_end - cur, batch_size);
+
+			if (!prefetch_buf)
+				prefetch_buf = xmalloc(len);
+
+			const unsigned int fetched =
+				prefetch_array(tcp, cur, len, prefetch_buf,
+					       tfetch_mem_func);
+			prefetch_start = cur;
+			prefetch_end = cur + fetched / elem_size * elem_size;
+			prefetch = fetched == len;
+		}
+
+		if (cur < prefetch_end) {
+			memcpy(elem_buf, prefetch_buf + (cur - prefetch_start),
+			       elem_size);
+		} else if (tfetch_mem_func) {
 			if (!tfetch_mem_func(tcp, cur, elem_size, elem_buf)) {
 				if (cur == start_addr)
 					printaddr(cur);
@@ -1613,6 +1793,8 @@ print_array_ex(struct tcb *const tcp,
 		tprint_array_end();
 	}
 
+	free(prefetch_buf);
+
 	return cur >= end_addr;
 }
 
@@ -0,0 +1,102 @@
+/*
+ * Transfer data via a pipe and a TCP connection on fixed descriptors,
+ * then via new pipes opened with the same descriptor numbers,
+ * so that strace --dump-dir and --pcap could be checked.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define PIPE_RD		10
+#define PIPE_WR		11
+#define TCP_CLIENT	12
+#define TCP_SERVER	13
+
+static void
+xdup2(int oldfd, int newfd)
+{
+	if (dup2(oldfd, newfd) != newfd)
+		perror_msg_and_fail("dup2");
+	close(oldfd);
+}
+
+int
+main(void)
+{
+	int fds[2];
+
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+	xdup2(fds[0], PIPE_RD);
+	xdup2(fds[1], PIPE_WR);
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t len = sizeof(addr);
+	const int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	if (listen_fd < 0)
+		perror_msg_and_skip("socket");
+	if (bind(listen_fd, (struct sockaddr *) &addr, len) ||
+	    listen(listen_fd, 1) ||
+	    getsockname(listen_fd, (struct sockaddr *) &addr, &len))
+		perror_msg_and_skip("bind");
+
+	const int client_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (client_fd < 0)
+		perror_msg_and_fail("socket");
+	if (connect(client_fd, (struct sockaddr *) &addr, len))
+		perror_msg_and_fail("connect");
+	xdup2(client_fd, TCP_CLIENT);
+
+	const int server_fd = accept(listen_fd, NULL, NULL);
+	if (server_fd < 0)
+		perror_msg_and_fail("accept");
+	xdup2(server_fd, TCP_SERVER);
+
+	char buf[16];
+	struct iovec iov[] = {
+		{ .iov_base = buf, .iov_len = 3 },
+		{ .iov_base = buf + 3, .iov_len = 3 },
+	};
+
+	if (write(PIPE_WR, "0123456789", 10) != 10 ||
+	    read(PIPE_RD, buf, 4) != 4 ||
+	    readv(PIPE_RD, iov, 2) != 6)
+		perror_msg_and_fail("pipe i/o");
+
+	if (write(TCP_CLIENT, "hello", 5) != 5 ||
+	    read(TCP_SERVER, buf, 5) != 5)
+		perror_msg_and_fail("tcp i/o");
+
+	/* A new pipe opened after the descriptor is closed. */
+	close(PIPE_WR);
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+	xdup2(fds[1], PIPE_WR);
+	if (write(PIPE_WR, "again", 5) != 5)
+		perror_msg_and_fail("pipe i/o");
+
+	/* A new pipe replacing the open descriptor. */
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+	xdup2(fds[1], PIPE_WR);
+	if (write(PIPE_WR, "third", 5) != 5)
+		perror_msg_and_fail("pipe i/o");
+
+	printf("%d\n", getpid());
+	return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ * Check --entry-only option.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+int
+main(void)
+{
+	static const char data[] = "data";
+	char buf[sizeof(data) - 1];
+	const struct iovec w_iov = {
+		.iov_base = (void *) data,
+		.iov_len = sizeof(data) - 1
+	};
+	const struct iovec r_iov = {
+		.iov_base = buf,
+		.iov_len = sizeof(buf)
+	};
+	int fds[2];
+
+	if (pipe(fds))
+		perror_msg_and_skip("pipe");
+
+	if (writev(fds[1], &w_iov, 1) != (ssize_t) w_iov.iov_len)
+		perror_msg_and_fail("writev");
+	printf("writev(%d, [{iov_base=\"%s\", iov_len=%zu}], 1) = ?\n",
+	       fds[1], data, w_iov.iov_len);
+
+	/* The data read is not going to be printed.  */
+	if (readv(fds[0], &r_iov, 1) != (ssize_t) r_iov.iov_len)
+		perror_msg_and_fail("readv");
+	printf("readv(%d, ...) = ?\n", fds[0]);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Check decoding performance of execve with a long argument list.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define NUM_ARGS 10000
+#define FILENAME "test.execve-perf"
+
+static volatile bool stop = false;
+
+static void
+handler(int signo)
+{
+	stop = true;
+}
+
+int
+main(void)
+{
+	static char args[NUM_ARGS][sizeof("arg") + sizeof(int) * 3];
+	static char *argv[NUM_ARGS + 1];
+	static char *const envp[] = { (char *) "PATH=/", NULL };
+	unsigned int i;
+
+	for (i = 0; i < NUM_ARGS; ++i) {
+		snprintf(args[i], sizeof(args[i]), "arg%u", i);
+		argv[i] = args[i];
+	}
+
+	signal(SIGALRM, handler);
+	alarm(1);
+
+	const char *errstr = sprintrc(execve(FILENAME, argv, envp));
+	for (i = 1; !stop; i++)
+		execve(FILENAME, argv, envp);
+
+	printf("execve(\"%s\", [", FILENAME);
+	for (unsigned int j = 0; j < NUM_ARGS; ++j)
+		printf("%s\"%s\"", j ? ", " : "", argv[j]);
+	printf("], [\"%s\"]) = %s\n", envp[0], errstr);
+	printf("%u\n", i);
+
+	return 0;
+}
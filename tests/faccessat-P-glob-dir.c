@@ -0,0 +1 @@
+#include "faccessat-P.c"
@@ -0,0 +1,120 @@
+/*
+ * Close, replace, and rename descriptors in ways strace might not notice,
+ * so that the fd cache of strace -y could be checked.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <linux/sched.h>
+
+#define FD	20
+
+static char dir[PATH_MAX + 1];
+
+static void
+open_fd(const char *path, int flags)
+{
+	int fd = open(path, flags, 0600);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", path);
+	if (fd != FD) {
+		if (dup2(fd, FD) != FD)
+			perror_msg_and_fail("dup2");
+		close(fd);
+	}
+}
+
+static void
+check_fd(const char *path, const char *cwd_path)
+{
+	int rc = fsync(FD);
+
+	printf("fsync(%d<", FD);
+	if (cwd_path) {
+		print_quoted_string_ex(dir, false, ">:");
+		printf("/%s", cwd_path);
+	} else {
+		printf("%s", path);
+	}
+	printf(">) = %s\n", sprintrc(rc));
+}
+
+int
+main(int argc, char **argv)
+{
+	skip_if_unavailable("/proc/self/fd/");
+
+	if (!getcwd(dir, sizeof(dir)))
+		perror_msg_and_fail("getcwd");
+
+	open_fd("/dev/null", O_RDONLY);
+	check_fd("/dev/null", NULL);
+
+	/* Closed and opened again. */
+	close(FD);
+	open_fd("/dev/zero", O_RDONLY);
+	check_fd("/dev/zero", NULL);
+
+	/* Replaced by dup2. */
+	open_fd("/dev/full", O_RDONLY);
+	check_fd("/dev/full", NULL);
+
+	/* Renamed and removed. */
+	close(FD);
+	open_fd("fd-cache.sample", O_RDONLY | O_CREAT);
+	check_fd(NULL, "fd-cache.sample");
+	if (rename("fd-cache.sample", "fd-cache.renamed"))
+		perror_msg_and_fail("rename");
+	check_fd(NULL, "fd-cache.renamed");
+	if (unlink("fd-cache.renamed"))
+		perror_msg_and_fail("unlink");
+	check_fd(NULL, "fd-cache.renamed (deleted)");
+
+	/*
+	 * Moved along with the directory it is in, this is not noticed
+	 * when the rename is not stopped at, see fd-cache.test.
+	 */
+	if (argc < 2) {
+		close(FD);
+		if (mkdir("fd-cache.dir", 0700))
+			perror_msg_and_fail("mkdir");
+		open_fd("fd-cache.dir/sample", O_RDONLY | O_CREAT);
+		check_fd(NULL, "fd-cache.dir/sample");
+		if (rename("fd-cache.dir", "fd-cache.moved"))
+			perror_msg_and_fail("rename");
+		check_fd(NULL, "fd-cache.moved/sample");
+		if (unlink("fd-cache.moved/sample") || rmdir("fd-cache.moved"))
+			perror_msg_and_fail("unlink");
+	}
+
+	/* Replaced by a process sharing the descriptor table. */
+	open_fd("/dev/zero", O_RDONLY);
+	check_fd("/dev/zero", NULL);
+	const pid_t pid = syscall(__NR_clone, CLONE_FILES | SIGCHLD, 0, 0, 0, 0);
+	if (pid < 0)
+		perror_msg_and_fail("clone");
+	if (!pid) {
+		open_fd("/dev/null", O_RDONLY);
+		_exit(0);
+	}
+
+	int status;
+	if (waitpid(pid, &status, 0) != pid || status)
+		perror_msg_and_fail("waitpid");
+	check_fd("/dev/null", NULL);
+
+	return 0;
+}
@@ -0,0 +1,76 @@
+/*
+ * Check that --flight-recorder writes the line of the syscall
+ * the tracee is blocked in on SIGUSR1.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static pid_t
+get_tracer_pid(void)
+{
+	FILE *fp = fopen("/proc/self/status", "r");
+	if (!fp)
+		perror_msg_and_fail("fopen");
+
+	char line[256];
+	int pid = 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "TracerPid: %d", &pid) == 1)
+			break;
+	}
+	fclose(fp);
+
+	return pid;
+}
+
+int
+main(void)
+{
+	/* Not traced when the expected output is generated. */
+	const pid_t tracer = get_tracer_pid();
+	char name[sizeof("flight-recorder-N")];
+	int fds[2];
+
+	if (pipe(fds))
+		perror_msg_and_fail("pipe");
+
+	/* These evict the lines recorded before main from the ring. */
+	for (unsigned int i = 0; i < 3; ++i) {
+		snprintf(name, sizeof(name), "flight-recorder-%u", i);
+		long rc = syscall(__NR_chdir, name);
+		printf("chdir(\"%s\") = %s\n", name, sprintrc(rc));
+	}
+	fflush(stdout);
+
+	const pid_t pid = fork();
+	if (pid < 0)
+		perror_msg_and_fail("fork");
+
+	if (!pid) {
+		/* Wait for the parent to block in read.  */
+		usleep(500000);
+		if (tracer && kill(tracer, SIGUSR1))
+			perror_msg_and_fail("kill");
+		usleep(500000);
+		if (write(fds[1], "", 1) != 1)
+			perror_msg_and_fail("write");
+		_exit(0);
+	}
+
+	char c;
+	if (read(fds[0], &c, 1) != 1)
+		perror_msg_and_fail("read");
+	printf("read(%d,  <unfinished ...>\n", fds[0]);
+
+	return 0;
+}
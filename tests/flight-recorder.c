@@ -0,0 +1,47 @@
+/*
+ * Check --flight-recorder option.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+static void
+do_chdir(const char *name, bool print)
+{
+	long rc = syscall(__NR_chdir, name);
+
+	if (print)
+		printf("chdir(\"%s\") = %s\n", name, sprintrc(rc));
+}
+
+int
+main(void)
+{
+	char name[sizeof("flight-recorder-NN")];
+	unsigned int i;
+
+	/* Only the last 2 of these are kept in the ring of 3 records. */
+	for (i = 0; i < 5; ++i) {
+		snprintf(name, sizeof(name), "flight-recorder-%u", i);
+		do_chdir(name, i >= 3);
+	}
+
+	/* This one fires the trigger. */
+	do_chdir("/dev/null/flight-recorder", true);
+
+	/* These are not written as there is no trigger afterwards. */
+	for (; i < 10; ++i) {
+		snprintf(name, sizeof(name), "flight-recorder-%u", i);
+		do_chdir(name, false);
+	}
+
+	return 0;
+}
@@ -0,0 +1,74 @@
+/*
+ * Wait on one futex and wake another one, then wait on a third futex
+ * until it is woken by another thread, so that strace --futex-profile
+ * could be checked.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#ifdef __NR_futex
+
+# include <errno.h>
+# include <pthread.h>
+# include <stdio.h>
+# include <time.h>
+# include <unistd.h>
+# include <linux/futex.h>
+
+static int waited = 1;
+static int woken;
+static int contended;
+
+static void *
+waker(void *arg)
+{
+	const struct timespec delay = { .tv_nsec = 1000000 };
+
+	/* Wake the main thread once it is waiting. */
+	while (syscall(__NR_futex, &contended, FUTEX_WAKE_PRIVATE, 1) != 1)
+		nanosleep(&delay, NULL);
+
+	return arg;
+}
+
+int
+main(void)
+{
+	const struct timespec timeout = { .tv_nsec = 100000000 };
+
+	/* Times out. */
+	if (syscall(__NR_futex, &waited, FUTEX_WAIT_PRIVATE, 1, &timeout)
+	    != -1)
+		error_msg_and_fail("FUTEX_WAIT did not time out");
+	/* Fails with EAGAIN as the value differs. */
+	if (syscall(__NR_futex, &waited, FUTEX_WAIT_PRIVATE, 0, &timeout)
+	    != -1)
+		error_msg_and_fail("FUTEX_WAIT did not fail");
+	if (syscall(__NR_futex, &woken, FUTEX_WAKE_PRIVATE, 1) != 0)
+		perror_msg_and_fail("FUTEX_WAKE");
+
+	pthread_t t;
+	errno = pthread_create(&t, NULL, waker, NULL);
+	if (errno)
+		perror_msg_and_fail("pthread_create");
+	if (syscall(__NR_futex, &contended, FUTEX_WAIT_PRIVATE, 0, NULL))
+		perror_msg_and_fail("FUTEX_WAIT");
+	errno = pthread_join(t, NULL);
+	if (errno)
+		perror_msg_and_fail("pthread_join");
+
+	printf("%d %p %p %p\n", getpid(), &waited, &woken, &contended);
+	return 0;
+}
+
+#else
+
+SKIP_MAIN_UNDEFINED("__NR_futex")
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ * This file is part of io-summary strace test.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+int
+main(void)
+{
+	static const char sample[] = "io-summary.sample";
+	static char buf[100];
+	static char data[300];
+
+	int fd = open(sample, O_CREAT|O_TRUNC|O_WRONLY, 0600);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", sample);
+	if (write(fd, data, sizeof(data)) != sizeof(data))
+		perror_msg_and_fail("write");
+	close(fd);
+
+	int in_fd = open(sample, O_RDONLY);
+	if (in_fd < 0)
+		perror_msg_and_fail("open: %s", sample);
+
+	fd = open("/dev/null", O_WRONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", "/dev/null");
+	for (unsigned int i = 0; i < 10; ++i) {
+		if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+			perror_msg_and_fail("write");
+	}
+	if (sendfile(fd, in_fd, NULL, sizeof(data)) != sizeof(data))
+		perror_msg_and_fail("sendfile");
+	close(fd);
+	close(in_fd);
+	unlink(sample);
+
+	fd = open("/dev/zero", O_RDONLY);
+	if (fd < 0)
+		perror_msg_and_fail("open: %s", "/dev/zero");
+	for (unsigned int i = 0; i < 3; ++i) {
+		if (read(fd, buf, 50) != 50)
+			perror_msg_and_fail("read");
+	}
+	for (unsigned int i = 0; i < 2; ++i) {
+		if (write(fd, buf, sizeof(buf)) != -1)
+			error_msg_and_fail("write to O_RDONLY descriptor");
+	}
+	close(fd);
+
+	return 0;
+}
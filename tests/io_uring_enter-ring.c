@@ -0,0 +1,122 @@
+/*
+ * Check decoding of io_uring submission and completion queue entries
+ * on io_uring_enter.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+#define ENTRIES 4
+
+static void *
+map_ring(int fd, size_t len, unsigned long long offset)
+{
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, fd, offset);
+	if (p == MAP_FAILED)
+		perror_msg_and_fail("mmap");
+	return p;
+}
+
+int
+main(void)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	const int fd = syscall(__NR_io_uring_setup, ENTRIES, &params);
+	if (fd < 0)
+		perror_msg_and_skip("io_uring_setup");
+
+	const size_t sq_len = params.sq_off.array +
+			      params.sq_entries * sizeof(uint32_t);
+	const size_t cq_len = params.cq_off.cqes +
+			      params.cq_entries * sizeof(struct io_uring_cqe);
+	const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+
+	char *sq = map_ring(fd, single_mmap ? MAX(sq_len, cq_len) : sq_len,
+			    IORING_OFF_SQ_RING);
+	char *cq = single_mmap ? sq : map_ring(fd, cq_len, IORING_OFF_CQ_RING);
+	struct io_uring_sqe *sqes =
+		map_ring(fd, params.sq_entries * sizeof(*sqes),
+			 IORING_OFF_SQES);
+
+	const int zero_fd = open("/dev/zero", O_RDONLY);
+	if (zero_fd < 0)
+		perror_msg_and_fail("open: %s", "/dev/zero");
+
+	static char buf[8];
+	static struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+
+	uint32_t *sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+	uint32_t *sq_array = (uint32_t *) (sq + params.sq_off.array);
+	const uint32_t sq_mask = *(uint32_t *) (sq + params.sq_off.ring_mask);
+	uint32_t tail = *sq_tail;
+
+	memset(&sqes[tail & sq_mask], 0, sizeof(*sqes));
+	sqes[tail & sq_mask].opcode = IORING_OP_NOP;
+	sqes[tail & sq_mask].fd = -1;
+	sqes[tail & sq_mask].user_data = 0xdead;
+	sq_array[tail & sq_mask] = tail & sq_mask;
+	++tail;
+
+	memset(&sqes[tail & sq_mask], 0, sizeof(*sqes));
+	sqes[tail & sq_mask].opcode = IORING_OP_READV;
+	sqes[tail & sq_mask].fd = zero_fd;
+	sqes[tail & sq_mask].addr = (unsigned long) &iov;
+	sqes[tail & sq_mask].len = 1;
+	sqes[tail & sq_mask].user_data = 0xbeef;
+	sq_array[tail & sq_mask] = tail & sq_mask;
+	++tail;
+
+	__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+	long rc = syscall(__NR_io_uring_enter, fd, 2, 2,
+			  IORING_ENTER_GETEVENTS, NULL, 0);
+	if (rc != 2)
+		perror_msg_and_skip("io_uring_enter");
+
+	printf("io_uring_enter(%d, 2, 2, IORING_ENTER_GETEVENTS, NULL, 0)"
+	       " = 2\n", fd);
+	printf(" > io_uring_sqe {opcode=IORING_OP_NOP, fd=-1, off=0"
+	       ", addr=NULL, len=0, user_data=0xdead}\n");
+	printf(" > io_uring_sqe {opcode=IORING_OP_READV, fd=%d, off=0"
+	       ", addr=%p, len=1, user_data=0xbeef}\n", zero_fd, &iov);
+
+	uint32_t *cq_head = (uint32_t *) (cq + params.cq_off.head);
+	const uint32_t cq_tail = __atomic_load_n((uint32_t *)
+						 (cq + params.cq_off.tail),
+						 __ATOMIC_ACQUIRE);
+	const uint32_t cq_mask = *(uint32_t *) (cq + params.cq_off.ring_mask);
+	const struct io_uring_cqe *cqes =
+		(struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	for (uint32_t head = *cq_head; head != cq_tail; ++head) {
+		const struct io_uring_cqe *cqe = &cqes[head & cq_mask];
+
+		printf(" < io_uring_cqe {user_data=%#llx, res=%d, flags=%#x}\n",
+		       (unsigned long long) cqe->user_data, cqe->res,
+		       cqe->flags);
+	}
+	__atomic_store_n(cq_head, cq_tail, __ATOMIC_RELEASE);
+
+	/* The consumed CQEs are not printed again. */
+	rc = syscall(__NR_io_uring_enter, fd, 0, 0, 0, NULL, 0);
+	printf("io_uring_enter(%d, 0, 0, 0, NULL, 0) = %s\n",
+	       fd, sprintrc(rc));
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * Make several processes invoke syscalls in turn, so that
+ * strace -ff --max-output-files=N with N less than the number of processes
+ * has to close and reopen their output files.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define CHILDREN 4
+#define ROUNDS   3
+
+static void
+xread(int fd)
+{
+	char c;
+
+	if (read(fd, &c, 1) != 1)
+		perror_msg_and_fail("read");
+}
+
+static void
+xwrite(int fd)
+{
+	if (write(fd, "", 1) != 1)
+		perror_msg_and_fail("write");
+}
+
+int
+main(void)
+{
+	pid_t pids[CHILDREN];
+	int go[CHILDREN][2];
+	int done[2];
+
+	if (pipe(done))
+		perror_msg_and_fail("pipe");
+
+	for (unsigned int i = 0; i < CHILDREN; ++i) {
+		if (pipe(go[i]))
+			perror_msg_and_fail("pipe");
+
+		pids[i] = fork();
+		if (pids[i] < 0)
+			perror_msg_and_fail("fork");
+
+		if (!pids[i]) {
+			const int pid = getpid();
+
+			for (unsigned int r = 0; r < ROUNDS; ++r) {
+				char path[sizeof("/dev/null/") + sizeof(int) * 6];
+
+				xread(go[i][0]);
+				snprintf(path, sizeof(path), "/dev/null/%d/%u",
+					 pid, r);
+				if (chdir(path) == 0)
+					error_msg_and_fail("chdir: %s", path);
+				xwrite(done[1]);
+			}
+			return 0;
+		}
+	}
+
+	for (unsigned int r = 0; r < ROUNDS; ++r) {
+		for (unsigned int i = 0; i < CHILDREN; ++i) {
+			xwrite(go[i][1]);
+			xread(done[0]);
+		}
+	}
+
+	for (unsigned int i = 0; i < CHILDREN; ++i) {
+		int status;
+
+		if (waitpid(pids[i], &status, 0) != pids[i])
+			perror_msg_and_fail("waitpid");
+		if (status)
+			error_msg_and_fail("child %d: status %#x",
+					   pids[i], status);
+		printf("%d\n", pids[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1 @@
+#include "net-yy-netlink.c"
@@ -0,0 +1,42 @@
+/*
+ * Check that -P selects an existing path containing wildcards
+ * as an ordinary path in addition to the glob pattern.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include "scno.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+	static const char literal[] = "pathtrace[1].sample";
+	static const char matched[] = "pathtrace1.sample";
+	static const char unmatched[] = "pathtrace2.sample";
+
+	long fd = syscall(__NR_openat, -100, literal, O_RDONLY);
+	if (fd < 0)
+		perror_msg_and_fail("openat: %s", literal);
+	printf("openat(AT_FDCWD, \"%s\", O_RDONLY) = %ld\n", literal, fd);
+
+	/* The descriptor is matched by its canonical path. */
+	if (close(fd))
+		perror_msg_and_fail("close");
+	printf("close(%ld) = 0\n", fd);
+
+	long rc = syscall(__NR_openat, -100, matched, O_RDONLY);
+	printf("openat(AT_FDCWD, \"%s\", O_RDONLY) = %s\n",
+	       matched, sprintrc(rc));
+
+	syscall(__NR_openat, -100, unmatched, O_RDONLY);
+
+	puts("+++ exited with 0 +++");
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Spawn two children, one of which executes this program again
+ * and runs longer, so that strace --process-profile could be checked.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static void
+sleep_ms(long ms)
+{
+	const struct timespec ts = {
+		.tv_sec = ms / 1000,
+		.tv_nsec = ms % 1000 * 1000000
+	};
+
+	if (nanosleep(&ts, NULL))
+		perror_msg_and_fail("nanosleep");
+}
+
+static pid_t
+xfork(void)
+{
+	const pid_t pid = fork();
+
+	if (pid < 0)
+		perror_msg_and_fail("fork");
+	return pid;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 1) {
+		sleep_ms(atol(argv[1]));
+		return 0;
+	}
+
+	const pid_t short_pid = xfork();
+	if (!short_pid) {
+		sleep_ms(100);
+		_exit(1);
+	}
+
+	const pid_t long_pid = xfork();
+	if (!long_pid) {
+		char *const args[] = { argv[0], (char *) "300", NULL };
+
+		execv("/proc/self/exe", args);
+		perror_msg_and_fail("execv");
+	}
+
+	int status;
+	if (waitpid(short_pid, &status, 0) != short_pid ||
+	    waitpid(long_pid, &status, 0) != long_pid)
+		perror_msg_and_fail("waitpid");
+
+	printf("%d %d %d\n", getpid(), short_pid, long_pid);
+	return 0;
+}
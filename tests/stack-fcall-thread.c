@@ -0,0 +1,41 @@
+/*
+ * Call the stack-fcall functions from a thread other than the main one,
+ * so that its stack is an anonymous mapping.
+ *
+ * Copyright (c) 2021 The strace developers.
+ * All rights reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "tests.h"
+#include <errno.h>
+#include <pthread.h>
+#include "stack-fcall.h"
+
+static void *
+thread(void *arg)
+{
+	int ac = (int) (intptr_t) arg;
+
+	for (;;)
+		ac += f0(ac, (unsigned long) (void *) thread);
+
+	return NULL;
+}
+
+int
+main(int ac, char **av)
+{
+	pthread_t t;
+
+	errno = pthread_create(&t, NULL, thread, (void *) (intptr_t) ac);
+	if (errno)
+		perror_msg_and_fail("pthread_create");
+
+	errno = pthread_join(t, NULL);
+	if (errno)
+		perror_msg_and_fail("pthread_join");
+
+	return 0;
+}